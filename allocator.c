@@ -0,0 +1,554 @@
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALLOC_VK_CHECK(expr) do { \
+    VkResult result = expr; \
+    if (result != VK_SUCCESS) { \
+        fprintf(stderr, "%s failed with error: %d\n", #expr, result); \
+        exit(1); \
+    } \
+} while(0)
+
+static
+uint32_t alloc_order_for_size(VkDeviceSize size) {
+    uint32_t order = 0;
+    while ((ALLOC_MIN_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+static
+uint8_t alloc_max_u8(uint8_t a, uint8_t b) {
+    return a > b ? a : b;
+}
+
+void alloc_init(Allocator *a, VkPhysicalDevice phys_device, VkDevice device) {
+    memset(a, 0, sizeof(*a));
+    a->device = device;
+
+    vkGetPhysicalDeviceMemoryProperties(phys_device, &a->mem_prop);
+
+    VkPhysicalDeviceProperties prop;
+    vkGetPhysicalDeviceProperties(phys_device, &prop);
+    a->non_coherent_atom = prop.limits.nonCoherentAtomSize > 0 ? prop.limits.nonCoherentAtomSize : 1;
+
+    for (uint32_t usage = 0; usage < ALLOC_USAGE_COUNT; usage++) {
+        int best_score = -1;
+        uint32_t best_type = UINT32_MAX;
+        for (uint32_t i = 0; i < a->mem_prop.memoryTypeCount; i++) {
+            int score = alloc_score_memory_type(a, i, usage);
+            if (score > best_score) {
+                best_score = score;
+                best_type = i;
+            }
+        }
+
+        const char *names[ALLOC_USAGE_COUNT] = {"gpu only", "upload", "readback"};
+        printf("Allocator: %s prefers memory type %d\n", names[usage], best_type);
+    }
+}
+
+void alloc_deinit(Allocator *a) {
+    if (a->stats.used_bytes > 0 || a->stats.dedicated_count > 0) {
+        fprintf(stderr, "Allocator: %lu bytes and %d dedicated allocations leaked\n",
+            (unsigned long)a->stats.used_bytes, a->stats.dedicated_count);
+    }
+
+    for (uint32_t i = 0; i < a->block_count; i++) {
+        AllocBlock *block = &a->blocks[i];
+        if (block->memory == VK_NULL_HANDLE) {
+            continue;
+        }
+        if (block->mapped != NULL) {
+            vkUnmapMemory(a->device, block->memory);
+        }
+        vkFreeMemory(a->device, block->memory, NULL);
+        free(block->longest);
+    }
+
+    // Freeing mapped memory unmaps it implicitly
+    for (uint32_t i = 0; i < a->dedicated_slots; i++) {
+        if (a->dedicated[i] != VK_NULL_HANDLE) {
+            vkFreeMemory(a->device, a->dedicated[i], NULL);
+        }
+    }
+
+    a->block_count = 0;
+    a->dedicated_slots = 0;
+}
+
+int alloc_score_memory_type(const Allocator *a, uint32_t memory_type, AllocUsage usage) {
+    VkMemoryPropertyFlags flags = a->mem_prop.memoryTypes[memory_type].propertyFlags;
+
+    // Lazily allocated is only for transient attachments, protected needs protected submits
+    if (flags & (VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT | VK_MEMORY_PROPERTY_PROTECTED_BIT)) {
+        return -1;
+    }
+
+    int device_local = (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+    int host_visible = (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+    int coherent = (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    int cached = (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0;
+
+    switch (usage) {
+    case ALLOC_USAGE_GPU_ONLY:
+        // Host visible device local memory is small on discrete GPUs, leave it for uploads
+        return 1 + device_local * 100 - host_visible * 10;
+    case ALLOC_USAGE_UPLOAD:
+        if (!host_visible) {
+            return -1;
+        }
+        // Device local is ReBAR or integrated GPU, GPU reads it at full speed.
+        // Cached memory is fine, but write combined is what sequential writes want
+        return 1 + device_local * 40 + coherent * 20 - cached * 5;
+    case ALLOC_USAGE_READBACK:
+        if (!host_visible) {
+            return -1;
+        }
+        // Uncached reads are slower by an order of magnitude
+        return 1 + cached * 100 + coherent * 20 - device_local * 10;
+    default:
+        return -1;
+    }
+}
+
+// Node is at depth, so its buddies are of order block->order - depth
+static
+void alloc_tree_update_parents(AllocBlock *block, uint32_t node, uint32_t depth) {
+    while (node > 0) {
+        uint32_t parent = (node - 1) / 2;
+        uint32_t left = parent * 2 + 1;
+        uint32_t right = left + 1;
+
+        // Value of completely free child, order + 1
+        uint8_t child_full = (uint8_t)(block->order - depth + 1);
+        depth--;
+
+        // Both halves free merge back into one buddy
+        if (block->longest[left] == child_full && block->longest[right] == child_full) {
+            block->longest[parent] = child_full + 1;
+        } else {
+            block->longest[parent] = alloc_max_u8(block->longest[left], block->longest[right]);
+        }
+
+        node = parent;
+    }
+}
+
+// Returns offset in block or UINT64_MAX
+static
+VkDeviceSize alloc_tree_alloc(AllocBlock *block, uint32_t order) {
+    if (order > block->order || block->longest[0] < order + 1) {
+        return UINT64_MAX;
+    }
+
+    uint32_t node = 0;
+    uint32_t node_order = block->order;
+    while (node_order > order) {
+        uint32_t left = node * 2 + 1;
+        // Left first keeps allocations packed at block start
+        node = block->longest[left] >= order + 1 ? left : left + 1;
+        node_order--;
+    }
+
+    uint32_t depth = block->order - order;
+    block->longest[node] = 0;
+    alloc_tree_update_parents(block, node, depth);
+
+    uint64_t index_in_level = node - ((1u << depth) - 1);
+    return (VkDeviceSize)index_in_level * (ALLOC_MIN_SIZE << order);
+}
+
+static
+void alloc_tree_free(AllocBlock *block, VkDeviceSize offset, uint32_t order) {
+    uint32_t depth = block->order - order;
+    uint32_t node = (1u << depth) - 1 + (uint32_t)(offset / (ALLOC_MIN_SIZE << order));
+
+    block->longest[node] = (uint8_t)(order + 1);
+    alloc_tree_update_parents(block, node, depth);
+}
+
+// Small heaps, like 256 MiB BAR window, get smaller blocks, so one block does not take most of it
+static
+VkDeviceSize alloc_block_size(const Allocator *a, uint32_t memory_type) {
+    VkDeviceSize heap_size = a->mem_prop.memoryHeaps[a->mem_prop.memoryTypes[memory_type].heapIndex].size;
+    VkDeviceSize block_size = ALLOC_BLOCK_SIZE;
+    while (block_size > heap_size / 8 && block_size > 1024 * 1024) {
+        block_size /= 2;
+    }
+    return block_size;
+}
+
+static
+int alloc_block_create(Allocator *a, uint32_t memory_type, int image, VkDeviceSize min_size, uint32_t *out_index) {
+    uint32_t index = UINT32_MAX;
+    for (uint32_t i = 0; i < a->block_count; i++) {
+        if (a->blocks[i].memory == VK_NULL_HANDLE) {
+            index = i;
+            break;
+        }
+    }
+    if (index == UINT32_MAX) {
+        if (a->block_count == ALLOC_MAX_BLOCKS) {
+            return 0;
+        }
+        index = a->block_count;
+    }
+
+    VkDeviceSize block_size = alloc_block_size(a, memory_type);
+    if (block_size < min_size) {
+        return 0;
+    }
+
+    VkMemoryAllocateInfo mem_alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = block_size,
+        .memoryTypeIndex = memory_type,
+    };
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(a->device, &mem_alloc_info, NULL, &memory) != VK_SUCCESS) {
+        return 0;
+    }
+
+    AllocBlock *block = &a->blocks[index];
+    memset(block, 0, sizeof(*block));
+    block->memory = memory;
+    block->memory_type = memory_type;
+    block->image = image;
+    block->order = alloc_order_for_size(block_size);
+
+    uint32_t node_count = (2u << block->order) - 1;
+    block->longest = malloc(node_count);
+    for (uint32_t depth = 0, first = 0; depth <= block->order; depth++) {
+        uint32_t count = 1u << depth;
+        memset(block->longest + first, (int)(block->order - depth + 1), count);
+        first += count;
+    }
+
+    if (a->mem_prop.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        void *mapped;
+        ALLOC_VK_CHECK(vkMapMemory(a->device, memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+        block->mapped = mapped;
+    }
+
+    if (index == a->block_count) {
+        a->block_count++;
+    }
+    a->stats.block_count++;
+    a->stats.device_allocations++;
+    a->stats.reserved_bytes += block_size;
+
+    printf("Allocator: new %lu MiB block in memory type %d for %s\n",
+        (unsigned long)(block_size / 1024 / 1024), memory_type, image ? "images" : "buffers");
+
+    *out_index = index;
+    return 1;
+}
+
+static
+void alloc_fill(Allocator *a, Allocation *out, VkDeviceMemory memory, char *mapped, uint32_t memory_type,
+                VkDeviceSize offset, VkDeviceSize size) {
+    out->memory = memory;
+    out->offset = offset;
+    out->size = size;
+    out->mapped = mapped != NULL ? mapped + offset : NULL;
+    out->memory_type = memory_type;
+    out->coherent = (a->mem_prop.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+static
+int alloc_from_type(Allocator *a, const VkMemoryRequirements *req, uint32_t memory_type, int image, Allocation *out) {
+    VkDeviceSize size = req->size > req->alignment ? req->size : req->alignment;
+
+    // Half block or more would waste most of it, such resources get own allocation, block of this heap
+    // may be smaller than ALLOC_BLOCK_SIZE
+    if (size > alloc_block_size(a, memory_type) / 2) {
+        uint32_t slot = 0;
+        while (slot < a->dedicated_slots && a->dedicated[slot] != VK_NULL_HANDLE) {
+            slot++;
+        }
+        if (slot == ALLOC_MAX_DEDICATED) {
+            return 0;
+        }
+
+        VkMemoryAllocateInfo mem_alloc_info = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = (req->size + a->non_coherent_atom - 1) / a->non_coherent_atom * a->non_coherent_atom,
+            .memoryTypeIndex = memory_type,
+        };
+
+        VkDeviceMemory memory;
+        if (vkAllocateMemory(a->device, &mem_alloc_info, NULL, &memory) != VK_SUCCESS) {
+            return 0;
+        }
+
+        void *mapped = NULL;
+        if (a->mem_prop.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            ALLOC_VK_CHECK(vkMapMemory(a->device, memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+        }
+
+        alloc_fill(a, out, memory, mapped, memory_type, 0, mem_alloc_info.allocationSize);
+        out->block = UINT32_MAX;
+        out->order = 0;
+
+        a->dedicated[slot] = memory;
+        if (slot == a->dedicated_slots) {
+            a->dedicated_slots++;
+        }
+
+        a->stats.dedicated_count++;
+        a->stats.device_allocations++;
+        a->stats.reserved_bytes += mem_alloc_info.allocationSize;
+        return 1;
+    }
+
+    // Buddy offsets are multiples of buddy size, so alignment up to size is free
+    uint32_t order = alloc_order_for_size(size);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        for (uint32_t i = 0; i < a->block_count; i++) {
+            AllocBlock *block = &a->blocks[i];
+            if (block->memory == VK_NULL_HANDLE || block->memory_type != memory_type || block->image != image) {
+                continue;
+            }
+
+            VkDeviceSize offset = alloc_tree_alloc(block, order);
+            if (offset != UINT64_MAX) {
+                alloc_fill(a, out, block->memory, block->mapped, memory_type, offset, ALLOC_MIN_SIZE << order);
+                out->block = i;
+                out->order = order;
+                block->used += ALLOC_MIN_SIZE << order;
+                return 1;
+            }
+        }
+
+        uint32_t new_index;
+        if (attempt == 0 && !alloc_block_create(a, memory_type, image, ALLOC_MIN_SIZE << order, &new_index)) {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+int alloc_memory(Allocator *a, const VkMemoryRequirements *req, AllocUsage usage, int image, Allocation *out) {
+    // Selection sort of allowed types by score, there are at most 32
+    uint32_t tried = 0;
+    for (;;) {
+        int best_score = -1;
+        uint32_t best_type = UINT32_MAX;
+        for (uint32_t i = 0; i < a->mem_prop.memoryTypeCount; i++) {
+            if (!(req->memoryTypeBits & (1u << i)) || (tried & (1u << i))) {
+                continue;
+            }
+            int score = alloc_score_memory_type(a, i, usage);
+            if (score > best_score) {
+                best_score = score;
+                best_type = i;
+            }
+        }
+
+        if (best_type == UINT32_MAX) {
+            return 0;
+        }
+        tried |= 1u << best_type;
+
+        // Heap can be full, then next best type is used, e.g. system memory instead of VRAM
+        if (alloc_from_type(a, req, best_type, image, out)) {
+            break;
+        }
+    }
+
+    a->stats.alloc_count++;
+    a->stats.used_bytes += out->size;
+    a->stats.requested_bytes += req->size;
+    if (a->stats.used_bytes > a->stats.peak_used_bytes) {
+        a->stats.peak_used_bytes = a->stats.used_bytes;
+    }
+
+    // Keep requested size for stats, allocation size may be rounded up
+    out->size = req->size;
+    return 1;
+}
+
+void alloc_free(Allocator *a, Allocation *allocation) {
+    if (allocation->memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    a->stats.free_count++;
+    a->stats.requested_bytes -= allocation->size;
+
+    if (allocation->block == UINT32_MAX) {
+        VkDeviceSize size = (allocation->size + a->non_coherent_atom - 1) / a->non_coherent_atom * a->non_coherent_atom;
+        if (allocation->mapped != NULL) {
+            vkUnmapMemory(a->device, allocation->memory);
+        }
+        vkFreeMemory(a->device, allocation->memory, NULL);
+
+        for (uint32_t i = 0; i < a->dedicated_slots; i++) {
+            if (a->dedicated[i] == allocation->memory) {
+                a->dedicated[i] = VK_NULL_HANDLE;
+                break;
+            }
+        }
+
+        a->stats.used_bytes -= size;
+        a->stats.reserved_bytes -= size;
+        a->stats.dedicated_count--;
+        a->stats.device_allocations--;
+    } else {
+        AllocBlock *block = &a->blocks[allocation->block];
+        VkDeviceSize size = ALLOC_MIN_SIZE << allocation->order;
+
+        alloc_tree_free(block, allocation->offset, allocation->order);
+        block->used -= size;
+        a->stats.used_bytes -= size;
+
+        // Empty blocks are kept, next allocation of same kind reuses them without vkAllocateMemory
+    }
+
+    memset(allocation, 0, sizeof(*allocation));
+}
+
+int alloc_buffer(Allocator *a, VkBuffer buffer, AllocUsage usage, Allocation *out) {
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(a->device, buffer, &req);
+
+    if (!alloc_memory(a, &req, usage, 0, out)) {
+        return 0;
+    }
+
+    ALLOC_VK_CHECK(vkBindBufferMemory(a->device, buffer, out->memory, out->offset));
+    return 1;
+}
+
+int alloc_image(Allocator *a, VkImage image, AllocUsage usage, Allocation *out) {
+    VkMemoryRequirements req;
+    vkGetImageMemoryRequirements(a->device, image, &req);
+
+    if (!alloc_memory(a, &req, usage, 1, out)) {
+        return 0;
+    }
+
+    ALLOC_VK_CHECK(vkBindImageMemory(a->device, image, out->memory, out->offset));
+    return 1;
+}
+
+// Range is widened to atom size, it stays inside buddy because buddies are at least ALLOC_MIN_SIZE aligned
+static
+VkMappedMemoryRange alloc_atom_range(Allocator *a, const Allocation *allocation, VkDeviceSize offset, VkDeviceSize size) {
+    VkDeviceSize begin = allocation->offset + offset;
+    VkDeviceSize end = size == VK_WHOLE_SIZE ? allocation->offset + allocation->size : begin + size;
+
+    begin = begin / a->non_coherent_atom * a->non_coherent_atom;
+    end = (end + a->non_coherent_atom - 1) / a->non_coherent_atom * a->non_coherent_atom;
+
+    VkMappedMemoryRange range = {
+        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = allocation->memory,
+        .offset = begin,
+        .size = end - begin,
+    };
+    return range;
+}
+
+void alloc_flush(Allocator *a, const Allocation *allocation, VkDeviceSize offset, VkDeviceSize size) {
+    if (allocation->coherent || size == 0) {
+        return;
+    }
+
+    VkMappedMemoryRange range = alloc_atom_range(a, allocation, offset, size);
+
+    // Adjacent writes to same memory are merged, typical for bump allocated data
+    if (a->pending_flush_count > 0) {
+        VkMappedMemoryRange *last = &a->pending_flushes[a->pending_flush_count - 1];
+        if (last->memory == range.memory && last->offset + last->size >= range.offset && range.offset >= last->offset) {
+            VkDeviceSize end = range.offset + range.size;
+            if (end > last->offset + last->size) {
+                last->size = end - last->offset;
+            }
+            return;
+        }
+    }
+
+    if (a->pending_flush_count == ALLOC_MAX_PENDING_FLUSHES) {
+        alloc_flush_commit(a);
+    }
+
+    a->pending_flushes[a->pending_flush_count++] = range;
+}
+
+void alloc_flush_commit(Allocator *a) {
+    if (a->pending_flush_count == 0) {
+        return;
+    }
+
+    ALLOC_VK_CHECK(vkFlushMappedMemoryRanges(a->device, a->pending_flush_count, a->pending_flushes));
+
+    a->stats.flushed_ranges += a->pending_flush_count;
+    a->stats.flush_calls++;
+    a->pending_flush_count = 0;
+}
+
+void alloc_invalidate(Allocator *a, const Allocation *allocation, VkDeviceSize offset, VkDeviceSize size) {
+    if (allocation->coherent || size == 0) {
+        return;
+    }
+
+    VkMappedMemoryRange range = alloc_atom_range(a, allocation, offset, size);
+    ALLOC_VK_CHECK(vkInvalidateMappedMemoryRanges(a->device, 1, &range));
+}
+
+void alloc_stats(const Allocator *a, AllocStats *out) {
+    *out = a->stats;
+}
+
+void alloc_print_stats(const Allocator *a) {
+    const AllocStats *s = &a->stats;
+    printf("Allocator: %d device allocations (%d blocks, %d dedicated), %.2f MiB reserved, "
+           "%.2f MiB used, %.2f MiB peak, %.2f MiB requested\n",
+        s->device_allocations, s->block_count, s->dedicated_count, s->reserved_bytes / 1024.0 / 1024.0,
+        s->used_bytes / 1024.0 / 1024.0, s->peak_used_bytes / 1024.0 / 1024.0, s->requested_bytes / 1024.0 / 1024.0);
+    printf("Allocator: %lu allocations, %lu frees, %lu ranges flushed in %lu calls\n",
+        (unsigned long)s->alloc_count, (unsigned long)s->free_count,
+        (unsigned long)s->flushed_ranges, (unsigned long)s->flush_calls);
+}
+
+int alloc_linear_init(Allocator *a, AllocLinear *linear, VkDeviceSize size, uint32_t type_bits, AllocUsage usage) {
+    VkMemoryRequirements req = {
+        .size = size,
+        .alignment = ALLOC_MIN_SIZE,
+        .memoryTypeBits = type_bits,
+    };
+
+    linear->head = 0;
+    linear->peak = 0;
+    return alloc_memory(a, &req, usage, 0, &linear->allocation);
+}
+
+void alloc_linear_deinit(Allocator *a, AllocLinear *linear) {
+    alloc_free(a, &linear->allocation);
+}
+
+VkDeviceSize alloc_linear_push(AllocLinear *linear, VkDeviceSize size, VkDeviceSize alignment) {
+    VkDeviceSize offset = (linear->head + alignment - 1) / alignment * alignment;
+    if (offset + size > linear->allocation.size) {
+        return UINT64_MAX;
+    }
+
+    linear->head = offset + size;
+    if (linear->head > linear->peak) {
+        linear->peak = linear->head;
+    }
+    return offset;
+}
+
+void alloc_linear_reset(AllocLinear *linear) {
+    linear->head = 0;
+}
@@ -0,0 +1,129 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+// Device memory sub-allocator. Few large blocks per memory type are split with buddy system,
+// so resources do not spend maxMemoryAllocationCount and allocation is cheap.
+// Not thread safe, all calls must come from one thread or be externally locked.
+
+#define ALLOC_BLOCK_SIZE (64ull * 1024 * 1024)
+// Smallest buddy, also upper limit of nonCoherentAtomSize, so flush ranges never cross into neighbour
+#define ALLOC_MIN_SIZE 256ull
+#define ALLOC_MAX_BLOCKS 64
+#define ALLOC_MAX_DEDICATED 64
+#define ALLOC_MAX_PENDING_FLUSHES 64
+
+// Intended access decides memory type, see alloc_score_memory_type
+typedef enum AllocUsage {
+    // Written and read only by GPU
+    ALLOC_USAGE_GPU_ONLY,
+    // Written by CPU sequentially, read by GPU, write combined memory is fine
+    ALLOC_USAGE_UPLOAD,
+    // Written by GPU, read by CPU, needs cached memory
+    ALLOC_USAGE_READBACK,
+    ALLOC_USAGE_COUNT,
+} AllocUsage;
+
+typedef struct Allocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    // NULL unless memory is host visible, points at offset already
+    void *mapped;
+    uint32_t memory_type;
+    int coherent;
+
+    // Index in allocator blocks, UINT32_MAX for dedicated allocation
+    uint32_t block;
+    uint32_t order;
+} Allocation;
+
+typedef struct AllocBlock {
+    VkDeviceMemory memory;
+    char *mapped;
+    uint32_t memory_type;
+    // Optimal tiling images and buffers never share block, so bufferImageGranularity can be ignored
+    int image;
+    // Block size is ALLOC_MIN_SIZE << order
+    uint32_t order;
+    // Buddy tree in heap order, node holds order + 1 of largest free buddy below it, 0 means full
+    uint8_t *longest;
+    VkDeviceSize used;
+} AllocBlock;
+
+typedef struct AllocStats {
+    // vkAllocateMemory calls alive, blocks plus dedicated
+    uint32_t device_allocations;
+    uint32_t block_count;
+    uint32_t dedicated_count;
+    VkDeviceSize reserved_bytes;
+    // Rounded up to buddy size, so it shows internal fragmentation against requested_bytes
+    VkDeviceSize used_bytes;
+    VkDeviceSize requested_bytes;
+    VkDeviceSize peak_used_bytes;
+    uint64_t alloc_count;
+    uint64_t free_count;
+    uint64_t flushed_ranges;
+    uint64_t flush_calls;
+} AllocStats;
+
+typedef struct Allocator {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties mem_prop;
+    VkDeviceSize non_coherent_atom;
+
+    AllocBlock blocks[ALLOC_MAX_BLOCKS];
+    uint32_t block_count;
+
+    // Own allocations of large resources, kept so leaked ones are freed on deinit, VK_NULL_HANDLE is free slot
+    VkDeviceMemory dedicated[ALLOC_MAX_DEDICATED];
+    uint32_t dedicated_slots;
+
+    VkMappedMemoryRange pending_flushes[ALLOC_MAX_PENDING_FLUSHES];
+    uint32_t pending_flush_count;
+
+    AllocStats stats;
+} Allocator;
+
+// Bump allocator over one allocation, for transient data that dies all at once
+typedef struct AllocLinear {
+    Allocation allocation;
+    VkDeviceSize head;
+    VkDeviceSize peak;
+} AllocLinear;
+
+void alloc_init(Allocator *a, VkPhysicalDevice phys_device, VkDevice device);
+// Prints leaks, every allocation should be freed before, leaked memory is still returned to device
+void alloc_deinit(Allocator *a);
+
+// Higher is better, negative means type cannot be used for usage
+int alloc_score_memory_type(const Allocator *a, uint32_t memory_type, AllocUsage usage);
+
+// Memory types from type_bits are tried from best score, returns 0 if no type had space
+int alloc_memory(Allocator *a, const VkMemoryRequirements *req, AllocUsage usage, int image, Allocation *out);
+void alloc_free(Allocator *a, Allocation *allocation);
+
+// Allocate and bind, return 0 on failure
+int alloc_buffer(Allocator *a, VkBuffer buffer, AllocUsage usage, Allocation *out);
+int alloc_image(Allocator *a, VkImage image, AllocUsage usage, Allocation *out);
+
+// Queues flush of CPU writes in range relative to allocation, no-op for coherent memory
+void alloc_flush(Allocator *a, const Allocation *allocation, VkDeviceSize offset, VkDeviceSize size);
+// One vkFlushMappedMemoryRanges for everything queued, call before submit which reads it
+void alloc_flush_commit(Allocator *a);
+// Makes GPU writes visible to CPU, immediate, no-op for coherent memory
+void alloc_invalidate(Allocator *a, const Allocation *allocation, VkDeviceSize offset, VkDeviceSize size);
+
+void alloc_stats(const Allocator *a, AllocStats *out);
+void alloc_print_stats(const Allocator *a);
+
+int alloc_linear_init(Allocator *a, AllocLinear *linear, VkDeviceSize size, uint32_t type_bits, AllocUsage usage);
+void alloc_linear_deinit(Allocator *a, AllocLinear *linear);
+// Returns offset in allocation memory or UINT64_MAX if pool is exhausted
+VkDeviceSize alloc_linear_push(AllocLinear *linear, VkDeviceSize size, VkDeviceSize alignment);
+void alloc_linear_reset(AllocLinear *linear);
+
+#endif /* ALLOCATOR_H */
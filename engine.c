@@ -1,9 +1,17 @@
 #include "engine.h"
 
+#include <ctype.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <X11/Xutil.h>
 
@@ -18,9 +26,558 @@
     } \
 } while(0)
 
+#include "profiler.h"
+#include "allocator.h"
+
+// Generated by build step from .vert and .frag files, see README
+#include "triangle.vert.spv.h"
+#include "triangle.frag.spv.h"
+#include "overlay.vert.spv.h"
+#include "overlay.frag.spv.h"
+#include "mass.vert.spv.h"
+#include "mass.frag.spv.h"
+#include "mass_cull.comp.spv.h"
+
+// Staging memory for one-time uploads such as overlay atlas
+#define UPLOAD_SCRATCH_SIZE (1024 * 1024)
+
+// Transfer submits timed by one pool, reset by halves, so half must hold more than ENGINE_MAX_UPLOADS
+#define TRANSFER_QUERY_PAIRS 32
+
+// Counted by statistics query, secondary command buffers declare the same set as inherited
+#define PIPELINE_STATISTICS (VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | \
+                             VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT)
+
+// Per-instance data of mass geometry, tightly packed, see inputs of mass.vert
+typedef struct MassInstance {
+    // SNORM, center in NDC
+    int16_t offset[2];
+    // UNORM, size relative to single triangle and shift in animation cycle
+    uint16_t scale;
+    uint16_t phase;
+    // RGBA8
+    uint32_t color;
+} MassInstance;
+
+// Objects of GPU driven mass geometry wrap around in [-MASS_WORLD_SIZE, MASS_WORLD_SIZE], screen is [-1, 1]
+#define MASS_WORLD_SIZE 2.0f
+#define MASS_CULL_GROUP_SIZE 64
+
+// Animation state of GPU driven mass geometry, std430 layout, see mass_cull.comp
+typedef struct MassObject {
+    float position[2];
+    // NDC per second
+    float velocity[2];
+    float scale;
+    float phase;
+    // Turns per second
+    float spin;
+    uint32_t color;
+} MassObject;
+
+typedef struct CullPushConstants {
+    float time;
+    float dt;
+    uint32_t count;
+} CullPushConstants;
+
+// Per-frame data shared by all shaders, std140 layout, see frame block in shaders
+typedef struct FrameUniforms {
+    // 2 / framebuffer size, converts pixels from top left to NDC
+    float pixel_to_ndc[2];
+    // Seconds since init
+    float time;
+    // Animation cycle in [0, 1] returned by latch
+    float cycle;
+} FrameUniforms;
+
+const char *engine_present_mode_name(VkPresentModeKHR mode) {
+    switch (mode) {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+    default: return "unknown";
+    }
+}
+
+int engine_present_mode_parse(const char *name, VkPresentModeKHR *out_mode) {
+    const VkPresentModeKHR modes[] = {
+        VK_PRESENT_MODE_IMMEDIATE_KHR,
+        VK_PRESENT_MODE_MAILBOX_KHR,
+        VK_PRESENT_MODE_FIFO_KHR,
+        VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+    };
+
+    for (uint32_t i = 0; i < sizeof(modes) / sizeof(VkPresentModeKHR); i++) {
+        if (strcmp(name, engine_present_mode_name(modes[i])) == 0) {
+            *out_mode = modes[i];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int engine_config_apply_profile(EngineConfig *config, const char *name) {
+    if (strcmp(name, "low-latency") == 0) {
+        // Newest image wins and CPU never runs ahead, so input shows up on next vblank
+        config->present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+        config->image_count = 3;
+        config->frames_in_flight = 1;
+    } else if (strcmp(name, "max-throughput") == 0) {
+        // No vsync and deep queues, GPU is never starved
+        config->present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+        config->image_count = 3;
+        config->frames_in_flight = 3;
+    } else if (strcmp(name, "power-save") == 0) {
+        // Capped to refresh rate with least memory
+        config->present_mode = VK_PRESENT_MODE_FIFO_KHR;
+        config->image_count = 2;
+        config->frames_in_flight = 2;
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+static
+uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+// Closes init stage, which began where previous one ended
+static
+void init_stage_end(Engine *e, const char *name) {
+    uint64_t now = now_ns();
+    EngineInitStats *stats = &e->init_stats;
+    if (stats->stage_count < ENGINE_MAX_INIT_STAGES) {
+        stats->stages[stats->stage_count].name = name;
+        stats->stages[stats->stage_count].ms = (now - e->init_stage_ns) / 1000000.0;
+        stats->stage_count++;
+    }
+    e->init_stage_ns = now;
+}
+
+void engine_config_default(EngineConfig *config) {
+    // 2 frames is enough to overlap CPU recording with GPU execution, 3 hides more jitter at cost of latency
+    config->frames_in_flight = 2;
+    config->present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    // Triple buffering, because with VK_PRESENT_MODE_MAILBOX_KHR it is only reasonable alternative
+    config->image_count = 3;
+    config->pipeline_cache_path = "pipeline_cache.bin";
+    config->shader_dir = NULL;
+    config->validation = 0;
+    config->parallel_init = 1;
+    config->device = NULL;
+    config->device_cache_path = "device_cache.txt";
+    config->gpu_pipeline_stats = 0;
+    config->overlay = 1;
+    config->stream_staging = -1;
+    config->mass_count = 0;
+    config->gpu_driven = 0;
+    config->cpu_mass_count = 0;
+    config->draw_count = 1;
+    config->record_threads = 1;
+    config->static_recording = 0;
+    config->dedicated_queues = 1;
+    // Window drag sends ConfigureNotify every few ms, rebuild when there was none for a while,
+    // but not later than budget, so long drag still gets sharp image from time to time
+    config->resize_settle_ms = 50;
+    config->resize_budget_ms = 250;
+    config->resize_wait_idle = 0;
+}
+
+void engine_config_from_env(EngineConfig *config) {
+    // Profile first, so separate variables can adjust it
+    const char *profile = getenv("ENGINE_PROFILE");
+    if (profile != NULL && !engine_config_apply_profile(config, profile)) {
+        fprintf(stderr, "Unknown ENGINE_PROFILE: %s\n", profile);
+    }
+
+    const char *present_mode = getenv("ENGINE_PRESENT_MODE");
+    if (present_mode != NULL && !engine_present_mode_parse(present_mode, &config->present_mode)) {
+        fprintf(stderr, "Unknown ENGINE_PRESENT_MODE: %s\n", present_mode);
+    }
+
+    const char *image_count = getenv("ENGINE_IMAGE_COUNT");
+    if (image_count != NULL) {
+        config->image_count = (uint32_t)atoi(image_count);
+    }
+
+    const char *frames_in_flight = getenv("ENGINE_FRAMES_IN_FLIGHT");
+    if (frames_in_flight != NULL) {
+        config->frames_in_flight = (uint32_t)atoi(frames_in_flight);
+    }
+
+    // Empty value disables on-disk cache
+    const char *pipeline_cache_path = getenv("ENGINE_PIPELINE_CACHE");
+    if (pipeline_cache_path != NULL) {
+        config->pipeline_cache_path = pipeline_cache_path[0] != '\0' ? pipeline_cache_path : NULL;
+    }
+
+    const char *validation = getenv("ENGINE_VALIDATION");
+    if (validation != NULL) {
+        config->validation = atoi(validation);
+    }
+
+    const char *parallel_init = getenv("ENGINE_PARALLEL_INIT");
+    if (parallel_init != NULL) {
+        config->parallel_init = atoi(parallel_init);
+    }
+
+    const char *device = getenv("ENGINE_DEVICE");
+    if (device != NULL) {
+        config->device = device[0] != '\0' ? device : NULL;
+    }
+
+    const char *device_cache_path = getenv("ENGINE_DEVICE_CACHE");
+    if (device_cache_path != NULL) {
+        config->device_cache_path = device_cache_path[0] != '\0' ? device_cache_path : NULL;
+    }
+
+    const char *resize_settle_ms = getenv("ENGINE_RESIZE_SETTLE_MS");
+    if (resize_settle_ms != NULL) {
+        config->resize_settle_ms = (uint32_t)atoi(resize_settle_ms);
+    }
+
+    const char *resize_budget_ms = getenv("ENGINE_RESIZE_BUDGET_MS");
+    if (resize_budget_ms != NULL) {
+        config->resize_budget_ms = (uint32_t)atoi(resize_budget_ms);
+    }
+
+    const char *resize_wait_idle = getenv("ENGINE_RESIZE_WAIT_IDLE");
+    if (resize_wait_idle != NULL) {
+        config->resize_wait_idle = atoi(resize_wait_idle);
+    }
+
+    const char *gpu_pipeline_stats = getenv("ENGINE_GPU_STATS");
+    if (gpu_pipeline_stats != NULL) {
+        config->gpu_pipeline_stats = atoi(gpu_pipeline_stats);
+    }
+
+    const char *overlay = getenv("ENGINE_OVERLAY");
+    if (overlay != NULL) {
+        config->overlay = atoi(overlay);
+    }
+
+    const char *stream_staging = getenv("ENGINE_STREAM_STAGING");
+    if (stream_staging != NULL) {
+        config->stream_staging = atoi(stream_staging);
+    }
+
+    const char *mass_count = getenv("ENGINE_MASS_COUNT");
+    if (mass_count != NULL) {
+        config->mass_count = (uint32_t)atoi(mass_count);
+    }
+
+    const char *gpu_driven = getenv("ENGINE_GPU_DRIVEN");
+    if (gpu_driven != NULL) {
+        config->gpu_driven = atoi(gpu_driven);
+    }
+
+    const char *cpu_mass_count = getenv("ENGINE_CPU_MASS");
+    if (cpu_mass_count != NULL) {
+        config->cpu_mass_count = (uint32_t)atoi(cpu_mass_count);
+    }
+
+    const char *draw_count = getenv("ENGINE_DRAW_COUNT");
+    if (draw_count != NULL) {
+        config->draw_count = (uint32_t)atoi(draw_count);
+    }
+
+    const char *record_threads = getenv("ENGINE_RECORD_THREADS");
+    if (record_threads != NULL) {
+        config->record_threads = (uint32_t)atoi(record_threads);
+    }
+
+    const char *dedicated_queues = getenv("ENGINE_DEDICATED_QUEUES");
+    if (dedicated_queues != NULL) {
+        config->dedicated_queues = atoi(dedicated_queues);
+    }
+
+    const char *static_recording = getenv("ENGINE_STATIC_RECORD");
+    if (static_recording != NULL) {
+        config->static_recording = atoi(static_recording);
+    }
+
+    const char *shader_dir = getenv("ENGINE_SHADER_DIR");
+    if (shader_dir != NULL) {
+        config->shader_dir = shader_dir[0] != '\0' ? shader_dir : NULL;
+    }
+}
+
+// PHYSICAL DEVICE selection, override or cached choice are taken as is, otherwise every device is scored
+
+// Device UUID on 1.0 instance needs VK_KHR_get_physical_device_properties2, without it vendor and device id
+// stand in, which can not tell two same GPUs apart
+static
+void device_id_text(PFN_vkGetPhysicalDeviceProperties2KHR get_props2, VkPhysicalDevice device,
+                    const VkPhysicalDeviceProperties *prop, char out_text[2 * VK_UUID_SIZE + 1]) {
+    uint8_t uuid[VK_UUID_SIZE] = {0};
+    if (get_props2 != NULL) {
+        VkPhysicalDeviceIDPropertiesKHR id_prop = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES_KHR,
+        };
+        VkPhysicalDeviceProperties2KHR prop2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR,
+            .pNext = &id_prop,
+        };
+        get_props2(device, &prop2);
+        memcpy(uuid, id_prop.deviceUUID, VK_UUID_SIZE);
+    } else {
+        memcpy(uuid, &prop->vendorID, sizeof(uint32_t));
+        memcpy(uuid + sizeof(uint32_t), &prop->deviceID, sizeof(uint32_t));
+    }
+
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+        snprintf(out_text + 2 * i, 3, "%02x", uuid[i]);
+    }
+}
+
+// Engine needs graphics family which presents to surface, any family and not only first one, and swapchain
+static
+int device_usable(Engine *e, VkPhysicalDevice device) {
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, NULL);
+    VkQueueFamilyProperties *families = malloc(family_count * sizeof(VkQueueFamilyProperties));
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, families);
+
+    int graphics = 0;
+    for (uint32_t i = 0; i < family_count && !graphics; i++) {
+        if (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+            VkBool32 supported = VK_TRUE;
+            if (!e->headless) {
+                VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(device, i, e->surface, &supported));
+            }
+            graphics = supported == VK_TRUE;
+        }
+    }
+
+    free(families);
+
+    if (!graphics || e->headless) {
+        return graphics;
+    }
+
+    uint32_t extension_count = 0;
+    VK_CHECK(vkEnumerateDeviceExtensionProperties(device, NULL, &extension_count, NULL));
+    VkExtensionProperties *extensions = malloc(extension_count * sizeof(VkExtensionProperties));
+    VK_CHECK(vkEnumerateDeviceExtensionProperties(device, NULL, &extension_count, extensions));
+
+    int swapchain = 0;
+    for (uint32_t i = 0; i < extension_count; i++) {
+        if (strcmp(extensions[i].extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0) {
+            swapchain = 1;
+        }
+    }
+
+    free(extensions);
+    return swapchain;
+}
+
+// Type dominates, so llvmpipe never beats real GPU, largest device local heap breaks ties inside type
+static
+int64_t device_score(VkPhysicalDevice device, const VkPhysicalDeviceProperties *prop) {
+    int64_t score = 0;
+    switch (prop->deviceType) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score = 400000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score = 300000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score = 200000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: score = 0; break;
+    default: score = 100000; break;
+    }
+
+    VkPhysicalDeviceMemoryProperties mem_prop;
+    vkGetPhysicalDeviceMemoryProperties(device, &mem_prop);
+
+    VkDeviceSize heap_size = 0;
+    for (uint32_t i = 0; i < mem_prop.memoryHeapCount; i++) {
+        if ((mem_prop.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && mem_prop.memoryHeaps[i].size > heap_size) {
+            heap_size = mem_prop.memoryHeaps[i].size;
+        }
+    }
+
+    // In MiB, capped below step between types
+    int64_t heap_mib = (int64_t)(heap_size / (1024 * 1024));
+    score += heap_mib < 99999 ? heap_mib : 99999;
+
+    return score;
+}
+
+static
+int device_matches_index(const char *spec, uint32_t index) {
+    char *end;
+    unsigned long spec_index = strtoul(spec, &end, 10);
+    return end != spec && *end == '\0' && spec_index == index;
+}
+
+static
+int device_matches_uuid(const char *spec, const char *id_text) {
+    char hex[2 * VK_UUID_SIZE + 2];
+    uint32_t hex_len = 0;
+    for (const char *c = spec; *c != '\0' && hex_len <= 2 * VK_UUID_SIZE; c++) {
+        if (*c != '-') {
+            hex[hex_len++] = (char)tolower((unsigned char)*c);
+        }
+    }
+    hex[hex_len] = '\0';
+    return strcmp(hex, id_text) == 0;
+}
+
+static
+int device_matches_name(const char *spec, const VkPhysicalDeviceProperties *prop) {
+    size_t spec_len = strlen(spec);
+    for (const char *name = prop->deviceName; *name != '\0'; name++) {
+        size_t i = 0;
+        while (i < spec_len && name[i] != '\0' && tolower((unsigned char)name[i]) == tolower((unsigned char)spec[i])) {
+            i++;
+        }
+        if (i == spec_len) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// index:, uuid: and name: prefixes pick the kind, without prefix decimal is always index, 32 hex digits with
+// or without dashes is UUID, anything else is part of name in any case, so all-digit name needs name:
+static
+int device_matches(const char *spec, uint32_t index, const VkPhysicalDeviceProperties *prop, const char *id_text) {
+    if (strncmp(spec, "index:", 6) == 0) {
+        return device_matches_index(spec + 6, index);
+    }
+    if (strncmp(spec, "uuid:", 5) == 0) {
+        return device_matches_uuid(spec + 5, id_text);
+    }
+    if (strncmp(spec, "name:", 5) == 0) {
+        return device_matches_name(spec + 5, prop);
+    }
+
+    char *end;
+    strtoul(spec, &end, 10);
+    if (end != spec && *end == '\0') {
+        return device_matches_index(spec, index);
+    }
+
+    return device_matches_uuid(spec, id_text) || device_matches_name(spec, prop);
+}
+
+static
+void phys_device_select(Engine *e, PFN_vkGetPhysicalDeviceProperties2KHR get_props2) {
+    uint32_t device_count = 0;
+    VK_CHECK(vkEnumeratePhysicalDevices(e->instance, &device_count, NULL));
+    VkPhysicalDevice *phys_devices = malloc(device_count * sizeof(VkPhysicalDevice));
+    VK_CHECK(vkEnumeratePhysicalDevices(e->instance, &device_count, phys_devices));
+    VkPhysicalDeviceProperties *props = malloc(device_count * sizeof(VkPhysicalDeviceProperties));
+    char (*ids)[2 * VK_UUID_SIZE + 1] = malloc(device_count * sizeof(*ids));
+
+    printf("Physical devices found: %d\n", device_count);
+    for (uint32_t i = 0; i < device_count; i++) {
+        vkGetPhysicalDeviceProperties(phys_devices[i], &props[i]);
+        device_id_text(get_props2, phys_devices[i], &props[i], ids[i]);
+        printf("I: %d, Api: %d, Driver: %d, Vendor: %d, Device %d, Type: %d, Name: %s, UUID: %s\n",
+                i, props[i].apiVersion, props[i].driverVersion, props[i].vendorID, props[i].deviceID,
+                props[i].deviceType, props[i].deviceName, ids[i]);
+    }
+
+    uint32_t selected = UINT32_MAX;
+    const char *reason = NULL;
+
+    if (e->config.device != NULL) {
+        // Explicit choice is never second guessed, failing it is an error
+        for (uint32_t i = 0; i < device_count && selected == UINT32_MAX; i++) {
+            if (device_matches(e->config.device, i, &props[i], ids[i])) {
+                selected = i;
+            }
+        }
+
+        if (selected == UINT32_MAX) {
+            fprintf(stderr, "No physical device matches %s\n", e->config.device);
+            exit(1);
+        }
+        if (!device_usable(e, phys_devices[selected])) {
+            fprintf(stderr, "Device %u (%s) can not render to surface\n", selected, props[selected].deviceName);
+            exit(1);
+        }
+        reason = "override";
+    } else {
+        char cached[2 * VK_UUID_SIZE + 2] = {0};
+        FILE *file = e->config.device_cache_path ? fopen(e->config.device_cache_path, "r") : NULL;
+        if (file) {
+            if (fgets(cached, sizeof(cached), file) == NULL) {
+                cached[0] = '\0';
+            }
+            cached[strcspn(cached, "\n")] = '\0';
+            fclose(file);
+        }
+
+        // Only cached device is probed, if it is gone, e.g. unplugged eGPU, scoring runs again
+        for (uint32_t i = 0; i < device_count && cached[0] != '\0'; i++) {
+            if (strcmp(ids[i], cached) == 0 && device_usable(e, phys_devices[i])) {
+                selected = i;
+                reason = "cache";
+                break;
+            }
+        }
+
+        if (selected == UINT32_MAX) {
+            int64_t best_score = -1;
+            for (uint32_t i = 0; i < device_count; i++) {
+                if (!device_usable(e, phys_devices[i])) {
+                    printf("I: %d, not usable\n", i);
+                    continue;
+                }
+
+                int64_t score = device_score(phys_devices[i], &props[i]);
+                printf("I: %d, Score: %ld\n", i, (long)score);
+                if (score > best_score) {
+                    best_score = score;
+                    selected = i;
+                }
+            }
+
+            if (selected == UINT32_MAX) {
+                fprintf(stderr, "No physical device can render to surface\n");
+                exit(1);
+            }
+            reason = "score";
+
+            // Written to temporary file and renamed like pipeline cache, so reader never sees half of UUID
+            if (e->config.device_cache_path) {
+                char tmp_path[4096];
+                snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", e->config.device_cache_path);
+
+                file = fopen(tmp_path, "w");
+                if (file) {
+                    int ok = fprintf(file, "%s\n", ids[selected]) > 0;
+                    ok = fclose(file) == 0 && ok;
+                    if (!ok || rename(tmp_path, e->config.device_cache_path) != 0) {
+                        fprintf(stderr, "Failed to write device cache: %s\n", e->config.device_cache_path);
+                        unlink(tmp_path);
+                    }
+                }
+            }
+        }
+    }
+
+    e->phys_device = phys_devices[selected];
+    printf("Device selected: %d, %s, by %s\n", selected, props[selected].deviceName, reason);
+
+    free(ids);
+    free(props);
+    free(phys_devices);
+}
+
 // Instance, Surface, Physical Device, Queue, Device
+// Headless engine passes NULL display, then there is no surface and no swapchain extension
 static 
 void base_init(Engine *e, Display *display, Window window) {
+    int device_uuid_supported = 0;
     {
         // Driver vendor may use this
         VkApplicationInfo app_info = {
@@ -32,12 +589,44 @@ void base_init(Engine *e, Display *display, Window window) {
             .apiVersion = VK_API_VERSION_1_0,
         };
 
-        const char *global_extensions[] = {
-            VK_KHR_SURFACE_EXTENSION_NAME,
-            VK_KHR_XLIB_SURFACE_EXTENSION_NAME,
-        };
+        const char *global_extensions[4];
+        uint32_t global_extension_count = 0;
+        if (!e->headless) {
+            global_extensions[global_extension_count++] = VK_KHR_SURFACE_EXTENSION_NAME;
+            global_extensions[global_extension_count++] = VK_KHR_XLIB_SURFACE_EXTENSION_NAME;
+        }
 
+        // Device UUID for selection override and cache, ID properties come with external memory capabilities
         {
+            uint32_t extension_count = 0;
+            VK_CHECK(vkEnumerateInstanceExtensionProperties(NULL, &extension_count, NULL));
+            VkExtensionProperties *extensions = malloc(extension_count * sizeof(VkExtensionProperties));
+            VK_CHECK(vkEnumerateInstanceExtensionProperties(NULL, &extension_count, extensions));
+
+            int found = 0;
+            for (uint32_t i = 0; i < extension_count; i++) {
+                if (strcmp(extensions[i].extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0 ||
+                    strcmp(extensions[i].extensionName, VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME) == 0) {
+                    found++;
+                }
+            }
+
+            device_uuid_supported = found == 2;
+            if (device_uuid_supported) {
+                global_extensions[global_extension_count++] = VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+                global_extensions[global_extension_count++] = VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME;
+            }
+
+            free(extensions);
+        }
+
+        const char *gloabal_layers[] = {
+            "VK_LAYER_KHRONOS_validation",
+        };
+        uint32_t global_layer_count = 0;
+
+        // Opt-in, validation alone takes large part of startup and adds overhead to every call
+        if (e->config.validation) {
             uint32_t layer_count;
             vkEnumerateInstanceLayerProperties(&layer_count, NULL);
             VkLayerProperties *layer_props = malloc(layer_count * sizeof(VkLayerProperties));
@@ -46,30 +635,31 @@ void base_init(Engine *e, Display *display, Window window) {
             for (uint32_t i = 0; i < layer_count; i++) {
                 printf("I: %d, Name: %s, Spec: %d, Impl: %d\n",
                         i, layer_props[i].layerName, layer_props[i].specVersion, layer_props[i].implementationVersion);
+                if (strcmp(layer_props[i].layerName, gloabal_layers[0]) == 0) {
+                    global_layer_count = 1;
+                }
             }
 
             free(layer_props);
-        }
 
-        const char *gloabal_layers[] = {
-            "VK_LAYER_KHRONOS_validation",
-        };
+            printf("Validation: %s\n", global_layer_count > 0 ? "on" : "requested, but layer is not installed");
+        }
 
         // TODO: VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR can be set for flags
-        // TODO: layers
         VkInstanceCreateInfo instance_ci = {
             .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
             .pApplicationInfo = &app_info,
-            .enabledLayerCount = sizeof(gloabal_layers) / sizeof(const char *),
+            .enabledLayerCount = global_layer_count,
             .ppEnabledLayerNames = gloabal_layers,
-            .enabledExtensionCount = sizeof(global_extensions) / sizeof(const char *),
+            .enabledExtensionCount = global_extension_count,
             .ppEnabledExtensionNames = global_extensions,
         };
 
         VK_CHECK(vkCreateInstance(&instance_ci, NULL, &e->instance));
     }
 
-    {
+    e->surface = VK_NULL_HANDLE;
+    if (!e->headless) {
         // Create Vulkan surface for X11 window
         VkXlibSurfaceCreateInfoKHR xlib_surface_ci = {
             .sType = VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR,
@@ -80,44 +670,28 @@ void base_init(Engine *e, Display *display, Window window) {
         VK_CHECK(vkCreateXlibSurfaceKHR(e->instance,  &xlib_surface_ci, NULL, &e->surface));
     }
 
-    // TODO: pick device better, may be you want specific one
+    init_stage_end(e, "instance");
+
     // TODO: is there way to query primary GPU on wayland or X11, there is github issue on vk loader repo though
     {
-        uint32_t desired = VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU | VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
-
-        uint32_t device_count = 0;
-        VK_CHECK(vkEnumeratePhysicalDevices(e->instance, &device_count, NULL));
-        VkPhysicalDevice *phys_devices = malloc(device_count * sizeof(VkPhysicalDevice));
-        VK_CHECK(vkEnumeratePhysicalDevices(e->instance, &device_count, phys_devices));
-
-        e->phys_device = VK_NULL_HANDLE;
-
-        printf("Physical devices found: %d\n", device_count);
-        for (uint32_t i = 0; i < device_count; i++) {
-            VkPhysicalDeviceProperties prop;
-            vkGetPhysicalDeviceProperties(phys_devices[i], &prop);
-            printf("I: %d, Api: %d, Driver: %d, Vendor: %d, Device %d, Type: %d, Name: %s\n",
-                    i, prop.apiVersion, prop.driverVersion, prop.vendorID, prop.deviceID, prop.deviceType, prop.deviceName);
-
-            VkBool32 supported = VK_FALSE;
-            VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(phys_devices[i], 0, e->surface, &supported));
-            if (supported == VK_TRUE && (e->phys_device == VK_NULL_HANDLE || (prop.deviceType & desired))) {
-                printf("Device selected: %d\n", i);
-                e->phys_device = phys_devices[i];
-            }
+        PFN_vkGetPhysicalDeviceProperties2KHR get_props2 = NULL;
+        if (device_uuid_supported) {
+            get_props2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(e->instance,
+                "vkGetPhysicalDeviceProperties2KHR");
         }
 
-        // TODO: is it even possible?
-        if (e->phys_device == VK_NULL_HANDLE) {
-            fprintf(stderr, "e->phys_device == VK_NULL_HANDLE\n");
-            exit(1);
-        }
-
-        free(phys_devices);
+        phys_device_select(e, get_props2);
     }
 
+    init_stage_end(e, "device select");
+
     // Get information about surface formats and present mode
-    {
+    if (e->headless) {
+        // Offscreen targets are ours, so just take format which is the same as typical swapchain one
+        e->surface_format.format = VK_FORMAT_B8G8R8A8_UNORM;
+        e->surface_format.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+        e->present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    } else {
         {
             VkFormat desired_format = VK_FORMAT_B8G8R8A8_UNORM;
             VkColorSpaceKHR desired_color_space = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
@@ -145,13 +719,18 @@ void base_init(Engine *e, Display *display, Window window) {
             free(surface_formats);
         }
         
-        // TODO: fifo is always avaible we may be want to query another one
+        // FIFO is always available, so it ends every fallback chain
         e->present_mode = VK_PRESENT_MODE_FIFO_KHR;
-        // TODO: you may want to use VK_PRESENT_MODE_MAILBOX_KHR, it actually the best for no vsync
         {
-            // VkPresentModeKHR desired = VK_PRESENT_MODE_MAILBOX_KHR;
-            // VkPresentModeKHR desired = VK_PRESENT_MODE_IMMEDIATE_KHR;
-            VkPresentModeKHR desired = VK_PRESENT_MODE_FIFO_KHR;
+            // Without vsync MAILBOX and IMMEDIATE replace each other, MAILBOX just does not tear
+            VkPresentModeKHR candidates[3];
+            uint32_t candidate_count = 0;
+            candidates[candidate_count++] = e->config.present_mode;
+            if (e->config.present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
+                candidates[candidate_count++] = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            } else if (e->config.present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+                candidates[candidate_count++] = VK_PRESENT_MODE_MAILBOX_KHR;
+            }
 
             uint32_t present_mode_count = 0;
             VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(e->phys_device, e->surface, &present_mode_count, NULL));
@@ -160,13 +739,25 @@ void base_init(Engine *e, Display *display, Window window) {
             
             printf("Present modes found: %d\n", present_mode_count);
             for (uint32_t i = 0; i < present_mode_count; i++) {
-                printf("I: %d, Mode: %d\n", i, present_modes[i]);
-                if (present_modes[i] == desired) {
-                    e->present_mode = desired;
-                    printf("Found desired present mode: %d\n", desired);
+                printf("I: %d, Mode: %s\n", i, engine_present_mode_name(present_modes[i]));
+            }
+
+            int found = 0;
+            for (uint32_t c = 0; c < candidate_count && !found; c++) {
+                for (uint32_t i = 0; i < present_mode_count; i++) {
+                    if (present_modes[i] == candidates[c]) {
+                        e->present_mode = candidates[c];
+                        found = 1;
+                        break;
+                    }
                 }
             }
 
+            if (e->present_mode != e->config.present_mode) {
+                printf("Present mode %s is not supported, falling back to %s\n",
+                    engine_present_mode_name(e->config.present_mode), engine_present_mode_name(e->present_mode));
+            }
+
             free(present_modes);
         }
     }
@@ -185,10 +776,13 @@ void base_init(Engine *e, Display *display, Window window) {
             printf("I: %d, Flags: %d, Count %d\n", i, queue_families[i].queueFlags, queue_families[i].queueCount);
 
             if (e->graphics_queue_family == UINT32_MAX && (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
-                VkBool32 supported = VK_FALSE;
-                VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(e->phys_device, i, e->surface, &supported));
+                VkBool32 supported = VK_TRUE;
+                if (!e->headless) {
+                    VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(e->phys_device, i, e->surface, &supported));
+                }
                 if (supported == VK_TRUE) {
                     e->graphics_queue_family = i;
+                    e->timestamp_valid_bits = queue_families[i].timestampValidBits;
                     printf("Found queue family: %d\n", i);
                 }
             }
@@ -199,6 +793,30 @@ void base_init(Engine *e, Display *display, Window window) {
             exit(1);
         }
 
+        // Transfer-only family is usually copy engine which runs beside graphics, compute-only one
+        // is async compute, first of each kind wins
+        e->transfer.family = e->graphics_queue_family;
+        e->compute.family = e->graphics_queue_family;
+        e->compute_timestamp_valid_bits = e->timestamp_valid_bits;
+        e->transfer_timestamp_valid_bits = e->timestamp_valid_bits;
+        for (uint32_t i = 0; i < queue_family_count && e->config.dedicated_queues; i++) {
+            VkQueueFlags flags = queue_families[i].queueFlags;
+            if (e->transfer.family == e->graphics_queue_family && (flags & VK_QUEUE_TRANSFER_BIT) &&
+                !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+                e->transfer.family = i;
+                e->transfer_timestamp_valid_bits = queue_families[i].timestampValidBits;
+            }
+            if (e->compute.family == e->graphics_queue_family && (flags & VK_QUEUE_COMPUTE_BIT) &&
+                !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+                e->compute.family = i;
+                e->compute_timestamp_valid_bits = queue_families[i].timestampValidBits;
+            }
+        }
+
+        printf("Queues: graphics family %u, compute family %u%s, transfer family %u%s\n", e->graphics_queue_family,
+            e->compute.family, e->compute.family != e->graphics_queue_family ? " (dedicated)" : "",
+            e->transfer.family, e->transfer.family != e->graphics_queue_family ? " (dedicated)" : "");
+
         free(queue_families);
     }
 
@@ -207,19 +825,41 @@ void base_init(Engine *e, Display *display, Window window) {
             1.0f,
         };
 
-        VkDeviceQueueCreateInfo queue_ci = {
-            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .flags = 0,
-            .queueFamilyIndex = e->graphics_queue_family,
-            .queueCount = sizeof(queue_priorities) / sizeof(float),
-            .pQueuePriorities = queue_priorities,
-        };
+        // One queue per distinct family
+        uint32_t families[3] = {e->graphics_queue_family, e->compute.family, e->transfer.family};
+        VkDeviceQueueCreateInfo queue_cis[3];
+        uint32_t queue_ci_count = 0;
+        for (uint32_t i = 0; i < 3; i++) {
+            if (i > 0 && families[i] == e->graphics_queue_family) {
+                continue;
+            }
+
+            queue_cis[queue_ci_count++] = (VkDeviceQueueCreateInfo){
+                .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                .flags = 0,
+                .queueFamilyIndex = families[i],
+                .queueCount = sizeof(queue_priorities) / sizeof(float),
+                .pQueuePriorities = queue_priorities,
+            };
+        }
 
         const char *device_extensions[] = {
             VK_KHR_SWAPCHAIN_EXTENSION_NAME,
         };
 
         // TODO: pNext can be something useful here, for features
+        VkPhysicalDeviceFeatures supported_features;
+        vkGetPhysicalDeviceFeatures(e->phys_device, &supported_features);
+
+        VkPhysicalDeviceFeatures features = {0};
+        e->pipeline_stats_supported = e->config.gpu_pipeline_stats && supported_features.pipelineStatisticsQuery;
+        // Statistics query stays active across vkCmdExecuteCommands, secondaries must be allowed to inherit it
+        if (e->pipeline_stats_supported && e->record_threads > 1 && !supported_features.inheritedQueries) {
+            printf("Device has no inheritedQueries, pipeline statistics are disabled with parallel recording\n");
+            e->pipeline_stats_supported = 0;
+        }
+        features.pipelineStatisticsQuery = e->pipeline_stats_supported ? VK_TRUE : VK_FALSE;
+        features.inheritedQueries = e->pipeline_stats_supported && e->record_threads > 1 ? VK_TRUE : VK_FALSE;
 
         // .enabledLayerCount and .ppEnabledLayerNames deprecated
         // TODO: for some reason, there is still some recomendation to put here
@@ -227,36 +867,77 @@ void base_init(Engine *e, Display *display, Window window) {
         
         VkDeviceCreateInfo device_ci = {
             .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-            .queueCreateInfoCount = 1,
-            .pQueueCreateInfos = &queue_ci,
+            .queueCreateInfoCount = queue_ci_count,
+            .pQueueCreateInfos = queue_cis,
             
-            .enabledExtensionCount = sizeof(device_extensions) / sizeof(const char *),
+            .enabledExtensionCount = e->headless ? 0 : sizeof(device_extensions) / sizeof(const char *),
             .ppEnabledExtensionNames = device_extensions,
-            .pEnabledFeatures = NULL
+            .pEnabledFeatures = &features,
         };
 
         VK_CHECK(vkCreateDevice(e->phys_device, &device_ci, NULL, &e->device));
 
         vkGetDeviceQueue(e->device, e->graphics_queue_family, 0, &e->graphics_queue);
+        vkGetDeviceQueue(e->device, e->compute.family, 0, &e->compute.queue);
+        vkGetDeviceQueue(e->device, e->transfer.family, 0, &e->transfer.queue);
     }
 
-    {
+    init_stage_end(e, "device");
+
+    // Pool per frame, so whole pool can be reset at once when frame fence is signaled
+    for (uint32_t i = 0; i < e->frames_in_flight; i++) {
+        EngineFrame *frame = &e->frames[i];
+
         VkCommandPoolCreateInfo command_pool_ci = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
             .queueFamilyIndex = e->graphics_queue_family,
         };
 
-        VK_CHECK(vkCreateCommandPool(e->device, &command_pool_ci, NULL, &e->command_pool));
+        VK_CHECK(vkCreateCommandPool(e->device, &command_pool_ci, NULL, &frame->command_pool));
 
         VkCommandBufferAllocateInfo command_buf_alloc_ci = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-            .commandPool = e->command_pool,
+            .commandPool = frame->command_pool,
             .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
             .commandBufferCount = 1,
         };
 
-        VK_CHECK(vkAllocateCommandBuffers(e->device, &command_buf_alloc_ci, &e->command_buffer));
+        VK_CHECK(vkAllocateCommandBuffers(e->device, &command_buf_alloc_ci, &frame->command_buffer));
+
+        // Recording threads never share pool, vkResetCommandPool of each is done by its own job
+        for (uint32_t t = 0; t < e->record_threads && e->record_threads > 1; t++) {
+            VK_CHECK(vkCreateCommandPool(e->device, &command_pool_ci, NULL, &frame->record_pools[t]));
+
+            VkCommandBufferAllocateInfo record_buf_alloc_ci = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = frame->record_pools[t],
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1,
+            };
+
+            VK_CHECK(vkAllocateCommandBuffers(e->device, &record_buf_alloc_ci, &frame->record_buffers[t]));
+        }
+
+        if (e->static_recording) {
+            VkCommandPoolCreateInfo static_pool_ci = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                .queueFamilyIndex = e->graphics_queue_family,
+            };
+
+            VK_CHECK(vkCreateCommandPool(e->device, &static_pool_ci, NULL, &frame->static_pool));
+
+            VkCommandBufferAllocateInfo static_buf_alloc_ci = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = frame->static_pool,
+                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                .commandBufferCount = ENGINE_MAX_STATIC_IMAGES,
+            };
+
+            VK_CHECK(vkAllocateCommandBuffers(e->device, &static_buf_alloc_ci, frame->static_buffers));
+            memset(frame->static_keys, 0, sizeof(frame->static_keys));
+        }
     }
 
     {
@@ -268,7 +949,8 @@ void base_init(Engine *e, Display *display, Window window) {
             .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
             .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
             .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+            // PRESENT_SRC_KHR is only valid with swapchain extension, offscreen images are left ready for readback
+            .finalLayout = e->headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
         };
 
         // TODO: ok, why can not we use VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL here
@@ -309,48 +991,595 @@ void base_init(Engine *e, Display *display, Window window) {
         VK_CHECK(vkCreateRenderPass(e->device, &render_pass_ci, NULL, &e->render_pass));
     }
 
+    {
+        VkCommandPoolCreateInfo command_pool_ci = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = e->graphics_queue_family,
+        };
+
+        VK_CHECK(vkCreateCommandPool(e->device, &command_pool_ci, NULL, &e->one_time_pool));
+
+        e->compute.one_time_pool = e->one_time_pool;
+        if (e->compute.family != e->graphics_queue_family) {
+            command_pool_ci.queueFamilyIndex = e->compute.family;
+            VK_CHECK(vkCreateCommandPool(e->device, &command_pool_ci, NULL, &e->compute.one_time_pool));
+        }
+
+        e->transfer.one_time_pool = e->one_time_pool;
+        if (e->transfer.family != e->graphics_queue_family) {
+            command_pool_ci.queueFamilyIndex = e->transfer.family;
+            VK_CHECK(vkCreateCommandPool(e->device, &command_pool_ci, NULL, &e->transfer.one_time_pool));
+        }
+    }
+
     {
         VkFenceCreateInfo fence_ci = {
             .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
             .flags = VK_FENCE_CREATE_SIGNALED_BIT,
         };
 
-        VK_CHECK(vkCreateFence(e->device, &fence_ci, NULL, &e->render_fence));
-
         VkSemaphoreCreateInfo semaphore_ci = {
             .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
         };
 
-        VK_CHECK(vkCreateSemaphore(e->device, &semaphore_ci, NULL, &e->present_sema));
-        VK_CHECK(vkCreateSemaphore(e->device, &semaphore_ci, NULL, &e->render_sema));
+        for (uint32_t i = 0; i < e->frames_in_flight; i++) {
+            VK_CHECK(vkCreateFence(e->device, &fence_ci, NULL, &e->frames[i].render_fence));
+            VK_CHECK(vkCreateSemaphore(e->device, &semaphore_ci, NULL, &e->frames[i].acquire_sema));
+        }
+
+        VK_CHECK(vkCreateSemaphore(e->device, &semaphore_ci, NULL, &e->handoff_sema));
+        VK_CHECK(vkCreateSemaphore(e->device, &semaphore_ci, NULL, &e->transfer_reset_sema));
+
+        // Upload fences start unsignaled, slot is free when it has no command buffer
+        fence_ci.flags = 0;
+        for (uint32_t i = 0; i < ENGINE_MAX_UPLOADS; i++) {
+            VK_CHECK(vkCreateFence(e->device, &fence_ci, NULL, &e->uploads[i].fence));
+            e->uploads[i].first_cmd = VK_NULL_HANDLE;
+            e->uploads[i].last_cmd = VK_NULL_HANDLE;
+            e->uploads[i].reset_cmd = VK_NULL_HANDLE;
+        }
+        e->upload_count = 0;
+        e->transfer_reset_cmd = VK_NULL_HANDLE;
     }
+
+    init_stage_end(e, "pools, render pass");
 }
 
 static
 void base_deinit(Engine *e) {
-    vkDestroySemaphore(e->device, e->render_sema, NULL);
-    vkDestroySemaphore(e->device, e->present_sema, NULL);
-    vkDestroyFence(e->device, e->render_fence, NULL);
-
-
-    vkDestroyRenderPass(e->device, e->render_pass, NULL);
+    for (int i = ENGINE_MAX_UPLOADS - 1; i >= 0; i--) {
+        vkDestroyFence(e->device, e->uploads[i].fence, NULL);
+    }
 
+    vkDestroySemaphore(e->device, e->transfer_reset_sema, NULL);
+    vkDestroySemaphore(e->device, e->handoff_sema, NULL);
 
-    vkFreeCommandBuffers(e->device, e->command_pool, 1, &e->command_buffer);
-    vkDestroyCommandPool(e->device, e->command_pool, NULL);
+    for (int i = e->frames_in_flight - 1; i >= 0; i--) {
+        vkDestroySemaphore(e->device, e->frames[i].acquire_sema, NULL);
+        vkDestroyFence(e->device, e->frames[i].render_fence, NULL);
+    }
 
 
-    vkDestroyDevice(e->device, NULL);
+    vkDestroyRenderPass(e->device, e->render_pass, NULL);
 
 
-    vkDestroySurfaceKHR(e->instance, e->surface, NULL);
+    if (e->transfer.one_time_pool != e->one_time_pool) {
+        vkDestroyCommandPool(e->device, e->transfer.one_time_pool, NULL);
+    }
+    if (e->compute.one_time_pool != e->one_time_pool) {
+        vkDestroyCommandPool(e->device, e->compute.one_time_pool, NULL);
+    }
+    vkDestroyCommandPool(e->device, e->one_time_pool, NULL);
+
+
+    for (int i = e->frames_in_flight - 1; i >= 0; i--) {
+        if (e->static_recording) {
+            vkFreeCommandBuffers(e->device, e->frames[i].static_pool, ENGINE_MAX_STATIC_IMAGES, e->frames[i].static_buffers);
+            vkDestroyCommandPool(e->device, e->frames[i].static_pool, NULL);
+        }
+        for (uint32_t t = 0; t < e->record_threads && e->record_threads > 1; t++) {
+            vkFreeCommandBuffers(e->device, e->frames[i].record_pools[t], 1, &e->frames[i].record_buffers[t]);
+            vkDestroyCommandPool(e->device, e->frames[i].record_pools[t], NULL);
+        }
+        vkFreeCommandBuffers(e->device, e->frames[i].command_pool, 1, &e->frames[i].command_buffer);
+        vkDestroyCommandPool(e->device, e->frames[i].command_pool, NULL);
+    }
+
+
+    vkDestroyDevice(e->device, NULL);
+
+
+    if (!e->headless) {
+        vkDestroySurfaceKHR(e->instance, e->surface, NULL);
+    }
 
 
     vkDestroyInstance(e->instance, NULL);
 }
 
+// Graphics queue in same form as dedicated ones, so upload helpers take any of them
+static
+EngineQueue queue_graphics(const Engine *e) {
+    EngineQueue q = {
+        .family = e->graphics_queue_family,
+        .queue = e->graphics_queue,
+        .one_time_pool = e->one_time_pool,
+    };
+    return q;
+}
+
+// Frees command buffers and staging buffer of completed uploads and reads their transfer time, with wait
+// blocks until all of them completed
+static
+void uploads_collect(Engine *e, int wait) {
+    for (uint32_t i = 0; i < ENGINE_MAX_UPLOADS && e->upload_count > 0; i++) {
+        EngineUpload *upload = &e->uploads[i];
+        if (upload->last_cmd == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        if (wait) {
+            VK_CHECK(vkWaitForFences(e->device, 1, &upload->fence, VK_TRUE, UINT64_MAX));
+        } else if (vkGetFenceStatus(e->device, upload->fence) != VK_SUCCESS) {
+            continue;
+        }
+
+        // Without timestamps it is CPU time from submit until completion was seen, so an upper bound
+        if (upload->transfer) {
+            uint64_t busy_ns = now_ns() - upload->submit_ns;
+            if (upload->transfer_query != UINT32_MAX) {
+                uint64_t timestamps[2];
+                VkResult result = vkGetQueryPoolResults(e->device, e->transfer_timestamp_pool, 2 * upload->transfer_query, 2,
+                    sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+                if (result == VK_SUCCESS) {
+                    uint64_t mask = e->transfer_timestamp_valid_bits >= 64 ? UINT64_MAX : (1ull << e->transfer_timestamp_valid_bits) - 1;
+                    uint64_t ticks = (timestamps[1] - timestamps[0]) & mask;
+                    busy_ns = (uint64_t)(ticks * (double)e->timestamp_period);
+                }
+            }
+            e->transfer_busy_ns += busy_ns;
+            e->transfer_submits++;
+        }
+
+        if (upload->first_cmd != VK_NULL_HANDLE) {
+            vkFreeCommandBuffers(e->device, upload->first_pool, 1, &upload->first_cmd);
+        }
+        vkFreeCommandBuffers(e->device, upload->last_pool, 1, &upload->last_cmd);
+        if (upload->reset_cmd != VK_NULL_HANDLE) {
+            vkFreeCommandBuffers(e->device, e->one_time_pool, 1, &upload->reset_cmd);
+        }
+        vkDestroyBuffer(e->device, upload->staging_buffer, NULL);
+
+        VK_CHECK(vkResetFences(e->device, 1, &upload->fence));
+        upload->first_cmd = VK_NULL_HANDLE;
+        upload->last_cmd = VK_NULL_HANDLE;
+        upload->reset_cmd = VK_NULL_HANDLE;
+        upload->staging_buffer = VK_NULL_HANDLE;
+        e->upload_count--;
+    }
+}
+
+// Transfer queue has no vkCmdResetQueryPool in Vulkan 1.0, so without graphics capable transfer family the
+// half entered next is reset by separate graphics submit which transfer submit waits for, CPU never waits
+static
+void transfer_queries_reset(Engine *e, VkCommandBuffer transfer_cmd) {
+    uint32_t first_pair = e->transfer_query_next;
+
+    // Pairs of this half were last used half a pool ago, those uploads are normally collected by now
+    for (uint32_t i = 0; i < ENGINE_MAX_UPLOADS; i++) {
+        uint32_t pair = e->uploads[i].transfer_query;
+        if (e->uploads[i].last_cmd != VK_NULL_HANDLE && pair >= first_pair && pair < first_pair + TRANSFER_QUERY_PAIRS / 2) {
+            uploads_collect(e, 1);
+            break;
+        }
+    }
+
+    if (e->transfer.family == e->graphics_queue_family) {
+        vkCmdResetQueryPool(transfer_cmd, e->transfer_timestamp_pool, 2 * first_pair, TRANSFER_QUERY_PAIRS);
+        return;
+    }
+
+    VkCommandBufferAllocateInfo command_buf_alloc_ci = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = e->one_time_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+
+    VK_CHECK(vkAllocateCommandBuffers(e->device, &command_buf_alloc_ci, &e->transfer_reset_cmd));
+
+    VkCommandBufferBeginInfo command_buf_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    VK_CHECK(vkBeginCommandBuffer(e->transfer_reset_cmd, &command_buf_begin_info));
+    vkCmdResetQueryPool(e->transfer_reset_cmd, e->transfer_timestamp_pool, 2 * first_pair, TRANSFER_QUERY_PAIRS);
+    VK_CHECK(vkEndCommandBuffer(e->transfer_reset_cmd));
+}
+
+// Command buffer for upload_submit2 or one_time_submit2
+static
+VkCommandBuffer one_time_begin(Engine *e, const EngineQueue *q) {
+    VkCommandBufferAllocateInfo command_buf_alloc_ci = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = q->one_time_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+
+    VkCommandBuffer cmd;
+    VK_CHECK(vkAllocateCommandBuffers(e->device, &command_buf_alloc_ci, &cmd));
+
+    VkCommandBufferBeginInfo command_buf_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    VK_CHECK(vkBeginCommandBuffer(cmd, &command_buf_begin_info));
+
+    // Start of transfer queue work, end is written by upload_submit2
+    if (q == &e->transfer && e->transfer_timestamp_pool != VK_NULL_HANDLE) {
+        if (e->transfer_query_next % (TRANSFER_QUERY_PAIRS / 2) == 0) {
+            transfer_queries_reset(e, cmd);
+        }
+        e->transfer_query_active = e->transfer_query_next;
+        e->transfer_query_next = (e->transfer_query_next + 1) % TRANSFER_QUERY_PAIRS;
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, e->transfer_timestamp_pool,
+            2 * e->transfer_query_active);
+    }
+
+    return cmd;
+}
+
+// Submits without waiting, also makes upload scratch writes visible. Last submit is always on queue of
+// consumer, so frames submitted after it are ordered by its barriers and need no semaphore, fence only tells
+// when command buffers, staging buffer and scratch can be reused
+// Two command buffers are for ownership transfer between families, second one runs on its queue after
+// first one completes, second may be VK_NULL_HANDLE, staging buffer too
+static
+void upload_submit2(Engine *e, const EngineQueue *first, VkCommandBuffer first_cmd,
+                    const EngineQueue *second, VkCommandBuffer second_cmd, VkBuffer staging_buffer) {
+    if (e->upload_count == ENGINE_MAX_UPLOADS) {
+        uploads_collect(e, 1);
+    }
+
+    EngineUpload *upload = NULL;
+    for (uint32_t i = 0; i < ENGINE_MAX_UPLOADS; i++) {
+        if (e->uploads[i].last_cmd == VK_NULL_HANDLE) {
+            upload = &e->uploads[i];
+            break;
+        }
+    }
+
+    VkCommandBuffer transfer_cmd = first == &e->transfer ? first_cmd : second == &e->transfer ? second_cmd : VK_NULL_HANDLE;
+    upload->transfer = transfer_cmd != VK_NULL_HANDLE;
+    upload->transfer_query = e->transfer_query_active;
+    e->transfer_query_active = UINT32_MAX;
+    if (transfer_cmd != VK_NULL_HANDLE && upload->transfer_query != UINT32_MAX) {
+        vkCmdWriteTimestamp(transfer_cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, e->transfer_timestamp_pool,
+            2 * upload->transfer_query + 1);
+    }
+
+    VK_CHECK(vkEndCommandBuffer(first_cmd));
+    if (second_cmd != VK_NULL_HANDLE) {
+        VK_CHECK(vkEndCommandBuffer(second_cmd));
+    }
+
+    alloc_flush(&e->allocator, &e->upload_scratch.allocation, 0, e->upload_scratch.head);
+    alloc_flush_commit(&e->allocator);
+
+    upload->submit_ns = now_ns();
+    upload->staging_buffer = staging_buffer;
+    upload->reset_cmd = e->transfer_reset_cmd;
+    e->transfer_reset_cmd = VK_NULL_HANDLE;
+
+    // Query reset for transfer queue, made by transfer_queries_reset
+    if (upload->reset_cmd != VK_NULL_HANDLE) {
+        VkSubmitInfo reset_submit_info = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &upload->reset_cmd,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &e->transfer_reset_sema,
+        };
+
+        VK_CHECK(vkQueueSubmit(e->graphics_queue, 1, &reset_submit_info, VK_NULL_HANDLE));
+    }
+
+    VkSemaphore wait_semas[2];
+    VkPipelineStageFlags wait_stages[2] = {VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT};
+    uint32_t first_wait_count = 0;
+    if (upload->reset_cmd != VK_NULL_HANDLE && first == &e->transfer) {
+        wait_semas[first_wait_count++] = e->transfer_reset_sema;
+    }
+
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = first_wait_count,
+        .pWaitSemaphores = wait_semas,
+        .pWaitDstStageMask = wait_stages,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &first_cmd,
+        .signalSemaphoreCount = second_cmd != VK_NULL_HANDLE ? 1 : 0,
+        .pSignalSemaphores = &e->handoff_sema,
+    };
+
+    VK_CHECK(vkQueueSubmit(first->queue, 1, &submit_info, second_cmd != VK_NULL_HANDLE ? VK_NULL_HANDLE : upload->fence));
+
+    upload->first_cmd = VK_NULL_HANDLE;
+    upload->last_pool = first->one_time_pool;
+    upload->last_cmd = first_cmd;
+
+    // Semaphore wait orders second submit after first one and makes its writes visible
+    if (second_cmd != VK_NULL_HANDLE) {
+        uint32_t second_wait_count = 0;
+        wait_semas[second_wait_count++] = e->handoff_sema;
+        if (upload->reset_cmd != VK_NULL_HANDLE && second == &e->transfer) {
+            wait_semas[second_wait_count++] = e->transfer_reset_sema;
+        }
+
+        VkSubmitInfo second_submit_info = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .waitSemaphoreCount = second_wait_count,
+            .pWaitSemaphores = wait_semas,
+            .pWaitDstStageMask = wait_stages,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &second_cmd,
+        };
+
+        VK_CHECK(vkQueueSubmit(second->queue, 1, &second_submit_info, upload->fence));
+
+        upload->first_pool = first->one_time_pool;
+        upload->first_cmd = first_cmd;
+        upload->last_pool = second->one_time_pool;
+        upload->last_cmd = second_cmd;
+    }
+
+    e->upload_count++;
+}
+
+static
+void upload_submit(Engine *e, const EngineQueue *q, VkCommandBuffer cmd, VkBuffer staging_buffer) {
+    upload_submit2(e, q, cmd, NULL, VK_NULL_HANDLE, staging_buffer);
+}
+
+// Blocking submit for rare work like readback, never use it per frame
+static
+void one_time_submit2(Engine *e, const EngineQueue *first, VkCommandBuffer first_cmd,
+                      const EngineQueue *second, VkCommandBuffer second_cmd) {
+    upload_submit2(e, first, first_cmd, second, second_cmd, VK_NULL_HANDLE);
+    uploads_collect(e, 1);
+}
+
+static
+void one_time_submit(Engine *e, const EngineQueue *q, VkCommandBuffer cmd) {
+    one_time_submit2(e, q, cmd, NULL, VK_NULL_HANDLE);
+}
+
+// Linear pool for staging data of one-time uploads, reset once no upload is pending
+static
+void upload_scratch_init(Engine *e) {
+    VkBufferCreateInfo buffer_ci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = UPLOAD_SCRATCH_SIZE,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    };
+
+    // Probe for memory types transfer source buffers accept, Vulkan guarantees it does not depend on size
+    VkBuffer probe;
+    VK_CHECK(vkCreateBuffer(e->device, &buffer_ci, NULL, &probe));
+    VkMemoryRequirements mem_req;
+    vkGetBufferMemoryRequirements(e->device, probe, &mem_req);
+    vkDestroyBuffer(e->device, probe, NULL);
+
+    if (!alloc_linear_init(&e->allocator, &e->upload_scratch, UPLOAD_SCRATCH_SIZE, mem_req.memoryTypeBits, ALLOC_USAGE_UPLOAD)) {
+        fprintf(stderr, "Unable to allocate memory for upload scratch\n");
+        exit(1);
+    }
+}
+
+static
+void upload_scratch_deinit(Engine *e) {
+    alloc_linear_deinit(&e->allocator, &e->upload_scratch);
+}
+
+// Transfer source buffer placed in scratch pool, handed to upload_submit which destroys it
+static
+VkBuffer upload_scratch_buffer(Engine *e, VkDeviceSize size, void **out_data) {
+    VkBufferCreateInfo buffer_ci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    };
+
+    VkBuffer buffer;
+    VK_CHECK(vkCreateBuffer(e->device, &buffer_ci, NULL, &buffer));
+
+    VkMemoryRequirements mem_req;
+    vkGetBufferMemoryRequirements(e->device, buffer, &mem_req);
+
+    VkDeviceSize offset = alloc_linear_push(&e->upload_scratch, mem_req.size, mem_req.alignment);
+    if (offset == UINT64_MAX) {
+        // Scratch is reused only once every upload reading it completed
+        uploads_collect(e, 1);
+        alloc_linear_reset(&e->upload_scratch);
+        offset = alloc_linear_push(&e->upload_scratch, mem_req.size, mem_req.alignment);
+    }
+    if (offset == UINT64_MAX) {
+        fprintf(stderr, "Upload scratch overflow: %lu bytes\n", (unsigned long)mem_req.size);
+        exit(1);
+    }
+
+    Allocation *scratch = &e->upload_scratch.allocation;
+    VK_CHECK(vkBindBufferMemory(e->device, buffer, scratch->memory, scratch->offset + offset));
+
+    *out_data = (char *)scratch->mapped + offset;
+    return buffer;
+}
+
+// GPU QUERIES, pools per frame in flight, results are read when frame fence is signaled, so never block
+
+static
+void gpu_queries_init(Engine *e) {
+    VkPhysicalDeviceProperties prop;
+    vkGetPhysicalDeviceProperties(e->phys_device, &prop);
+
+    e->timestamp_period = prop.limits.timestampPeriod;
+    e->timestamp_mask = e->timestamp_valid_bits >= 64 ? UINT64_MAX : (1ull << e->timestamp_valid_bits) - 1;
+
+    // Zero valid bits on transfer family leaves transfer busy time to CPU clock
+    e->transfer_timestamp_pool = VK_NULL_HANDLE;
+    e->transfer_query_active = UINT32_MAX;
+    if (e->transfer_timestamp_valid_bits > 0) {
+        VkQueryPoolCreateInfo query_pool_ci = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2 * TRANSFER_QUERY_PAIRS,
+        };
+
+        VK_CHECK(vkCreateQueryPool(e->device, &query_pool_ci, NULL, &e->transfer_timestamp_pool));
+        // First half is reset on first use
+        e->transfer_query_next = 0;
+    }
+
+    memset(&e->gpu_stats, 0, sizeof(e->gpu_stats));
+    e->gpu_stats.gpu_time_ms = -1.0f;
+    e->gpu_time_total_ms = 0;
+    e->gpu_time_frames = 0;
+
+    for (uint32_t i = 0; i < e->frames_in_flight; i++) {
+        EngineFrame *frame = &e->frames[i];
+
+        frame->timestamp_pool = VK_NULL_HANDLE;
+        frame->stats_pool = VK_NULL_HANDLE;
+        frame->queries_written = 0;
+
+        // Zero valid bits means queue does not support timestamps at all
+        if (e->timestamp_valid_bits > 0) {
+            VkQueryPoolCreateInfo query_pool_ci = {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                .queryCount = 2,
+            };
+
+            VK_CHECK(vkCreateQueryPool(e->device, &query_pool_ci, NULL, &frame->timestamp_pool));
+        }
+
+        if (e->pipeline_stats_supported) {
+            VkQueryPoolCreateInfo query_pool_ci = {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+                .queryCount = 1,
+                .pipelineStatistics = PIPELINE_STATISTICS,
+            };
+
+            VK_CHECK(vkCreateQueryPool(e->device, &query_pool_ci, NULL, &frame->stats_pool));
+        }
+    }
+
+    printf("GPU queries: timestamps %s (period %.3f ns), transfer queue timestamps %s, pipeline statistics %s\n",
+        e->timestamp_valid_bits > 0 ? "on" : "unsupported", (double)e->timestamp_period,
+        e->transfer_timestamp_valid_bits > 0 ? "on" : "unsupported", e->pipeline_stats_supported ? "on" : "off");
+}
+
+static
+void gpu_queries_deinit(Engine *e) {
+    for (int i = e->frames_in_flight - 1; i >= 0; i--) {
+        if (e->frames[i].stats_pool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(e->device, e->frames[i].stats_pool, NULL);
+        }
+        if (e->frames[i].timestamp_pool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(e->device, e->frames[i].timestamp_pool, NULL);
+        }
+    }
+
+    if (e->transfer_timestamp_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(e->device, e->transfer_timestamp_pool, NULL);
+    }
+}
+
+// Called after frame fence wait, so results are there, still no WAIT flag to never stall on driver quirks
+static
+void gpu_queries_collect(Engine *e, EngineFrame *frame) {
+    if (!frame->queries_written) {
+        return;
+    }
+    frame->queries_written = 0;
+
+    if (frame->timestamp_pool != VK_NULL_HANDLE) {
+        uint64_t timestamps[2];
+        VkResult result = vkGetQueryPoolResults(e->device, frame->timestamp_pool, 0, 2,
+            sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result == VK_SUCCESS) {
+            uint64_t ticks = (timestamps[1] - timestamps[0]) & e->timestamp_mask;
+            e->gpu_stats.gpu_time_ms = (float)(ticks * (double)e->timestamp_period / 1000000.0);
+            e->gpu_stats.frame_number = frame->queries_frame_number;
+            e->gpu_time_total_ms += (double)e->gpu_stats.gpu_time_ms;
+            e->gpu_time_frames++;
+        }
+    }
+
+    if (e->async_compute && frame->compute_timestamp_pool != VK_NULL_HANDLE) {
+        uint64_t timestamps[2];
+        VkResult result = vkGetQueryPoolResults(e->device, frame->compute_timestamp_pool, 0, 2,
+            sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result == VK_SUCCESS) {
+            uint64_t mask = e->compute_timestamp_valid_bits >= 64 ? UINT64_MAX : (1ull << e->compute_timestamp_valid_bits) - 1;
+            uint64_t ticks = (timestamps[1] - timestamps[0]) & mask;
+            e->compute_busy_ms += ticks * (double)e->timestamp_period / 1000000.0;
+        }
+    }
+
+    if (frame->stats_pool != VK_NULL_HANDLE) {
+        // Results are in order of statistic bits, vertex before fragment
+        uint64_t stats[2];
+        VkResult result = vkGetQueryPoolResults(e->device, frame->stats_pool, 0, 1,
+            sizeof(stats), stats, sizeof(stats), VK_QUERY_RESULT_64_BIT);
+        if (result == VK_SUCCESS) {
+            e->gpu_stats.vertex_invocations = stats[0];
+            e->gpu_stats.fragment_invocations = stats[1];
+        }
+    }
+}
+
+void engine_memory_stats(const Engine *e, AllocStats *out_stats) {
+    alloc_stats(&e->allocator, out_stats);
+}
+
+void engine_gpu_stats(const Engine *e, EngineGpuStats *out_stats) {
+    *out_stats = e->gpu_stats;
+}
+
+static
+VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static
+void stream_create_buffer(Engine *e, VkBufferUsageFlags usage, AllocUsage alloc_usage,
+                          VkBuffer *out_buffer, Allocation *out_allocation) {
+    VkBufferCreateInfo buffer_ci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = e->stream_frame_size * ENGINE_MAX_FRAMES_IN_FLIGHT,
+        .usage = usage,
+    };
+
+    VK_CHECK(vkCreateBuffer(e->device, &buffer_ci, NULL, out_buffer));
+
+    if (!alloc_buffer(&e->allocator, *out_buffer, alloc_usage, out_allocation)) {
+        fprintf(stderr, "Unable to allocate memory for stream ring\n");
+        exit(1);
+    }
+
+    printf("Stream ring memory: type %d, flags %d\n", out_allocation->memory_type,
+        e->allocator.mem_prop.memoryTypes[out_allocation->memory_type].propertyFlags);
+}
+
+// STREAM ring, persistently mapped, one slice per frame in flight, so CPU writes only slice whose fence was waited
 static
-void vertex_memory_init(Engine *e) {
+void stream_init(Engine *e) {
     {
         VkPhysicalDeviceMemoryProperties mem_properties;
         vkGetPhysicalDeviceMemoryProperties(e->phys_device, &mem_properties);
@@ -369,309 +1598,2237 @@ void vertex_memory_init(Engine *e) {
         }
     }
 
-    // TODO: flags
-    VkBufferCreateInfo buffer_ci = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = 2 * 1024,
-        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-    };
-
-    VK_CHECK(vkCreateBuffer(e->device, &buffer_ci, NULL, &e->buffer));
+    VkPhysicalDeviceProperties prop;
+    vkGetPhysicalDeviceProperties(e->phys_device, &prop);
 
-    VkMemoryRequirements mem_req;
-    vkGetBufferMemoryRequirements(e->device, e->buffer, &mem_req);
+    // Every allocation can be used as dynamic uniform offset and flushed without touching neighbour
+    e->stream_alignment = 16;
+    if (prop.limits.minUniformBufferOffsetAlignment > e->stream_alignment) {
+        e->stream_alignment = prop.limits.minUniformBufferOffsetAlignment;
+    }
+    if (prop.limits.nonCoherentAtomSize > e->stream_alignment) {
+        e->stream_alignment = prop.limits.nonCoherentAtomSize;
+    }
+    e->stream_frame_size = align_up(ENGINE_STREAM_FRAME_SIZE, e->stream_alignment);
+    e->stream_head = 0;
+    e->stream_peak = 0;
+
+    // Auto: write straight into device local memory if CPU can map it, otherwise copy from staging
+    VkBufferUsageFlags gpu_usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    e->stream_staged = e->config.stream_staging;
+    if (e->stream_staged < 0) {
+        VkBuffer probe;
+        VkBufferCreateInfo buffer_ci = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = e->stream_frame_size,
+            .usage = gpu_usage,
+        };
+        VK_CHECK(vkCreateBuffer(e->device, &buffer_ci, NULL, &probe));
 
-    VkPhysicalDeviceMemoryProperties mem_prop;
-    vkGetPhysicalDeviceMemoryProperties(e->phys_device, &mem_prop);
+        VkMemoryRequirements mem_req;
+        vkGetBufferMemoryRequirements(e->device, probe, &mem_req);
+        vkDestroyBuffer(e->device, probe, NULL);
 
-    uint32_t type_candid_count = 0;
-    uint32_t type_candid[VK_MAX_MEMORY_TYPES];
-    
-    // TODO: we do need CACHED_BIT try to choose if alternative is possible without cached choose it
-    for (uint32_t i = 0; i < mem_prop.memoryTypeCount; i++) {
-        VkMemoryType mem_type = mem_prop.memoryTypes[i];
-        if ((mem_req.memoryTypeBits & (1 << i)) &&
-            (mem_type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
-            (mem_type.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
-            type_candid[type_candid_count] = i;
-            type_candid_count++;
+        VkMemoryPropertyFlags wanted = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        e->stream_staged = 1;
+        for (uint32_t i = 0; i < e->allocator.mem_prop.memoryTypeCount; i++) {
+            if ((mem_req.memoryTypeBits & (1u << i)) && (e->allocator.mem_prop.memoryTypes[i].propertyFlags & wanted) == wanted) {
+                e->stream_staged = 0;
+            }
         }
     }
 
-    if (type_candid_count == 0) {
-        fprintf(stderr, "Unable to find memory type\n");
-        exit(1);
+    // Upload usage prefers write combined memory, CPU must only write it sequentially and never read back
+    if (e->stream_staged) {
+        stream_create_buffer(e, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, ALLOC_USAGE_UPLOAD,
+            &e->stream_buffer, &e->stream_allocation);
+        stream_create_buffer(e, gpu_usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, ALLOC_USAGE_GPU_ONLY,
+            &e->stream_device_buffer, &e->stream_device_allocation);
+    } else {
+        stream_create_buffer(e, gpu_usage, ALLOC_USAGE_UPLOAD,
+            &e->stream_buffer, &e->stream_allocation);
+        e->stream_device_buffer = VK_NULL_HANDLE;
     }
 
-    printf("Found %d types of memory for candidates\n", type_candid_count);
-    for (uint32_t i = 0; i < type_candid_count; i++) {
-        VkMemoryType mem_type = mem_prop.memoryTypes[type_candid[i]];
-        VkMemoryHeap heap = mem_prop.memoryHeaps[mem_type.heapIndex];
-        double mib_size = heap.size / 1024.0 / 1024.0;
-        printf("Type: %d, flags: %d, heap size: %.2f, heap: %d\n",
-            type_candid[i], mem_type.propertyFlags, mib_size, mem_type.heapIndex);
-    }
+    e->stream_mapped = e->stream_allocation.mapped;
 
-    uint32_t best_mem_type_index = type_candid[0];
-    uint64_t best_memory_size;
-    {
-        VkMemoryType temp = mem_prop.memoryTypes[type_candid[0]];
-        best_memory_size = mem_prop.memoryHeaps[temp.heapIndex].size;
-    }
+    printf("Stream ring: %lu KiB per frame, alignment %lu, %s, %s\n",
+        (unsigned long)(e->stream_frame_size / 1024), (unsigned long)e->stream_alignment,
+        e->stream_staged ? "staged into device local" : "direct", e->stream_allocation.coherent ? "coherent" : "flushed");
+}
 
-    // TODO: better heuristic
-    for (uint32_t i = 1; i < type_candid_count; i++) {
-        VkMemoryType mem_type = mem_prop.memoryTypes[type_candid[i]];
-        uint64_t heap_size = mem_prop.memoryHeaps[mem_type.heapIndex].size;
-        uint32_t cur_best_flags = mem_prop.memoryTypes[best_mem_type_index].propertyFlags;
-        if (heap_size > best_memory_size ||
-            (heap_size == best_memory_size && cur_best_flags > mem_type.propertyFlags)) {
-            best_mem_type_index = type_candid[i];
-            best_memory_size = heap_size;
-        }
+static
+void stream_deinit(Engine *e) {
+    if (e->stream_device_buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(e->device, e->stream_device_buffer, NULL);
+        alloc_free(&e->allocator, &e->stream_device_allocation);
     }
 
-    {
-        uint32_t heap_index = mem_prop.memoryTypes[best_mem_type_index].heapIndex;
-        double mib_size = mem_prop.memoryHeaps[heap_index].size / 1024.0 / 1024.0;
+    alloc_free(&e->allocator, &e->stream_allocation);
+    vkDestroyBuffer(e->device, e->stream_buffer, NULL);
+}
+
+// Buffer which draws bind, offsets returned by stream_alloc are valid in it
+static
+VkBuffer stream_gpu_buffer(Engine *e) {
+    return e->stream_staged ? e->stream_device_buffer : e->stream_buffer;
+}
+
+// Caller must have waited fence of current frame
+static
+void stream_begin_frame(Engine *e) {
+    e->stream_head = 0;
+}
 
-        printf("Memory chosen. Heap: %d, Type: %d, Size: %.2f\n", heap_index, best_mem_type_index, mib_size);
+// Returns pointer for writing up to max_size bytes, stream_commit tells how much was used
+static
+void *stream_reserve(Engine *e, VkDeviceSize max_size, VkDeviceSize *out_offset) {
+    if (e->stream_head + max_size > e->stream_frame_size) {
+        fprintf(stderr, "Stream ring overflow: %lu + %lu > %lu bytes per frame\n",
+            (unsigned long)e->stream_head, (unsigned long)max_size, (unsigned long)e->stream_frame_size);
+        exit(1);
     }
 
-    VkMemoryAllocateInfo mem_alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = mem_req.size,
-        .memoryTypeIndex = best_mem_type_index,
-    };
+    *out_offset = e->frame_index * e->stream_frame_size + e->stream_head;
+    return e->stream_mapped + *out_offset;
+}
 
-    VK_CHECK(vkAllocateMemory(e->device, &mem_alloc_info, NULL, &e->memory));
+static
+void stream_commit(Engine *e, VkDeviceSize size) {
+    e->stream_head = align_up(e->stream_head + size, e->stream_alignment);
+}
+
+static
+void *stream_alloc(Engine *e, VkDeviceSize size, VkDeviceSize *out_offset) {
+    void *ptr = stream_reserve(e, size, out_offset);
+    stream_commit(e, size);
+    return ptr;
+}
+
+// Makes written data visible to GPU, needed every frame, also when recorded commands are reused
+static
+void stream_end_frame(Engine *e) {
+    if (e->stream_head > e->stream_peak) {
+        e->stream_peak = e->stream_head;
+    }
+    if (e->stream_head == 0) {
+        return;
+    }
 
-    VK_CHECK(vkBindBufferMemory(e->device, e->buffer, e->memory, 0));
+    VkDeviceSize slice_offset = e->frame_index * e->stream_frame_size;
 
-    VK_CHECK(vkMapMemory(e->device, e->memory, 0, buffer_ci.size, 0, &e->mapped_data));
+    // Queued with other writes of this frame, committed once before submit
+    alloc_flush(&e->allocator, &e->stream_allocation, slice_offset, e->stream_head);
 }
 
+// Staging copy of current slice, must be outside render pass
 static
-void vertex_memory_deinit(Engine *e) {
-    vkUnmapMemory(e->device, e->memory);
+void stream_record_copy(Engine *e, VkCommandBuffer cmd) {
+    if (!e->stream_staged || e->stream_head == 0) {
+        return;
+    }
+
+    VkDeviceSize slice_offset = e->frame_index * e->stream_frame_size;
+
+    VkBufferCopy region = {
+        .srcOffset = slice_offset,
+        .dstOffset = slice_offset,
+        .size = e->stream_head,
+    };
+
+    vkCmdCopyBuffer(cmd, e->stream_buffer, e->stream_device_buffer, 1, &region);
+
+    VkBufferMemoryBarrier buffer_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = e->stream_device_buffer,
+        .offset = slice_offset,
+        .size = e->stream_head,
+    };
 
-    vkFreeMemory(e->device, e->memory, NULL);
-    vkDestroyBuffer(e->device, e->buffer, NULL);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+        0, NULL, 1, &buffer_barrier, 0, NULL);
 }
 
+// Set with one dynamic uniform buffer, offset selects FrameUniforms of current frame
 static
-void swapchain_init(Engine *e) {
-    // TODO: VkSurfaceCapabilitiesKHR have a lot of cool info
-    VkSurfaceCapabilitiesKHR surface_capabilities;
-    VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(e->phys_device, e->surface, &surface_capabilities));
-    VkExtent2D swapchain_extent = surface_capabilities.currentExtent;
-    VkExtent2D min_swapchain_extent = surface_capabilities.minImageExtent;
-    VkExtent2D max_swapchain_extent = surface_capabilities.maxImageExtent;
-    printf("Swapchain extent. Current: (%d, %d), Min: (%d, %d), Max: (%d, %d), Signaled: (%d, %d)\n",
-        swapchain_extent.width, swapchain_extent.height, min_swapchain_extent.width, min_swapchain_extent.height,
-        max_swapchain_extent.width, max_swapchain_extent.height, e->signaled_width, e->signaled_height);
-    if (swapchain_extent.width == 0xFFFFFFFF && swapchain_extent.height == 0xFFFFFFFF) {
-        fprintf(stderr, "Swapchain currentExtent have corner case values, TODO is there common system it may happen\n");
-    } else {
-        e->window.width = swapchain_extent.width;
-        e->window.height = swapchain_extent.height;
+void frame_descriptors_init(Engine *e) {
+    VkDescriptorSetLayoutBinding binding = {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+    };
+
+    VkDescriptorSetLayoutCreateInfo set_layout_ci = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+
+    VK_CHECK(vkCreateDescriptorSetLayout(e->device, &set_layout_ci, NULL, &e->frame_set_layout));
+
+    VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .descriptorCount = 1,
+    };
+
+    VkDescriptorPoolCreateInfo descriptor_pool_ci = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 1,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size,
+    };
+
+    VK_CHECK(vkCreateDescriptorPool(e->device, &descriptor_pool_ci, NULL, &e->frame_descriptor_pool));
+
+    VkDescriptorSetAllocateInfo set_alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = e->frame_descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &e->frame_set_layout,
+    };
+
+    VK_CHECK(vkAllocateDescriptorSets(e->device, &set_alloc_info, &e->frame_set));
+
+    VkDescriptorBufferInfo buffer_info = {
+        .buffer = stream_gpu_buffer(e),
+        .offset = 0,
+        .range = sizeof(FrameUniforms),
+    };
+
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = e->frame_set,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .pBufferInfo = &buffer_info,
+    };
+
+    vkUpdateDescriptorSets(e->device, 1, &write, 0, NULL);
+}
+
+static
+void frame_descriptors_deinit(Engine *e) {
+    vkDestroyDescriptorPool(e->device, e->frame_descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(e->device, e->frame_set_layout, NULL);
+}
+
+// Image views and per-image render semaphores of swapchain, same for main window and extra windows
+static
+void swapchain_images_init(Engine *e, VkSwapchainKHR swapchain, uint32_t *out_image_count,
+                           VkImageView **out_image_views, VkSemaphore **out_render_semas) {
+    {
+        // TODO: well we have image_count, but vulkan driver may allocate more, does this even happen?
+        VK_CHECK(vkGetSwapchainImagesKHR(e->device, swapchain, out_image_count, NULL));
+        // Allocation on resize, well may be we can use stack
+        VkImage *swapchain_images = malloc(*out_image_count * sizeof(VkImage));
+        VK_CHECK(vkGetSwapchainImagesKHR(e->device, swapchain, out_image_count, swapchain_images));
+
+        *out_image_views = malloc(*out_image_count * sizeof(VkImageView));
+        
+
+        // TODO: pNext may be useful with flags
+        VkImageViewCreateInfo image_view_ci = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            // .image = e->swapchain_images[i],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = e->surface_format.format,
+            // .components // becomes identity being zero
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            }
+        };
+        
+        for (uint32_t i = 0; i < *out_image_count; i++) {
+            image_view_ci.image = swapchain_images[i];
+            VK_CHECK(vkCreateImageView(e->device, &image_view_ci, NULL, &(*out_image_views)[i]));
+        }
+
+        free(swapchain_images);
+    }
+
+    {
+        VkSemaphoreCreateInfo semaphore_ci = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        };
+
+        *out_render_semas = malloc(*out_image_count * sizeof(VkSemaphore));
+        for (uint32_t i = 0; i < *out_image_count; i++) {
+            VK_CHECK(vkCreateSemaphore(e->device, &semaphore_ci, NULL, &(*out_render_semas)[i]));
+        }
+    }
+}
+
+// old_swapchain is retired one, passing it lets driver reuse resources and keep presenting during recreation
+static
+void swapchain_init(Engine *e, VkSwapchainKHR old_swapchain) {
+    e->swapchain_presents = 0;
+
+    // TODO: VkSurfaceCapabilitiesKHR have a lot of cool info
+    VkSurfaceCapabilitiesKHR surface_capabilities;
+    VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(e->phys_device, e->surface, &surface_capabilities));
+    VkExtent2D swapchain_extent = surface_capabilities.currentExtent;
+    VkExtent2D min_swapchain_extent = surface_capabilities.minImageExtent;
+    VkExtent2D max_swapchain_extent = surface_capabilities.maxImageExtent;
+    printf("Swapchain extent. Current: (%d, %d), Min: (%d, %d), Max: (%d, %d), Signaled: (%d, %d)\n",
+        swapchain_extent.width, swapchain_extent.height, min_swapchain_extent.width, min_swapchain_extent.height,
+        max_swapchain_extent.width, max_swapchain_extent.height, e->signaled_width, e->signaled_height);
+    if (swapchain_extent.width == 0xFFFFFFFF && swapchain_extent.height == 0xFFFFFFFF) {
+        fprintf(stderr, "Swapchain currentExtent have corner case values, TODO is there common system it may happen\n");
+    } else {
+        e->window.width = swapchain_extent.width;
+        e->window.height = swapchain_extent.height;
+    }
+
+    // NOTE: surface_capabilities. maxImageCount != 0, checked because zero stand for unlimited
+    uint32_t image_count = e->config.image_count;
+    if (image_count < surface_capabilities.minImageCount) {
+        image_count = surface_capabilities.minImageCount;
+    }
+    if (surface_capabilities.maxImageCount < image_count && surface_capabilities.maxImageCount != 0) {
+        image_count = surface_capabilities.maxImageCount;
+    }
+    if (image_count != e->config.image_count) {
+        printf("Swapchain image count %d is not supported, clamped to %d\n", e->config.image_count, image_count);
+    }
+
+    // TODO: flags
+    // TODO: imageExtent have actually can have strange behaviour, need to research
+    VkSwapchainCreateInfoKHR swapchain_ci = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+        .surface = e->surface,
+        .minImageCount = image_count,
+        .imageFormat = e->surface_format.format,
+        .imageColorSpace = e->surface_format.colorSpace,
+        .imageExtent = swapchain_extent,
+        .imageArrayLayers = 1, // TODO: For non-stereoscopic-3D applications, this value is 1, WTF?
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .preTransform = surface_capabilities.currentTransform,
+        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+        .presentMode = e->present_mode,
+        .clipped = VK_TRUE,
+        .oldSwapchain = old_swapchain,
+    };
+
+    VK_CHECK(vkCreateSwapchainKHR(e->device, &swapchain_ci, NULL, &e->swapchain));
+
+    if (old_swapchain == VK_NULL_HANDLE) {
+        printf("Swapchain: present mode %s (requested %s), min images %d (requested %d), frames in flight %d\n",
+            engine_present_mode_name(e->present_mode), engine_present_mode_name(e->config.present_mode),
+            image_count, e->config.image_count, e->frames_in_flight);
+    }
+
+    swapchain_images_init(e, e->swapchain, &e->swapchain_image_count, &e->swapchain_image_views, &e->render_semas);
+}
+
+static
+void swapchain_deinit(Engine *e) {
+    for (int i = e->swapchain_image_count - 1; i >= 0; i--) {
+        vkDestroySemaphore(e->device, e->render_semas[i], NULL);
+    }
+
+    free(e->render_semas);
+
+    for (int i = e->swapchain_image_count - 1; i >= 0; i--) {
+        vkDestroyImageView(e->device, e->swapchain_image_views[i], NULL);
+    }
+
+    free(e->swapchain_image_views);
+
+    vkDestroySwapchainKHR(e->device, e->swapchain, NULL);
+}
+
+// Engine owned ring of color targets, used instead of swapchain when there is no window
+static
+void headless_targets_init(Engine *e) {
+    e->window.width = e->signaled_width;
+    e->window.height = e->signaled_height;
+    e->swapchain_image_count = e->headless_image_count;
+
+    VkImageCreateInfo image_ci = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = e->surface_format.format,
+        .extent = {
+            .width = e->window.width,
+            .height = e->window.height,
+            .depth = 1,
+        },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    e->headless_images = malloc(e->swapchain_image_count * sizeof(VkImage));
+    for (uint32_t i = 0; i < e->swapchain_image_count; i++) {
+        VK_CHECK(vkCreateImage(e->device, &image_ci, NULL, &e->headless_images[i]));
+    }
+
+    e->headless_allocations = malloc(e->swapchain_image_count * sizeof(Allocation));
+
+    VkImageViewCreateInfo image_view_ci = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = e->surface_format.format,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        }
+    };
+
+    e->swapchain_image_views = malloc(e->swapchain_image_count * sizeof(VkImageView));
+    for (uint32_t i = 0; i < e->swapchain_image_count; i++) {
+        if (!alloc_image(&e->allocator, e->headless_images[i], ALLOC_USAGE_GPU_ONLY, &e->headless_allocations[i])) {
+            fprintf(stderr, "Unable to allocate memory for headless targets\n");
+            exit(1);
+        }
+
+        image_view_ci.image = e->headless_images[i];
+        VK_CHECK(vkCreateImageView(e->device, &image_view_ci, NULL, &e->swapchain_image_views[i]));
+    }
+
+    e->headless_next_image = 0;
+    e->last_image_index = UINT32_MAX;
+
+    printf("Headless targets: %d images, (%d, %d)\n", e->swapchain_image_count, e->window.width, e->window.height);
+}
+
+static
+void headless_targets_deinit(Engine *e) {
+    for (int i = e->swapchain_image_count - 1; i >= 0; i--) {
+        vkDestroyImageView(e->device, e->swapchain_image_views[i], NULL);
+        vkDestroyImage(e->device, e->headless_images[i], NULL);
+        alloc_free(&e->allocator, &e->headless_allocations[i]);
+    }
+
+    free(e->swapchain_image_views);
+    free(e->headless_images);
+    free(e->headless_allocations);
+}
+
+static
+void readback_init(Engine *e) {
+    VkBufferCreateInfo buffer_ci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = (VkDeviceSize)e->window.width * e->window.height * 4,
+        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    };
+
+    VK_CHECK(vkCreateBuffer(e->device, &buffer_ci, NULL, &e->readback_buffer));
+
+    // CPU reads this memory, uncached memory would make memcpy very slow
+    if (!alloc_buffer(&e->allocator, e->readback_buffer, ALLOC_USAGE_READBACK, &e->readback_allocation)) {
+        fprintf(stderr, "Unable to allocate memory for readback\n");
+        exit(1);
+    }
+
+    e->readback_extent = e->window;
+}
+
+static
+void readback_deinit(Engine *e) {
+    if (e->readback_buffer == VK_NULL_HANDLE) {
+        return;
+    }
+
+    vkDestroyBuffer(e->device, e->readback_buffer, NULL);
+    alloc_free(&e->allocator, &e->readback_allocation);
+
+    e->readback_buffer = VK_NULL_HANDLE;
+}
+
+static
+VkFramebuffer *framebuffers_create(Engine *e, VkExtent2D extent, uint32_t image_count, const VkImageView *image_views) {
+    // TODO: pNext with flags may have more stuff with VkFramebufferAttachmentsCreateInfo
+    VkFramebufferCreateInfo framebuffer_ci = {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .renderPass = e->render_pass,
+        .attachmentCount = 1,
+        // .pAttachments = &image_views[i],
+        .width = extent.width,
+        .height = extent.height,
+        .layers = 1,
+    };
+
+    VkFramebuffer *framebuffers = malloc(image_count * sizeof(VkFramebuffer));
+    for (uint32_t i = 0; i < image_count; i++) {
+        framebuffer_ci.pAttachments = &image_views[i];
+
+        VK_CHECK(vkCreateFramebuffer(e->device, &framebuffer_ci, NULL, &framebuffers[i]));
+    }
+
+    return framebuffers;
+}
+
+static
+void framebuffers_init(Engine *e) {
+    e->framebuffers = framebuffers_create(e, e->window, e->swapchain_image_count, e->swapchain_image_views);
+}
+
+static
+void framebuffers_deinit(Engine *e) {
+    for (int i = e->swapchain_image_count - 1; i >= 0; i--) {
+        vkDestroyFramebuffer(e->device, e->framebuffers[i], NULL);
+    }
+
+    free(e->framebuffers);
+}
+
+// One window queue, presented tells whether a present to its current swapchain completed, returns kept count
+static
+uint32_t retired_collect_queue(Engine *e, EngineRetiredSwapchain *queue, uint32_t count, int presented, int force) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        EngineRetiredSwapchain *retired = &queue[i];
+
+        if (!force && (e->frame_number < retired->retire_frame || !presented)) {
+            queue[kept] = *retired;
+            kept++;
+            continue;
+        }
+
+        for (int j = retired->image_count - 1; j >= 0; j--) {
+            vkDestroyFramebuffer(e->device, retired->framebuffers[j], NULL);
+            vkDestroySemaphore(e->device, retired->render_semas[j], NULL);
+            vkDestroyImageView(e->device, retired->image_views[j], NULL);
+        }
+
+        free(retired->framebuffers);
+        free(retired->render_semas);
+        free(retired->image_views);
+
+        vkDestroySwapchainKHR(e->device, retired->swapchain, NULL);
+    }
+
+    return kept;
+}
+
+// Destroys retired swapchains of every window whose frames completed, or all of them with force after
+// waiting for idle
+static
+void retired_collect(Engine *e, int force) {
+    if (force) {
+        vkDeviceWaitIdle(e->device);
+    }
+
+    e->retired_count = retired_collect_queue(e, e->retired, e->retired_count,
+        e->swapchain_presents > e->swapchain_image_count, force);
+
+    for (uint32_t v = 0; v < e->view_count; v++) {
+        EngineView *view = &e->views[v];
+        view->retired_count = retired_collect_queue(e, view->retired, view->retired_count,
+            view->swapchain_presents > view->image_count, force);
+    }
+}
+
+// Moves current swapchain and everything created from it into deferred destruction queue
+// Frames already submitted still reference them and queued presents wait on render semaphores, so they live
+// until those frames are retired and a later present to new swapchain completed
+static
+void swapchain_retire(Engine *e) {
+    if (e->retired_count == ENGINE_MAX_RETIRED_SWAPCHAINS) {
+        // Queue is full only with resize every frame, waiting is fine then
+        retired_collect(e, 1);
+    }
+
+    // Frame number N waits on fence of frame N - frames_in_flight, so that is the first one
+    // for which all frames up to e->frame_number - 1 are known to be complete
+    EngineRetiredSwapchain retired = {
+        .swapchain = e->swapchain,
+        .image_count = e->swapchain_image_count,
+        .image_views = e->swapchain_image_views,
+        .framebuffers = e->framebuffers,
+        .render_semas = e->render_semas,
+        .retire_frame = e->frame_number + e->frames_in_flight - 1,
+    };
+
+    e->retired[e->retired_count] = retired;
+    e->retired_count++;
+}
+
+// VIEWS, extra windows rendered with same device, pipelines and stream ring as main window
+
+// Extent follows window, image count follows config, format and render pass are the main window ones
+static
+void view_swapchain_init(Engine *e, EngineView *view, VkSwapchainKHR old_swapchain) {
+    view->swapchain_presents = 0;
+
+    VkSurfaceCapabilitiesKHR surface_capabilities;
+    VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(e->phys_device, view->surface, &surface_capabilities));
+    view->extent = surface_capabilities.currentExtent;
+    if (view->extent.width == 0xFFFFFFFF && view->extent.height == 0xFFFFFFFF) {
+        view->extent = e->window;
+    }
+
+    // Minimized window has zero extent and no swapchain can be created for it, view stays empty and is
+    // skipped until rebuild finds non zero extent
+    if (view->extent.width == 0 || view->extent.height == 0) {
+        view->swapchain = VK_NULL_HANDLE;
+        view->image_count = 0;
+        view->image_views = NULL;
+        view->render_semas = NULL;
+        view->framebuffers = NULL;
+        view->rebuild = 1;
+        return;
+    }
+
+    uint32_t image_count = e->config.image_count;
+    if (image_count < surface_capabilities.minImageCount) {
+        image_count = surface_capabilities.minImageCount;
+    }
+    if (surface_capabilities.maxImageCount < image_count && surface_capabilities.maxImageCount != 0) {
+        image_count = surface_capabilities.maxImageCount;
+    }
+
+    VkSwapchainCreateInfoKHR swapchain_ci = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+        .surface = view->surface,
+        .minImageCount = image_count,
+        .imageFormat = e->surface_format.format,
+        .imageColorSpace = e->surface_format.colorSpace,
+        .imageExtent = view->extent,
+        .imageArrayLayers = 1,
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .preTransform = surface_capabilities.currentTransform,
+        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+        .presentMode = view->present_mode,
+        .clipped = VK_TRUE,
+        .oldSwapchain = old_swapchain,
+    };
+
+    VK_CHECK(vkCreateSwapchainKHR(e->device, &swapchain_ci, NULL, &view->swapchain));
+
+    swapchain_images_init(e, view->swapchain, &view->image_count, &view->image_views, &view->render_semas);
+    view->framebuffers = framebuffers_create(e, view->extent, view->image_count, view->image_views);
+}
+
+// Swapchain itself is left to caller, rebuild passes it as old swapchain first
+static
+void view_swapchain_deinit(Engine *e, EngineView *view) {
+    for (int i = view->image_count - 1; i >= 0; i--) {
+        vkDestroyFramebuffer(e->device, view->framebuffers[i], NULL);
+        vkDestroySemaphore(e->device, view->render_semas[i], NULL);
+        vkDestroyImageView(e->device, view->image_views[i], NULL);
+    }
+
+    free(view->framebuffers);
+    free(view->render_semas);
+    free(view->image_views);
+}
+
+// Same deferred destruction as main window, see swapchain_retire, old swapchain of minimized view is none
+static
+void view_swapchain_retire(Engine *e, EngineView *view) {
+    if (view->swapchain == VK_NULL_HANDLE) {
+        return;
+    }
+
+    if (view->retired_count == ENGINE_MAX_RETIRED_SWAPCHAINS) {
+        // Queue is full only with resize every frame, waiting is fine then
+        retired_collect(e, 1);
+    }
+
+    EngineRetiredSwapchain retired = {
+        .swapchain = view->swapchain,
+        .image_count = view->image_count,
+        .image_views = view->image_views,
+        .framebuffers = view->framebuffers,
+        .render_semas = view->render_semas,
+        .retire_frame = e->frame_number + e->frames_in_flight - 1,
+    };
+
+    view->retired[view->retired_count] = retired;
+    view->retired_count++;
+}
+
+// No vkDeviceWaitIdle, dragging extra window must not stall frames of main one, frames in flight keep using
+// old swapchain until it is collected
+static
+void view_rebuild(Engine *e, EngineView *view) {
+    // While minimized rebuild is retried every frame, checked first so it costs one query
+    VkSurfaceCapabilitiesKHR surface_capabilities;
+    VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(e->phys_device, view->surface, &surface_capabilities));
+    if (surface_capabilities.currentExtent.width == 0 || surface_capabilities.currentExtent.height == 0) {
+        return;
+    }
+
+    view->rebuild = 0;
+
+    VkSwapchainKHR old_swapchain = view->swapchain;
+    view_swapchain_retire(e, view);
+    view_swapchain_init(e, view, old_swapchain);
+
+    view->rebuilds++;
+}
+
+uint32_t engine_add_window(Engine *e, Display *display, Window window) {
+    if (e->headless || e->view_count == ENGINE_MAX_VIEWS) {
+        fprintf(stderr, "engine_add_window: no extra windows in headless mode, at most %d otherwise\n", ENGINE_MAX_VIEWS);
+        exit(1);
+    }
+
+    EngineView *view = &e->views[e->view_count];
+    memset(view, 0, sizeof(*view));
+
+    VkXlibSurfaceCreateInfoKHR xlib_surface_ci = {
+        .sType = VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR,
+        .dpy = display,
+        .window = window,
+    };
+
+    VK_CHECK(vkCreateXlibSurfaceKHR(e->instance, &xlib_surface_ci, NULL, &view->surface));
+
+    // Device and queue were picked for main window, every other surface must work with them as is
+    VkBool32 supported = VK_FALSE;
+    VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(e->phys_device, e->graphics_queue_family, view->surface, &supported));
+    if (supported != VK_TRUE) {
+        fprintf(stderr, "Graphics queue can not present to extra window\n");
+        exit(1);
+    }
+
+    {
+        uint32_t format_count;
+        VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(e->phys_device, view->surface, &format_count, NULL));
+        VkSurfaceFormatKHR *surface_formats = malloc(format_count * sizeof(VkSurfaceFormatKHR));
+        VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(e->phys_device, view->surface, &format_count, surface_formats));
+
+        int found = 0;
+        for (uint32_t i = 0; i < format_count; i++) {
+            if (surface_formats[i].format == e->surface_format.format &&
+                surface_formats[i].colorSpace == e->surface_format.colorSpace) {
+                found = 1;
+            }
+        }
+
+        free(surface_formats);
+
+        // Render pass and pipelines are shared, so format can not differ
+        if (!found) {
+            fprintf(stderr, "Extra window does not support surface format of main window\n");
+            exit(1);
+        }
+    }
+
+    view->present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    {
+        uint32_t present_mode_count = 0;
+        VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(e->phys_device, view->surface, &present_mode_count, NULL));
+        VkPresentModeKHR *present_modes = malloc(present_mode_count * sizeof(VkPresentModeKHR));
+        VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(e->phys_device, view->surface, &present_mode_count, present_modes));
+
+        for (uint32_t i = 0; i < present_mode_count; i++) {
+            if (present_modes[i] == e->present_mode) {
+                view->present_mode = e->present_mode;
+            }
+        }
+
+        free(present_modes);
+    }
+
+    {
+        VkSemaphoreCreateInfo semaphore_ci = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        };
+
+        for (uint32_t i = 0; i < e->frames_in_flight; i++) {
+            VK_CHECK(vkCreateSemaphore(e->device, &semaphore_ci, NULL, &view->acquire_semas[i]));
+        }
+    }
+
+    view_swapchain_init(e, view, VK_NULL_HANDLE);
+    view->image_index = UINT32_MAX;
+
+    e->view_count++;
+
+    printf("Window %u: present mode %s, %d images, (%d, %d)\n", e->view_count,
+        engine_present_mode_name(view->present_mode), view->image_count, view->extent.width, view->extent.height);
+
+    return e->view_count;
+}
+
+static
+void views_deinit(Engine *e) {
+    for (int v = e->view_count - 1; v >= 0; v--) {
+        EngineView *view = &e->views[v];
+
+        view_swapchain_deinit(e, view);
+        vkDestroySwapchainKHR(e->device, view->swapchain, NULL);
+
+        for (int i = e->frames_in_flight - 1; i >= 0; i--) {
+            vkDestroySemaphore(e->device, view->acquire_semas[i], NULL);
+        }
+
+        vkDestroySurfaceKHR(e->instance, view->surface, NULL);
+    }
+
+    e->view_count = 0;
+}
+
+// Window which has no image this frame is skipped, main window alone paces the loop
+static
+void views_acquire(Engine *e) {
+    for (uint32_t v = 0; v < e->view_count; v++) {
+        EngineView *view = &e->views[v];
+        view->image_index = UINT32_MAX;
+
+        if (view->rebuild) {
+            PROFILE_BEGIN("window rebuild");
+            view_rebuild(e, view);
+            PROFILE_END();
+
+            // Still minimized
+            if (view->rebuild) {
+                continue;
+            }
+        }
+
+        // Zero timeout, slow or hidden window must not stall main one, semaphore is not signaled when
+        // no image is returned, so it is free for next try
+        uint32_t image_index;
+        VkResult result = vkAcquireNextImageKHR(e->device, view->swapchain, 0,
+            view->acquire_semas[e->frame_index], VK_NULL_HANDLE, &image_index);
+        if (result == VK_NOT_READY || result == VK_TIMEOUT) {
+            view->acquire_skips++;
+            continue;
+        }
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            view->rebuild = 1;
+            continue;
+        }
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            fprintf(stderr, "vkAcquireNextImageKHR for window %u (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)\n", v + 1);
+            exit(1);
+        }
+        // Image is still presentable, rebuild happens next frame
+        if (result == VK_SUBOPTIMAL_KHR) {
+            view->rebuild = 1;
+        }
+
+        view->image_index = image_index;
+    }
+}
+
+void engine_signal_window_resize(Engine *e, uint32_t window, int width, int height) {
+    if (window == 0) {
+        engine_signal_resize(e, width, height);
+        return;
+    }
+
+    // No policy for extra windows, swapchain takes extent from surface anyway
+    e->views[window - 1].rebuild = 1;
+}
+
+uint64_t engine_window_presents(const Engine *e, uint32_t window) {
+    return window == 0 ? e->presents : e->views[window - 1].presents;
+}
+
+// SPIR-V is linked into binary, so there is no file system access on startup
+// With config.shader_dir set, <shader_dir>/<filename> is mapped instead, handy to iterate on shaders without rebuild
+static
+void load_shader_module(Engine *e, const char *filename, const uint32_t *embedded_code, size_t embedded_size,
+                        VkShaderModule *out_shader_module) {
+    const uint32_t *code = embedded_code;
+    size_t code_size = embedded_size;
+
+    int fd = -1;
+    void *mapped = MAP_FAILED;
+
+    if (e->config.shader_dir != NULL) {
+        char filepath[4096];
+        snprintf(filepath, sizeof(filepath), "%s/%s", e->config.shader_dir, filename);
+
+        fd = open(filepath, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Failed to open file: %s\n", filepath);
+            exit(1);
+        }
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+            fprintf(stderr, "Failed to stat file: %s\n", filepath);
+            exit(1);
+        }
+
+        // Zero copy, mapping is page aligned so it satisfies uint32_t alignment of pCode
+        mapped = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            fprintf(stderr, "Failed to mmap file: %s\n", filepath);
+            exit(1);
+        }
+
+        code = mapped;
+        code_size = file_stat.st_size;
+    }
+
+    // Vulkan requires the shader size to be a multiple of 4, the SPIR-V binary is naturally aligned to 4 bytes
+    if (code_size % 4 != 0) {
+        fprintf(stderr, "Invalid SPIR-V code\n");
+        exit(1);
+    }
+
+    VkShaderModuleCreateInfo shader_module_ci = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = code_size,
+        .pCode = code,
+    };
+
+    VK_CHECK(vkCreateShaderModule(e->device, &shader_module_ci, NULL, out_shader_module));
+
+    if (mapped != MAP_FAILED) {
+        munmap(mapped, code_size);
+        close(fd);
+    }
+}
+
+// Layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE, every driver puts it in front of its own data
+typedef struct PipelineCacheHeader {
+    uint32_t header_size;
+    uint32_t header_version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint8_t uuid[VK_UUID_SIZE];
+} PipelineCacheHeader;
+
+// Reads cache blob written by previous run, blob from other device or driver version is thrown away
+static
+void pipeline_cache_init(Engine *e) {
+    void *data = NULL;
+    size_t data_size = 0;
+
+    e->pipeline_cache_warm = 0;
+
+    FILE *file = e->config.pipeline_cache_path ? fopen(e->config.pipeline_cache_path, "rb") : NULL;
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        long filesize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        if (filesize >= (long)sizeof(PipelineCacheHeader)) {
+            data = malloc(filesize);
+            if (fread(data, 1, filesize, file) == (size_t)filesize) {
+                data_size = filesize;
+            }
+        }
+
+        fclose(file);
+    }
+
+    if (data_size > 0) {
+        VkPhysicalDeviceProperties prop;
+        vkGetPhysicalDeviceProperties(e->phys_device, &prop);
+
+        PipelineCacheHeader header;
+        memcpy(&header, data, sizeof(header));
+
+        if (header.header_size < sizeof(PipelineCacheHeader) ||
+            header.header_version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+            header.vendor_id != prop.vendorID ||
+            header.device_id != prop.deviceID ||
+            memcmp(header.uuid, prop.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            printf("Pipeline cache %s is stale or from other device, ignored\n", e->config.pipeline_cache_path);
+            data_size = 0;
+        }
+    }
+
+    VkPipelineCacheCreateInfo pipeline_cache_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = data_size,
+        .pInitialData = data_size > 0 ? data : NULL,
+    };
+
+    VkResult result = vkCreatePipelineCache(e->device, &pipeline_cache_ci, NULL, &e->pipeline_cache);
+    if (result != VK_SUCCESS && data_size > 0) {
+        // Driver may still reject blob, start from empty cache then
+        pipeline_cache_ci.initialDataSize = 0;
+        pipeline_cache_ci.pInitialData = NULL;
+        data_size = 0;
+        result = vkCreatePipelineCache(e->device, &pipeline_cache_ci, NULL, &e->pipeline_cache);
+    }
+    VK_CHECK(result);
+
+    e->pipeline_cache_warm = data_size > 0;
+    printf("Pipeline cache: %s, %lu bytes loaded\n", e->pipeline_cache_warm ? "warm" : "cold", (unsigned long)data_size);
+
+    free(data);
+}
+
+// Written to temporary file and renamed, so crash in the middle never leaves truncated cache
+static
+void pipeline_cache_deinit(Engine *e) {
+    if (e->config.pipeline_cache_path) {
+        size_t data_size = 0;
+        VK_CHECK(vkGetPipelineCacheData(e->device, e->pipeline_cache, &data_size, NULL));
+        void *data = malloc(data_size);
+        VK_CHECK(vkGetPipelineCacheData(e->device, e->pipeline_cache, &data_size, data));
+
+        char tmp_path[4096];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", e->config.pipeline_cache_path);
+
+        FILE *file = fopen(tmp_path, "wb");
+        if (file) {
+            int ok = fwrite(data, 1, data_size, file) == data_size;
+            ok = fflush(file) == 0 && ok;
+            ok = fsync(fileno(file)) == 0 && ok;
+            ok = fclose(file) == 0 && ok;
+
+            if (ok && rename(tmp_path, e->config.pipeline_cache_path) == 0) {
+                printf("Pipeline cache: %lu bytes written to %s\n", (unsigned long)data_size, e->config.pipeline_cache_path);
+            } else {
+                fprintf(stderr, "Failed to write pipeline cache: %s\n", e->config.pipeline_cache_path);
+                unlink(tmp_path);
+            }
+        } else {
+            fprintf(stderr, "Failed to open file: %s\n", tmp_path);
+        }
+
+        free(data);
+    }
+
+    vkDestroyPipelineCache(e->device, e->pipeline_cache, NULL);
+}
+
+static
+void triangle_pipeline_init(Engine *e) {
+    VkShaderModule triangle_frag_shader;
+    load_shader_module(e, "triangle.frag.spv", triangle_frag_spv, sizeof(triangle_frag_spv), &triangle_frag_shader);
+
+    VkShaderModule triangle_vert_shader;
+    load_shader_module(e, "triangle.vert.spv", triangle_vert_spv, sizeof(triangle_vert_spv), &triangle_vert_shader);
+
+    // TODO: flags
+    // no layouts or push constants
+    VkPipelineLayoutCreateInfo pipeline_layout_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 0,
+        .pSetLayouts = NULL,
+        .pushConstantRangeCount = 0,
+        .pPushConstantRanges = NULL,
+    };
+
+    VkPipelineLayout triangle_pipeline_layout;
+    VK_CHECK(vkCreatePipelineLayout(e->device, &pipeline_layout_ci, NULL, &triangle_pipeline_layout));
+
+    // TODO flags are interested here also
+    VkPipelineShaderStageCreateInfo vertex_shader_stage_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_VERTEX_BIT,
+        .module = triangle_vert_shader,
+        .pName = "main",
+    };
+
+    VkPipelineShaderStageCreateInfo fragment_shader_stage_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .module = triangle_frag_shader,
+        .pName = "main",
+    };
+
+    VkPipelineShaderStageCreateInfo shader_stages[2] = {vertex_shader_stage_ci, fragment_shader_stage_ci};
+
+    // TODO: pNext may do more intersting, especially on NV
+    // both viewport and scissor are dynamic, because of resize behaviour
+    VkPipelineViewportStateCreateInfo viewport_state_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .scissorCount = 1,
+    };
+
+    // Well, we do not want to do any complex blending
+    VkPipelineColorBlendAttachmentState color_blend_attach_state = {
+        .blendEnable = VK_FALSE,
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+    };
+
+    VkPipelineColorBlendStateCreateInfo color_blend_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .logicOpEnable = VK_FALSE,
+        .attachmentCount = 1,
+        .pAttachments = &color_blend_attach_state,
+    };
+
+    VkVertexInputBindingDescription binding_desc = {
+        .binding = 0,
+        .stride = sizeof(float) * 2,
+        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+    };
+
+    VkVertexInputAttributeDescription attr_desc = {
+        .location = 0,
+        .binding = 0,
+        .format = VK_FORMAT_R32G32_SFLOAT,
+        .offset = 0,
+    };
+
+    // TODO: input vs attribute?
+    VkPipelineVertexInputStateCreateInfo vertex_input_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = &binding_desc,
+        .vertexAttributeDescriptionCount = 1,
+        .pVertexAttributeDescriptions = &attr_desc,
+    };
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        .primitiveRestartEnable = VK_FALSE,
+    };
+
+    // TODO: intresting there is other polygon modes, such as point and lines, how the actually work?
+    VkPipelineRasterizationStateCreateInfo raster_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .depthClampEnable = VK_FALSE,
+        .rasterizerDiscardEnable = VK_FALSE,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .cullMode = VK_CULL_MODE_NONE,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+        .depthBiasEnable = VK_FALSE,
+        .depthBiasConstantFactor = 0.0f,
+        .depthBiasClamp = 0.0f,
+        .depthBiasSlopeFactor = 0.0f,
+        .lineWidth = 1.0f,
+    };
+
+    VkPipelineMultisampleStateCreateInfo multisample_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+        .sampleShadingEnable = VK_FALSE,
+        .minSampleShading = 1.0f,
+        .pSampleMask = NULL,
+        .alphaToCoverageEnable = VK_FALSE,
+        .alphaToOneEnable = VK_FALSE,
+    };
+
+    VkDynamicState dynamic_states[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR,
+    };
+
+    VkPipelineDynamicStateCreateInfo dynamic_state_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = sizeof(dynamic_states) / sizeof(VkDynamicState),
+        .pDynamicStates = dynamic_states,
+    };
+
+    VkGraphicsPipelineCreateInfo pipeline_ci = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .stageCount = 2,
+        .pStages = shader_stages,
+        .pVertexInputState = &vertex_input_ci,
+        .pInputAssemblyState = &input_assembly_ci,
+        .pViewportState = &viewport_state_ci,
+        .pRasterizationState = &raster_ci,
+        .pMultisampleState = &multisample_ci,
+        .pColorBlendState = &color_blend_ci,
+        .pDynamicState = &dynamic_state_ci,
+        .layout = triangle_pipeline_layout,
+        .renderPass = e->render_pass,
+        .subpass = 0,
+        .basePipelineHandle = VK_NULL_HANDLE,
+    };
+    
+    {
+        uint64_t create_start = now_ns();
+        VK_CHECK(vkCreateGraphicsPipelines(e->device, e->pipeline_cache, 1, &pipeline_ci, NULL, &e->triangle_pipeline));
+        printf("Triangle pipeline created in %.3f ms, %s cache\n",
+            (now_ns() - create_start) / 1000000.0, e->pipeline_cache_warm ? "warm" : "cold");
+    }
+
+    vkDestroyShaderModule(e->device, triangle_frag_shader, NULL);
+    vkDestroyShaderModule(e->device, triangle_vert_shader, NULL);
+
+    vkDestroyPipelineLayout(e->device, triangle_pipeline_layout, NULL);
+}
+
+static
+void triangle_pipeline_deinit(Engine *e) {
+    vkDestroyPipeline(e->device, e->triangle_pipeline, NULL);
+}
+
+// Cheap integer hash, so every instance is generated independently of others and uploads can go in chunks
+static
+uint32_t hash_u32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Keep covered area roughly constant, single instance is as big as single triangle, random in half to full size
+static
+float mass_scale(uint32_t h, uint32_t total) {
+    return 1.0f / sqrtf((float)total) * (0.5f + (h & 0xff) / 510.0f);
+}
+
+// Bright colors, no channel below 64
+static
+uint32_t mass_color(uint32_t h) {
+    return (64u + (h & 0xbf))
+        | (64u + ((h >> 8) & 0xbf)) << 8
+        | (64u + ((h >> 16) & 0xbf)) << 16
+        | 0xffu << 24;
+}
+
+static
+void mass_instances_fill(void *dst, uint32_t first, uint32_t count, uint32_t total) {
+    MassInstance *instances = dst;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t h0 = hash_u32((first + i) * 2);
+        uint32_t h1 = hash_u32((first + i) * 2 + 1);
+
+        MassInstance *instance = &instances[i];
+        // Half of SNORM range is visible part of NDC
+        instance->offset[0] = (int16_t)(h0 & 0xffff) / 2;
+        instance->offset[1] = (int16_t)(h0 >> 16) / 2;
+        instance->scale = (uint16_t)(mass_scale(h1, total) * 65535.0f);
+        instance->phase = (uint16_t)(h1 >> 16);
+        instance->color = mass_color(hash_u32(h1));
+    }
+}
+
+static
+void mass_objects_fill(void *dst, uint32_t first, uint32_t count, uint32_t total) {
+    MassObject *objects = dst;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t h0 = hash_u32((first + i) * 2);
+        uint32_t h1 = hash_u32((first + i) * 2 + 1);
+        uint32_t h2 = hash_u32(h1);
+
+        MassObject *object = &objects[i];
+        // Whole world, not only visible part, so culling has something to do
+        object->position[0] = (int16_t)(h0 & 0xffff) / 32768.0f * MASS_WORLD_SIZE;
+        object->position[1] = (int16_t)(h0 >> 16) / 32768.0f * MASS_WORLD_SIZE;
+        // Up to quarter of screen per second in any direction
+        float angle = (h2 >> 24) / 256.0f * 2.0f * (float) M_PI;
+        float speed = 0.05f + ((h2 >> 16) & 0xff) / 255.0f * 0.45f;
+        object->velocity[0] = cosf(angle) * speed;
+        object->velocity[1] = sinf(angle) * speed;
+        object->scale = mass_scale(h1, total);
+        object->phase = (h1 >> 16) / 65536.0f;
+        // Turns per second, both directions
+        object->spin = (int16_t)((h0 ^ h2) & 0xffff) / 32768.0f * 0.5f;
+        object->color = mass_color(h2);
+    }
+}
+
+typedef void (*UploadFillFn)(void *dst, uint32_t first, uint32_t count, uint32_t total);
+
+// Elements are generated straight into upload scratch and copied in chunks, so buffer of any size fits
+// Copy runs on transfer queue, ownership of every chunk goes to consumer family, which then reads it
+static
+void upload_generated(Engine *e, VkBuffer buffer, uint32_t count, uint32_t stride, UploadFillFn fill,
+                      const EngineQueue *consumer, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access) {
+    // Quarter of scratch, so copies of previous chunks run while next one is generated, rest covers alignment
+    uint32_t chunk_count = UPLOAD_SCRATCH_SIZE / 4 / stride;
+
+    for (uint32_t first = 0; first < count; first += chunk_count) {
+        uint32_t n = count - first < chunk_count ? count - first : chunk_count;
+
+        void *staging_data;
+        VkBuffer staging_buffer = upload_scratch_buffer(e, (VkDeviceSize)n * stride, &staging_data);
+        fill(staging_data, first, n, count);
+
+        VkCommandBuffer cmd = one_time_begin(e, &e->transfer);
+
+        VkBufferCopy region = {
+            .srcOffset = 0,
+            .dstOffset = (VkDeviceSize)first * stride,
+            .size = (VkDeviceSize)n * stride,
+        };
+
+        vkCmdCopyBuffer(cmd, staging_buffer, buffer, 1, &region);
+
+        VkBufferMemoryBarrier buffer_barrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = dst_access,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = buffer,
+            .offset = region.dstOffset,
+            .size = region.size,
+        };
+
+        if (consumer->family == e->transfer.family) {
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage, 0,
+                0, NULL, 1, &buffer_barrier, 0, NULL);
+
+            upload_submit(e, &e->transfer, cmd, staging_buffer);
+        } else {
+            // Release half, its destination access and stage are ignored
+            buffer_barrier.dstAccessMask = 0;
+            buffer_barrier.srcQueueFamilyIndex = e->transfer.family;
+            buffer_barrier.dstQueueFamilyIndex = consumer->family;
+
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                0, NULL, 1, &buffer_barrier, 0, NULL);
+
+            // Acquire half, writes were made available by release and semaphore
+            VkCommandBuffer acquire_cmd = one_time_begin(e, consumer);
+
+            buffer_barrier.srcAccessMask = 0;
+            buffer_barrier.dstAccessMask = dst_access;
+
+            vkCmdPipelineBarrier(acquire_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dst_stage, 0,
+                0, NULL, 1, &buffer_barrier, 0, NULL);
+
+            upload_submit2(e, &e->transfer, cmd, consumer, acquire_cmd, staging_buffer);
+        }
+    }
+}
+
+static
+void mass_create_buffer(Engine *e, VkDeviceSize size, VkBufferUsageFlags usage, int compute_written, const char *name,
+                        VkBuffer *out_buffer, Allocation *out_allocation) {
+    VkBufferCreateInfo buffer_ci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+    };
+
+    // Written by compute queue and read by graphics one every frame, concurrent sharing avoids
+    // ownership transfer per frame, which would cost more than it saves
+    uint32_t families[2] = {e->graphics_queue_family, e->compute.family};
+    if (e->async_compute && compute_written) {
+        buffer_ci.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        buffer_ci.queueFamilyIndexCount = 2;
+        buffer_ci.pQueueFamilyIndices = families;
+    }
+
+    VK_CHECK(vkCreateBuffer(e->device, &buffer_ci, NULL, out_buffer));
+
+    if (!alloc_buffer(&e->allocator, *out_buffer, ALLOC_USAGE_GPU_ONLY, out_allocation)) {
+        fprintf(stderr, "Unable to allocate %lu bytes for %s\n", (unsigned long)size, name);
+        exit(1);
+    }
+}
+
+static
+void mass_instances_init(Engine *e) {
+    uint32_t count = e->config.mass_count;
+
+    mass_create_buffer(e, (VkDeviceSize)count * sizeof(MassInstance),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0, "mass instances",
+        &e->mass_instance_buffer, &e->mass_instance_allocation);
+
+    EngineQueue graphics = queue_graphics(e);
+    upload_generated(e, e->mass_instance_buffer, count, sizeof(MassInstance), mass_instances_fill, &graphics,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+    printf("Mass instances: %u, %.2f MiB\n", count, (double)count * sizeof(MassInstance) / (1024.0 * 1024.0));
+}
+
+static
+void mass_instances_deinit(Engine *e) {
+    vkDestroyBuffer(e->device, e->mass_instance_buffer, NULL);
+    alloc_free(&e->allocator, &e->mass_instance_allocation);
+}
+
+// Every triangle is three vertices at thirds of a turn around same center, like the single one
+static
+void cpu_mass_init(Engine *e) {
+    uint32_t triangles = e->config.cpu_mass_count;
+    uint32_t count = triangles * 3;
+
+    e->cpu_mass_storage = malloc((size_t)count * 4 * sizeof(float));
+    if (e->cpu_mass_storage == NULL) {
+        fprintf(stderr, "Unable to allocate CPU mass input for %u triangles\n", triangles);
+        exit(1);
+    }
+
+    float *center_x = e->cpu_mass_storage;
+    float *center_y = center_x + count;
+    float *radius = center_y + count;
+    float *angle = radius + count;
+
+    for (uint32_t t = 0; t < triangles; t++) {
+        uint32_t h0 = hash_u32(t * 2);
+        uint32_t h1 = hash_u32(t * 2 + 1);
+        for (uint32_t k = 0; k < 3; k++) {
+            uint32_t i = t * 3 + k;
+            center_x[i] = (int16_t)(h0 & 0xffff) / 65536.0f;
+            center_y[i] = (int16_t)(h0 >> 16) / 65536.0f;
+            radius[i] = mass_scale(h1, triangles) / 2.0f;
+            angle[i] = (h1 >> 16) / 65536.0f + k / 3.0f;
+        }
+    }
+
+    e->cpu_mass_input = (VertexKernelInput){
+        .center_x = center_x,
+        .center_y = center_y,
+        .radius = radius,
+        .angle = angle,
+        .count = count,
+    };
+
+    // Slices start at cache line, so every slice gets same streaming store alignment
+    e->cpu_mass_slice = align_up((VkDeviceSize)count * 2 * sizeof(float), 64);
+
+    VkBufferCreateInfo buffer_ci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = e->cpu_mass_slice * e->frames_in_flight,
+        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+    };
+
+    VK_CHECK(vkCreateBuffer(e->device, &buffer_ci, NULL, &e->cpu_mass_buffer));
+
+    if (!alloc_buffer(&e->allocator, e->cpu_mass_buffer, ALLOC_USAGE_UPLOAD, &e->cpu_mass_allocation)) {
+        fprintf(stderr, "Unable to allocate %lu bytes for CPU mass vertices\n", (unsigned long)buffer_ci.size);
+        exit(1);
+    }
+
+    printf("CPU mass triangles: %u, %.2f MiB per frame, vertex kernel %s on %u threads\n", triangles,
+        (double)e->cpu_mass_slice / (1024.0 * 1024.0), vertex_kernel_isa_name(e->vertex_isa),
+        e->pool_started ? thread_pool_threads(&e->pool) : 1);
+}
+
+static
+void cpu_mass_deinit(Engine *e) {
+    vkDestroyBuffer(e->device, e->cpu_mass_buffer, NULL);
+    alloc_free(&e->allocator, &e->cpu_mass_allocation);
+    free(e->cpu_mass_storage);
+}
+
+// Positions of current frame go straight into its slice, returns offset of slice
+static
+VkDeviceSize cpu_mass_write(Engine *e, float cycle) {
+    VkDeviceSize offset = e->frame_index * e->cpu_mass_slice;
+    float *out_xy = (float *)((char *)e->cpu_mass_allocation.mapped + offset);
+
+    PROFILE_BEGIN("vertex kernel");
+    vertex_kernel_run_parallel(e->pool_started ? &e->pool : NULL, e->vertex_isa, &e->cpu_mass_input, cycle, out_xy);
+    PROFILE_END();
+
+    alloc_flush(&e->allocator, &e->cpu_mass_allocation, offset, (VkDeviceSize)e->cpu_mass_input.count * 2 * sizeof(float));
+    return offset;
+}
+
+// DRAW LIST, mass geometry is split into equal draws, GPU driven mass and single triangle are one draw
+
+// Instances or triangles the draw list covers
+static
+uint32_t draw_list_items(const Engine *e) {
+    if (e->config.mass_count > 0) {
+        return e->gpu_driven ? 1 : e->config.mass_count;
+    }
+    if (e->config.cpu_mass_count > 0) {
+        return e->config.cpu_mass_count;
+    }
+    return 1;
+}
+
+// First item of draw, draw_list_first(e, e->draw_count) is number of items
+static
+uint32_t draw_list_first(const Engine *e, uint32_t draw) {
+    return (uint32_t)((uint64_t)draw_list_items(e) * draw / e->draw_count);
+}
+
+// Culling runs on graphics queue, so its family must support compute too, Vulkan does not promise that
+static
+int cull_supported(Engine *e) {
+    uint32_t family_count;
+    vkGetPhysicalDeviceQueueFamilyProperties(e->phys_device, &family_count, NULL);
+    VkQueueFamilyProperties *families = malloc(sizeof(VkQueueFamilyProperties) * family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(e->phys_device, &family_count, families);
+
+    int supported = (families[e->graphics_queue_family].queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+
+    free(families);
+    return supported;
+}
+
+static
+void cull_init(Engine *e) {
+    uint32_t count = e->config.mass_count;
+
+    VkPhysicalDeviceProperties prop;
+    vkGetPhysicalDeviceProperties(e->phys_device, &prop);
+    VkDeviceSize alignment = prop.limits.minStorageBufferOffsetAlignment;
+
+    mass_create_buffer(e, (VkDeviceSize)count * sizeof(MassObject),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0, "mass objects",
+        &e->mass_object_buffer, &e->mass_object_allocation);
+
+    // Object state is only touched by culling, so it belongs to queue which runs it
+    EngineQueue graphics = queue_graphics(e);
+    upload_generated(e, e->mass_object_buffer, count, sizeof(MassObject), mass_objects_fill,
+        e->async_compute ? &e->compute : &graphics, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    // Worst case every object is visible
+    e->mass_visible_slice = align_up((VkDeviceSize)count * sizeof(MassInstance), alignment);
+    mass_create_buffer(e, e->mass_visible_slice * e->frames_in_flight,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 1, "mass visible instances",
+        &e->mass_visible_buffer, &e->mass_visible_allocation);
+
+    e->mass_indirect_slice = align_up(sizeof(VkDrawIndirectCommand), alignment);
+    mass_create_buffer(e, e->mass_indirect_slice * e->frames_in_flight,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 1,
+        "mass indirect draw", &e->mass_indirect_buffer, &e->mass_indirect_allocation);
+
+    printf("Mass objects: %u, state %.2f MiB, visible instances %.2f MiB per frame\n", count,
+        (double)count * sizeof(MassObject) / (1024.0 * 1024.0), (double)e->mass_visible_slice / (1024.0 * 1024.0));
+
+    VkDescriptorSetLayoutBinding bindings[3];
+    for (uint32_t i = 0; i < 3; i++) {
+        bindings[i] = (VkDescriptorSetLayoutBinding) {
+            .binding = i,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+    }
+
+    VkDescriptorSetLayoutCreateInfo set_layout_ci = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 3,
+        .pBindings = bindings,
+    };
+
+    VK_CHECK(vkCreateDescriptorSetLayout(e->device, &set_layout_ci, NULL, &e->cull_set_layout));
+
+    VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 3 * e->frames_in_flight,
+    };
+
+    VkDescriptorPoolCreateInfo descriptor_pool_ci = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = e->frames_in_flight,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size,
+    };
+
+    VK_CHECK(vkCreateDescriptorPool(e->device, &descriptor_pool_ci, NULL, &e->cull_descriptor_pool));
+
+    // Set per frame in flight, each one points at its own slices
+    for (uint32_t i = 0; i < e->frames_in_flight; i++) {
+        VkDescriptorSetAllocateInfo set_alloc_info = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = e->cull_descriptor_pool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &e->cull_set_layout,
+        };
+
+        VK_CHECK(vkAllocateDescriptorSets(e->device, &set_alloc_info, &e->cull_sets[i]));
+
+        VkDescriptorBufferInfo buffer_infos[3] = {
+            {
+                .buffer = e->mass_object_buffer,
+                .offset = 0,
+                .range = VK_WHOLE_SIZE,
+            },
+            {
+                .buffer = e->mass_visible_buffer,
+                .offset = e->mass_visible_slice * i,
+                .range = e->mass_visible_slice,
+            },
+            {
+                .buffer = e->mass_indirect_buffer,
+                .offset = e->mass_indirect_slice * i,
+                .range = sizeof(VkDrawIndirectCommand),
+            },
+        };
+
+        VkWriteDescriptorSet write = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = e->cull_sets[i],
+            .dstBinding = 0,
+            .descriptorCount = 3,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = buffer_infos,
+        };
+
+        vkUpdateDescriptorSets(e->device, 1, &write, 0, NULL);
+    }
+
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(CullPushConstants),
+    };
+
+    VkPipelineLayoutCreateInfo pipeline_layout_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &e->cull_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+
+    VK_CHECK(vkCreatePipelineLayout(e->device, &pipeline_layout_ci, NULL, &e->cull_pipeline_layout));
+
+    VkShaderModule cull_shader;
+    load_shader_module(e, "mass_cull.comp.spv", mass_cull_comp_spv, sizeof(mass_cull_comp_spv), &cull_shader);
+
+    VkComputePipelineCreateInfo pipeline_ci = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = cull_shader,
+            .pName = "main",
+        },
+        .layout = e->cull_pipeline_layout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+    };
+
+    VK_CHECK(vkCreateComputePipelines(e->device, e->pipeline_cache, 1, &pipeline_ci, NULL, &e->cull_pipeline));
+
+    vkDestroyShaderModule(e->device, cull_shader, NULL);
+
+    e->cull_last_time = -1.0f;
+}
+
+static
+void cull_deinit(Engine *e) {
+    vkDestroyPipeline(e->device, e->cull_pipeline, NULL);
+    vkDestroyPipelineLayout(e->device, e->cull_pipeline_layout, NULL);
+
+    vkDestroyDescriptorPool(e->device, e->cull_descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(e->device, e->cull_set_layout, NULL);
+
+    vkDestroyBuffer(e->device, e->mass_indirect_buffer, NULL);
+    alloc_free(&e->allocator, &e->mass_indirect_allocation);
+    vkDestroyBuffer(e->device, e->mass_visible_buffer, NULL);
+    alloc_free(&e->allocator, &e->mass_visible_allocation);
+    vkDestroyBuffer(e->device, e->mass_object_buffer, NULL);
+    alloc_free(&e->allocator, &e->mass_object_allocation);
+}
+
+// Outside render pass, moves objects by time since last frame and writes visible ones with draw command
+// Slices of current frame are free, their previous readers completed before frame fence was signaled
+static
+void cull_record(Engine *e, VkCommandBuffer cmd, float time) {
+    VkDeviceSize visible_offset = e->mass_visible_slice * e->frame_index;
+    VkDeviceSize indirect_offset = e->mass_indirect_slice * e->frame_index;
+
+    // Long stall must not teleport objects
+    float dt = e->cull_last_time < 0.0f ? 0.0f : time - e->cull_last_time;
+    if (dt > 0.1f) {
+        dt = 0.1f;
+    }
+    e->cull_last_time = time;
+
+    VkDrawIndirectCommand draw = {
+        .vertexCount = 3,
+        .instanceCount = 0,
+        .firstVertex = 0,
+        .firstInstance = 0,
+    };
+
+    vkCmdUpdateBuffer(cmd, e->mass_indirect_buffer, indirect_offset, sizeof(draw), &draw);
+
+    {
+        // Object state was written by previous frame dispatch, draw command was just reset
+        VkBufferMemoryBarrier buffer_barriers[2] = {
+            {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = e->mass_object_buffer,
+                .offset = 0,
+                .size = VK_WHOLE_SIZE,
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = e->mass_indirect_buffer,
+                .offset = indirect_offset,
+                .size = sizeof(draw),
+            },
+        };
+
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 2, buffer_barriers, 0, NULL);
+    }
+
+    CullPushConstants push = {
+        .time = time,
+        .dt = dt,
+        .count = e->config.mass_count,
+    };
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, e->cull_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, e->cull_pipeline_layout, 0, 1, &e->cull_sets[e->frame_index], 0, NULL);
+    vkCmdPushConstants(cmd, e->cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(cmd, (e->config.mass_count + MASS_CULL_GROUP_SIZE - 1) / MASS_CULL_GROUP_SIZE, 1, 1);
+
+    // On compute queue draw stages do not exist, semaphore which graphics submit waits for covers it
+    if (!e->async_compute) {
+        VkBufferMemoryBarrier buffer_barriers[2] = {
+            {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = e->mass_visible_buffer,
+                .offset = visible_offset,
+                .size = e->mass_visible_slice,
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = e->mass_indirect_buffer,
+                .offset = indirect_offset,
+                .size = sizeof(draw),
+            },
+        };
+
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, NULL, 2, buffer_barriers, 0, NULL);
+    }
+}
+
+// ASYNC COMPUTE, culling of frame runs on compute queue while graphics queue still renders previous one
+
+static
+void async_compute_init(Engine *e) {
+    for (uint32_t i = 0; i < e->frames_in_flight; i++) {
+        EngineFrame *frame = &e->frames[i];
+
+        VkCommandPoolCreateInfo command_pool_ci = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = e->compute.family,
+        };
+
+        VK_CHECK(vkCreateCommandPool(e->device, &command_pool_ci, NULL, &frame->compute_pool));
+
+        VkCommandBufferAllocateInfo command_buf_alloc_ci = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = frame->compute_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+
+        VK_CHECK(vkAllocateCommandBuffers(e->device, &command_buf_alloc_ci, &frame->compute_buffer));
+
+        VkSemaphoreCreateInfo semaphore_ci = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        };
+
+        VK_CHECK(vkCreateSemaphore(e->device, &semaphore_ci, NULL, &frame->compute_sema));
+
+        frame->compute_timestamp_pool = VK_NULL_HANDLE;
+        if (e->compute_timestamp_valid_bits > 0) {
+            VkQueryPoolCreateInfo query_pool_ci = {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                .queryCount = 2,
+            };
+
+            VK_CHECK(vkCreateQueryPool(e->device, &query_pool_ci, NULL, &frame->compute_timestamp_pool));
+        }
+    }
+}
+
+static
+void async_compute_deinit(Engine *e) {
+    for (int i = e->frames_in_flight - 1; i >= 0; i--) {
+        EngineFrame *frame = &e->frames[i];
+
+        if (frame->compute_timestamp_pool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(e->device, frame->compute_timestamp_pool, NULL);
+        }
+        vkDestroySemaphore(e->device, frame->compute_sema, NULL);
+        vkFreeCommandBuffers(e->device, frame->compute_pool, 1, &frame->compute_buffer);
+        vkDestroyCommandPool(e->device, frame->compute_pool, NULL);
+    }
+}
+
+// Frame fence is signaled after graphics submit, which waits for compute semaphore, so compute buffer
+// of this frame is not pending anymore
+static
+void async_compute_submit(Engine *e, EngineFrame *frame, float time) {
+    VK_CHECK(vkResetCommandPool(e->device, frame->compute_pool, 0));
+
+    VkCommandBuffer cmd = frame->compute_buffer;
+
+    VkCommandBufferBeginInfo command_buf_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    VK_CHECK(vkBeginCommandBuffer(cmd, &command_buf_begin_info));
+
+    if (frame->compute_timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(cmd, frame->compute_timestamp_pool, 0, 2);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->compute_timestamp_pool, 0);
+    }
+
+    cull_record(e, cmd, time);
+
+    if (frame->compute_timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->compute_timestamp_pool, 1);
+    }
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &frame->compute_sema,
+    };
+
+    VK_CHECK(vkQueueSubmit(e->compute.queue, 1, &submit_info, VK_NULL_HANDLE));
+}
+
+// Same fragment stage as triangle, vertex stage places one triangle per instance
+static
+void mass_pipeline_init(Engine *e) {
+    VkShaderModule mass_frag_shader;
+    load_shader_module(e, "mass.frag.spv", mass_frag_spv, sizeof(mass_frag_spv), &mass_frag_shader);
+
+    VkShaderModule mass_vert_shader;
+    load_shader_module(e, "mass.vert.spv", mass_vert_spv, sizeof(mass_vert_spv), &mass_vert_shader);
+
+    // Set 0 is frame uniforms, animation cycle comes from there
+    VkPipelineLayoutCreateInfo pipeline_layout_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &e->frame_set_layout,
+        .pushConstantRangeCount = 0,
+        .pPushConstantRanges = NULL,
+    };
+
+    VK_CHECK(vkCreatePipelineLayout(e->device, &pipeline_layout_ci, NULL, &e->mass_pipeline_layout));
+
+    VkPipelineShaderStageCreateInfo shader_stages[2] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = mass_vert_shader,
+            .pName = "main",
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .module = mass_frag_shader,
+            .pName = "main",
+        },
+    };
+
+    VkPipelineViewportStateCreateInfo viewport_state_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .scissorCount = 1,
+    };
+
+    VkPipelineColorBlendAttachmentState color_blend_attach_state = {
+        .blendEnable = VK_FALSE,
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+    };
+
+    VkPipelineColorBlendStateCreateInfo color_blend_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .logicOpEnable = VK_FALSE,
+        .attachmentCount = 1,
+        .pAttachments = &color_blend_attach_state,
+    };
+
+    // No per-vertex data at all, corners come from gl_VertexIndex
+    VkVertexInputBindingDescription binding_desc = {
+        .binding = 0,
+        .stride = sizeof(MassInstance),
+        .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
+    };
+
+    VkVertexInputAttributeDescription attr_descs[3] = {
+        {
+            .location = 0,
+            .binding = 0,
+            .format = VK_FORMAT_R16G16_SNORM,
+            .offset = offsetof(MassInstance, offset),
+        },
+        {
+            .location = 1,
+            .binding = 0,
+            .format = VK_FORMAT_R16G16_UNORM,
+            .offset = offsetof(MassInstance, scale),
+        },
+        {
+            .location = 2,
+            .binding = 0,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .offset = offsetof(MassInstance, color),
+        },
+    };
+
+    VkPipelineVertexInputStateCreateInfo vertex_input_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = &binding_desc,
+        .vertexAttributeDescriptionCount = 3,
+        .pVertexAttributeDescriptions = attr_descs,
+    };
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        .primitiveRestartEnable = VK_FALSE,
+    };
+
+    VkPipelineRasterizationStateCreateInfo raster_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .cullMode = VK_CULL_MODE_NONE,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+        .lineWidth = 1.0f,
+    };
+
+    VkPipelineMultisampleStateCreateInfo multisample_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+        .minSampleShading = 1.0f,
+    };
+
+    VkDynamicState dynamic_states[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR,
+    };
+
+    VkPipelineDynamicStateCreateInfo dynamic_state_ci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = sizeof(dynamic_states) / sizeof(VkDynamicState),
+        .pDynamicStates = dynamic_states,
+    };
+
+    VkGraphicsPipelineCreateInfo pipeline_ci = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .stageCount = 2,
+        .pStages = shader_stages,
+        .pVertexInputState = &vertex_input_ci,
+        .pInputAssemblyState = &input_assembly_ci,
+        .pViewportState = &viewport_state_ci,
+        .pRasterizationState = &raster_ci,
+        .pMultisampleState = &multisample_ci,
+        .pColorBlendState = &color_blend_ci,
+        .pDynamicState = &dynamic_state_ci,
+        .layout = e->mass_pipeline_layout,
+        .renderPass = e->render_pass,
+        .subpass = 0,
+        .basePipelineHandle = VK_NULL_HANDLE,
+    };
+
+    VK_CHECK(vkCreateGraphicsPipelines(e->device, e->pipeline_cache, 1, &pipeline_ci, NULL, &e->mass_pipeline));
+
+    vkDestroyShaderModule(e->device, mass_frag_shader, NULL);
+    vkDestroyShaderModule(e->device, mass_vert_shader, NULL);
+}
+
+static
+void mass_pipeline_deinit(Engine *e) {
+    vkDestroyPipeline(e->device, e->mass_pipeline, NULL);
+    vkDestroyPipelineLayout(e->device, e->mass_pipeline_layout, NULL);
+}
+
+// Inside render pass, one draw for all instances, or for visible ones which cull_record wrote
+static
+void mass_record(Engine *e, VkCommandBuffer cmd, uint32_t uniform_offset, uint32_t first_draw, uint32_t draw_count) {
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, e->mass_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, e->mass_pipeline_layout, 0, 1, &e->frame_set, 1, &uniform_offset);
+
+    if (e->gpu_driven) {
+        VkDeviceSize offset = e->mass_visible_slice * e->frame_index;
+        vkCmdBindVertexBuffers(cmd, 0, 1, &e->mass_visible_buffer, &offset);
+        vkCmdDrawIndirect(cmd, e->mass_indirect_buffer, e->mass_indirect_slice * e->frame_index, 1, sizeof(VkDrawIndirectCommand));
+    } else {
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(cmd, 0, 1, &e->mass_instance_buffer, &offset);
+        // Instance range of each draw is picked by firstInstance, binding stays the same
+        for (uint32_t d = first_draw; d < first_draw + draw_count; d++) {
+            uint32_t first = draw_list_first(e, d);
+            vkCmdDraw(cmd, 3, draw_list_first(e, d + 1) - first, 0, first);
+        }
     }
+}
 
-    // NOTE: surface_capabilities. maxImageCount != 0, checked because zero stand for unlimited
-    // triple buffering because if we use VK_PRESENT_MODE_MAILBOX_KHR it is only reasonable alternative
-    uint32_t desired_image_count = 3;
-    if (surface_capabilities.maxImageCount < desired_image_count && surface_capabilities.maxImageCount != 0) {
-        fprintf(stderr, "surface_capabilities.maxImageCount < 3 && surface_capabilities.maxImageCount != 0\n");
+// Atlas is uploaded once through staging buffer, it never changes
+static
+void overlay_atlas_init(Engine *e) {
+    VkImageCreateInfo image_ci = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = VK_FORMAT_R8_UNORM,
+        .extent = {
+            .width = OVERLAY_ATLAS_WIDTH,
+            .height = OVERLAY_ATLAS_HEIGHT,
+            .depth = 1,
+        },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    VK_CHECK(vkCreateImage(e->device, &image_ci, NULL, &e->overlay_atlas));
+
+    if (!alloc_image(&e->allocator, e->overlay_atlas, ALLOC_USAGE_GPU_ONLY, &e->overlay_atlas_allocation)) {
+        fprintf(stderr, "Unable to allocate memory for overlay atlas\n");
         exit(1);
     }
-    uint32_t image_count = desired_image_count;
 
-    // TODO: flags
-    // TODO: imageExtent have actually can have strange behaviour, need to research
-    VkSwapchainCreateInfoKHR swapchain_ci = {
-        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-        .surface = e->surface,
-        .minImageCount = image_count,
-        .imageFormat = e->surface_format.format,
-        .imageColorSpace = e->surface_format.colorSpace,
-        .imageExtent = swapchain_extent,
-        .imageArrayLayers = 1, // TODO: For non-stereoscopic-3D applications, this value is 1, WTF?
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-        .preTransform = surface_capabilities.currentTransform,
-        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-        .presentMode = e->present_mode,
-        .clipped = VK_TRUE,
-        .oldSwapchain = VK_NULL_HANDLE,
+    void *staging_data;
+    VkBuffer staging_buffer = upload_scratch_buffer(e, OVERLAY_ATLAS_WIDTH * OVERLAY_ATLAS_HEIGHT, &staging_data);
+    overlay_atlas_pixels(staging_data);
+
+    VkCommandBuffer cmd = one_time_begin(e, &e->transfer);
+
+    VkImageMemoryBarrier image_barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = e->overlay_atlas,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
     };
 
-    VK_CHECK(vkCreateSwapchainKHR(e->device, &swapchain_ci, NULL, &e->swapchain));
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, NULL, 0, NULL, 1, &image_barrier);
+
+    VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {OVERLAY_ATLAS_WIDTH, OVERLAY_ATLAS_HEIGHT, 1},
+    };
 
-    {
-        // TODO: well we have image_count, but vulkan driver may allocate more, does this even happen?
-        VK_CHECK(vkGetSwapchainImagesKHR(e->device, e->swapchain, &e->swapchain_image_count, NULL));
-        // Allocation on resize, well may be we can use stack
-        VkImage *swapchain_images = malloc(e->swapchain_image_count * sizeof(VkImage));
-        VK_CHECK(vkGetSwapchainImagesKHR(e->device, e->swapchain, &e->swapchain_image_count, swapchain_images));
+    vkCmdCopyBufferToImage(cmd, staging_buffer, e->overlay_atlas, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
-        e->swapchain_image_views = malloc(e->swapchain_image_count * sizeof(VkImageView));
-        
+    image_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    image_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    image_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    image_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-        // TODO: pNext may be useful with flags
-        VkImageViewCreateInfo image_view_ci = {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-            // .image = e->swapchain_images[i],
-            .viewType = VK_IMAGE_VIEW_TYPE_2D,
-            .format = e->surface_format.format,
-            // .components // becomes identity being zero
-            .subresourceRange = {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .baseMipLevel = 0,
-                .levelCount = 1,
-                .baseArrayLayer = 0,
-                .layerCount = 1,
-            }
-        };
-        
-        for (uint32_t i = 0; i < e->swapchain_image_count; i++) {
-            image_view_ci.image = swapchain_images[i];
-            VK_CHECK(vkCreateImageView(e->device, &image_view_ci, NULL, &e->swapchain_image_views[i]));
-        }
+    EngineQueue graphics = queue_graphics(e);
+    if (e->transfer.family == graphics.family) {
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+            0, NULL, 0, NULL, 1, &image_barrier);
 
-        free(swapchain_images);
-    }
-}
+        upload_submit(e, &e->transfer, cmd, staging_buffer);
+    } else {
+        // Release and acquire both carry same layout transition, it is executed once
+        image_barrier.dstAccessMask = 0;
+        image_barrier.srcQueueFamilyIndex = e->transfer.family;
+        image_barrier.dstQueueFamilyIndex = graphics.family;
 
-static
-void swapchain_deinit(Engine *e) {
-    for (int i = e->swapchain_image_count - 1; i >= 0; i--) {
-        vkDestroyImageView(e->device, e->swapchain_image_views[i], NULL);
-    }
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+            0, NULL, 0, NULL, 1, &image_barrier);
 
-    free(e->swapchain_image_views);
+        VkCommandBuffer acquire_cmd = one_time_begin(e, &graphics);
 
-    vkDestroySwapchainKHR(e->device, e->swapchain, NULL);
-}
+        image_barrier.srcAccessMask = 0;
+        image_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-static
-void framebuffers_init(Engine *e) {
-    // TODO: pNext with flags may have more stuff with VkFramebufferAttachmentsCreateInfo
-    VkFramebufferCreateInfo framebuffer_ci = {
-        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-        .renderPass = e->render_pass,
-        .attachmentCount = 1,
-        // .pAttachments = &e->swapchain_image_views[i],
-        .width = e->window.width,
-        .height = e->window.height,
-        .layers = 1,
+        vkCmdPipelineBarrier(acquire_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+            0, NULL, 0, NULL, 1, &image_barrier);
+
+        upload_submit2(e, &e->transfer, cmd, &graphics, acquire_cmd, staging_buffer);
+    }
+
+    VkImageViewCreateInfo image_view_ci = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = e->overlay_atlas,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = VK_FORMAT_R8_UNORM,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
     };
 
-    e->framebuffers = malloc(e->swapchain_image_count * sizeof(VkFramebuffer));
-    for (uint32_t i = 0; i < e->swapchain_image_count; i++) {
-        framebuffer_ci.pAttachments = &e->swapchain_image_views[i];
+    VK_CHECK(vkCreateImageView(e->device, &image_view_ci, NULL, &e->overlay_atlas_view));
+
+    // Glyphs are drawn at integer scale, nearest keeps them sharp
+    VkSamplerCreateInfo sampler_ci = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_NEAREST,
+        .minFilter = VK_FILTER_NEAREST,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .maxLod = 0.0f,
+    };
 
-        VK_CHECK(vkCreateFramebuffer(e->device, &framebuffer_ci, NULL, &e->framebuffers[i]));
-    }
+    VK_CHECK(vkCreateSampler(e->device, &sampler_ci, NULL, &e->overlay_sampler));
 }
 
 static
-void framebuffers_deinit(Engine *e) {
-    for (int i = e->swapchain_image_count - 1; i >= 0; i--) {
-        vkDestroyFramebuffer(e->device, e->framebuffers[i], NULL);
-    }
-
-    free(e->framebuffers);
+void overlay_atlas_deinit(Engine *e) {
+    vkDestroySampler(e->device, e->overlay_sampler, NULL);
+    vkDestroyImageView(e->device, e->overlay_atlas_view, NULL);
+    vkDestroyImage(e->device, e->overlay_atlas, NULL);
+    alloc_free(&e->allocator, &e->overlay_atlas_allocation);
 }
 
 static
-void load_shader_module(Engine *e, const char* filepath, VkShaderModule *out_shader_module) {
-    FILE *file = fopen(filepath, "rb");
-    if (!file) {
-        fprintf(stderr, "Failed to open file: %s\n", filepath);
-        exit(1);
-    }
+void overlay_gpu_init(Engine *e) {
+    overlay_atlas_init(e);
 
-    // TODO: handle errors for file access
+    {
+        VkDescriptorSetLayoutBinding binding = {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .pImmutableSamplers = &e->overlay_sampler,
+        };
 
-    fseek(file, 0, SEEK_END);
-    long filesize = ftell(file);
-    fseek(file, 0, SEEK_SET);
+        VkDescriptorSetLayoutCreateInfo set_layout_ci = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = 1,
+            .pBindings = &binding,
+        };
 
-    // Vulkan requires the shader size to be a multiple of 4, the SPIR-V binary is naturally aligned to 4 bytes
-    if (filesize % 4 != 0) {
-        fprintf(stderr, "Invalid SPIR-V code\n");
-        exit(1);
-    }
+        VK_CHECK(vkCreateDescriptorSetLayout(e->device, &set_layout_ci, NULL, &e->overlay_set_layout));
 
-    // Allocate memory and read the file
-    uint32_t *buffer = malloc(filesize);
+        VkDescriptorPoolSize pool_size = {
+            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+        };
 
-    if (fread(buffer, 1, filesize, file) != (size_t)filesize) {
-        fprintf(stderr, "fread failed\n");
-        exit(1);    
-    }
+        VkDescriptorPoolCreateInfo descriptor_pool_ci = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .maxSets = 1,
+            .poolSizeCount = 1,
+            .pPoolSizes = &pool_size,
+        };
 
-    fclose(file);
+        VK_CHECK(vkCreateDescriptorPool(e->device, &descriptor_pool_ci, NULL, &e->overlay_descriptor_pool));
 
-    VkShaderModuleCreateInfo shader_module_ci = {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = filesize,
-        .pCode = buffer,
-    };
+        VkDescriptorSetAllocateInfo set_alloc_info = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = e->overlay_descriptor_pool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &e->overlay_set_layout,
+        };
 
-    VK_CHECK(vkCreateShaderModule(e->device, &shader_module_ci, NULL, out_shader_module));
+        VK_CHECK(vkAllocateDescriptorSets(e->device, &set_alloc_info, &e->overlay_set));
 
-    free(buffer);
-}
+        VkDescriptorImageInfo image_info = {
+            .sampler = VK_NULL_HANDLE,
+            .imageView = e->overlay_atlas_view,
+            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        };
 
-static
-void triangle_pipeline_init(Engine *e) {
-    VkShaderModule triangle_frag_shader;
-    load_shader_module(e, "triangle.frag.spv", &triangle_frag_shader);
+        VkWriteDescriptorSet write = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = e->overlay_set,
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &image_info,
+        };
 
-    VkShaderModule triangle_vert_shader;
-    load_shader_module(e, "triangle.vert.spv", &triangle_vert_shader);
+        vkUpdateDescriptorSets(e->device, 1, &write, 0, NULL);
+    }
+
+    VkShaderModule overlay_frag_shader;
+    load_shader_module(e, "overlay.frag.spv", overlay_frag_spv, sizeof(overlay_frag_spv), &overlay_frag_shader);
+
+    VkShaderModule overlay_vert_shader;
+    load_shader_module(e, "overlay.vert.spv", overlay_vert_spv, sizeof(overlay_vert_spv), &overlay_vert_shader);
+
+    // Set 0 is frame uniforms, set 1 is atlas
+    VkDescriptorSetLayout set_layouts[2] = {e->frame_set_layout, e->overlay_set_layout};
 
-    // TODO: flags
-    // no layouts or push constants
     VkPipelineLayoutCreateInfo pipeline_layout_ci = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 0,
-        .pSetLayouts = NULL,
+        .setLayoutCount = 2,
+        .pSetLayouts = set_layouts,
         .pushConstantRangeCount = 0,
         .pPushConstantRanges = NULL,
     };
 
-    VkPipelineLayout triangle_pipeline_layout;
-    VK_CHECK(vkCreatePipelineLayout(e->device, &pipeline_layout_ci, NULL, &triangle_pipeline_layout));
-
-    // TODO flags are interested here also
-    VkPipelineShaderStageCreateInfo vertex_shader_stage_ci = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .stage = VK_SHADER_STAGE_VERTEX_BIT,
-        .module = triangle_vert_shader,
-        .pName = "main",
-    };
+    VK_CHECK(vkCreatePipelineLayout(e->device, &pipeline_layout_ci, NULL, &e->overlay_pipeline_layout));
 
-    VkPipelineShaderStageCreateInfo fragment_shader_stage_ci = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-        .module = triangle_frag_shader,
-        .pName = "main",
+    VkPipelineShaderStageCreateInfo shader_stages[2] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = overlay_vert_shader,
+            .pName = "main",
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .module = overlay_frag_shader,
+            .pName = "main",
+        },
     };
 
-    VkPipelineShaderStageCreateInfo shader_stages[2] = {vertex_shader_stage_ci, fragment_shader_stage_ci};
-
-    // TODO: pNext may do more intersting, especially on NV
-    // both viewport and scissor are dynamic, because of resize behaviour
     VkPipelineViewportStateCreateInfo viewport_state_ci = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
         .viewportCount = 1,
         .scissorCount = 1,
     };
 
-    // Well, we do not want to do any complex blending
+    // Straight alpha over whatever was drawn before
     VkPipelineColorBlendAttachmentState color_blend_attach_state = {
-        .blendEnable = VK_FALSE,
+        .blendEnable = VK_TRUE,
+        .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+        .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+        .colorBlendOp = VK_BLEND_OP_ADD,
+        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+        .alphaBlendOp = VK_BLEND_OP_ADD,
         .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
     };
 
@@ -684,24 +3841,37 @@ void triangle_pipeline_init(Engine *e) {
 
     VkVertexInputBindingDescription binding_desc = {
         .binding = 0,
-        .stride = sizeof(float) * 2,
+        .stride = sizeof(OverlayVertex),
         .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
     };
 
-    VkVertexInputAttributeDescription attr_desc = {
-        .location = 0,
-        .binding = 0,
-        .format = VK_FORMAT_R32G32_SFLOAT,
-        .offset = 0,
+    VkVertexInputAttributeDescription attr_descs[3] = {
+        {
+            .location = 0,
+            .binding = 0,
+            .format = VK_FORMAT_R32G32_SFLOAT,
+            .offset = offsetof(OverlayVertex, x),
+        },
+        {
+            .location = 1,
+            .binding = 0,
+            .format = VK_FORMAT_R32G32_SFLOAT,
+            .offset = offsetof(OverlayVertex, u),
+        },
+        {
+            .location = 2,
+            .binding = 0,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .offset = offsetof(OverlayVertex, color),
+        },
     };
 
-    // TODO: input vs attribute?
     VkPipelineVertexInputStateCreateInfo vertex_input_ci = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
         .vertexBindingDescriptionCount = 1,
         .pVertexBindingDescriptions = &binding_desc,
-        .vertexAttributeDescriptionCount = 1,
-        .pVertexAttributeDescriptions = &attr_desc,
+        .vertexAttributeDescriptionCount = 3,
+        .pVertexAttributeDescriptions = attr_descs,
     };
 
     VkPipelineInputAssemblyStateCreateInfo input_assembly_ci = {
@@ -710,29 +3880,18 @@ void triangle_pipeline_init(Engine *e) {
         .primitiveRestartEnable = VK_FALSE,
     };
 
-    // TODO: intresting there is other polygon modes, such as point and lines, how the actually work?
     VkPipelineRasterizationStateCreateInfo raster_ci = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-        .depthClampEnable = VK_FALSE,
-        .rasterizerDiscardEnable = VK_FALSE,
         .polygonMode = VK_POLYGON_MODE_FILL,
         .cullMode = VK_CULL_MODE_NONE,
         .frontFace = VK_FRONT_FACE_CLOCKWISE,
-        .depthBiasEnable = VK_FALSE,
-        .depthBiasConstantFactor = 0.0f,
-        .depthBiasClamp = 0.0f,
-        .depthBiasSlopeFactor = 0.0f,
         .lineWidth = 1.0f,
     };
 
     VkPipelineMultisampleStateCreateInfo multisample_ci = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
         .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
-        .sampleShadingEnable = VK_FALSE,
         .minSampleShading = 1.0f,
-        .pSampleMask = NULL,
-        .alphaToCoverageEnable = VK_FALSE,
-        .alphaToOneEnable = VK_FALSE,
     };
 
     VkDynamicState dynamic_states[] = {
@@ -757,113 +3916,699 @@ void triangle_pipeline_init(Engine *e) {
         .pMultisampleState = &multisample_ci,
         .pColorBlendState = &color_blend_ci,
         .pDynamicState = &dynamic_state_ci,
-        .layout = triangle_pipeline_layout,
+        .layout = e->overlay_pipeline_layout,
         .renderPass = e->render_pass,
         .subpass = 0,
         .basePipelineHandle = VK_NULL_HANDLE,
     };
-    
-    VK_CHECK(vkCreateGraphicsPipelines(e->device, VK_NULL_HANDLE, 1, &pipeline_ci, NULL, &e->triangle_pipeline));
 
-    vkDestroyShaderModule(e->device, triangle_frag_shader, NULL);
-    vkDestroyShaderModule(e->device, triangle_vert_shader, NULL);
+    VK_CHECK(vkCreateGraphicsPipelines(e->device, e->pipeline_cache, 1, &pipeline_ci, NULL, &e->overlay_pipeline));
 
-    vkDestroyPipelineLayout(e->device, triangle_pipeline_layout, NULL);
+    vkDestroyShaderModule(e->device, overlay_frag_shader, NULL);
+    vkDestroyShaderModule(e->device, overlay_vert_shader, NULL);
 }
 
 static
-void triangle_pipeline_deinit(Engine *e) {
-    vkDestroyPipeline(e->device, e->triangle_pipeline, NULL);
+void overlay_gpu_deinit(Engine *e) {
+    vkDestroyPipeline(e->device, e->overlay_pipeline, NULL);
+    vkDestroyPipelineLayout(e->device, e->overlay_pipeline_layout, NULL);
+
+    vkDestroyDescriptorPool(e->device, e->overlay_descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(e->device, e->overlay_set_layout, NULL);
+
+    overlay_atlas_deinit(e);
+}
+
+// Batch is built into stream ring before render pass, returns vertex count. With static recording
+// vertex count goes into indirect draw command and whole reservation is committed, so stream layout
+// and recorded commands stay the same when text changes
+static
+uint32_t overlay_prepare(Engine *e, VkDeviceSize *out_offset, VkDeviceSize *out_indirect_offset) {
+    VkDrawIndirectCommand *indirect = NULL;
+    *out_indirect_offset = UINT64_MAX;
+    if (e->static_recording) {
+        indirect = stream_alloc(e, sizeof(VkDrawIndirectCommand), out_indirect_offset);
+    }
+
+    void *vertices = stream_reserve(e, OVERLAY_MAX_VERTICES * sizeof(OverlayVertex), out_offset);
+    uint32_t vertex_count = overlay_build(&e->overlay, vertices, OVERLAY_MAX_VERTICES);
+
+    if (indirect != NULL) {
+        *indirect = (VkDrawIndirectCommand){
+            .vertexCount = vertex_count,
+            .instanceCount = 1,
+            .firstVertex = 0,
+            .firstInstance = 0,
+        };
+        stream_commit(e, OVERLAY_MAX_VERTICES * sizeof(OverlayVertex));
+    } else {
+        stream_commit(e, vertex_count * sizeof(OverlayVertex));
+    }
+    return vertex_count;
+}
+
+// Inside render pass, after scene, so it is drawn on top
+static
+void overlay_record(Engine *e, VkCommandBuffer cmd, uint32_t vertex_count, VkDeviceSize vertex_offset,
+                    VkDeviceSize indirect_offset, uint32_t uniform_offset) {
+    if (vertex_count == 0 && indirect_offset == UINT64_MAX) {
+        return;
+    }
+
+    VkDescriptorSet sets[2] = {e->frame_set, e->overlay_set};
+    VkBuffer buffer = stream_gpu_buffer(e);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, e->overlay_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, e->overlay_pipeline_layout, 0, 2, sets, 1, &uniform_offset);
+    vkCmdBindVertexBuffers(cmd, 0, 1, &buffer, &vertex_offset);
+    if (indirect_offset != UINT64_MAX) {
+        vkCmdDrawIndirect(cmd, buffer, indirect_offset, 1, sizeof(VkDrawIndirectCommand));
+    } else {
+        vkCmdDraw(cmd, vertex_count, 1, 0, 0);
+    }
+}
+
+void engine_overlay_text(Engine *e, const char *text) {
+    overlay_set_text(&e->overlay, text);
 }
 
+void engine_overlay_frame_time(Engine *e, float frame_ms) {
+    overlay_push_frame_time(&e->overlay, frame_ms);
+}
+
+// Needs only device, render pass, frame set layout and pipeline cache, fields it writes are not touched
+// by caller thread until join, pipeline cache is internally synchronized
+static
+void *pipelines_thread_main(void *arg) {
+    Engine *e = arg;
+    uint64_t start_ns = now_ns();
+
+    triangle_pipeline_init(e);
+    if (e->config.mass_count > 0) {
+        mass_pipeline_init(e);
+    }
+
+    e->init_stats.pipelines_ms = (now_ns() - start_ns) / 1000000.0;
+    return NULL;
+}
+
+void engine_init_stats(const Engine *e, EngineInitStats *out_stats) {
+    *out_stats = e->init_stats;
+}
+
+static
+void engine_init(Engine *e, const EngineConfig *config, int width, int height, Display *display, Window window) {
+    e->init_start_ns = now_ns();
+    e->init_stage_ns = e->init_start_ns;
+    memset(&e->init_stats, 0, sizeof(e->init_stats));
+    e->init_stats.first_frame_ms = -1.0;
+
+    e->config = *config;
+
+    e->frames_in_flight = config->frames_in_flight;
+    if (e->frames_in_flight < 1) {
+        e->frames_in_flight = 1;
+    }
+    if (e->frames_in_flight > ENGINE_MAX_FRAMES_IN_FLIGHT) {
+        e->frames_in_flight = ENGINE_MAX_FRAMES_IN_FLIGHT;
+    }
+    e->frame_index = 0;
+    e->frame_number = 0;
+    e->fence_wait_ns = 0;
+    e->latch_to_submit_ns = 0;
+    e->latch_to_submit_max_ns = 0;
+
+    e->resize_pending = 0;
+    e->resize_forced = 0;
+    memset(&e->resize_stats, 0, sizeof(e->resize_stats));
+    e->signaled_width = width;
+    e->signaled_height = height;
+
+    e->readback_buffer = VK_NULL_HANDLE;
+    e->last_image_index = UINT32_MAX;
+    e->retired_count = 0;
+    e->view_count = 0;
+    e->presents = 0;
+    e->async_compute = 0;
+    e->compute_busy_ms = 0;
+    e->transfer_busy_ns = 0;
+    e->transfer_submits = 0;
+
+    e->vertex_isa = vertex_kernel_best_isa();
+
+    // Known before device creation, inherited queries depend on it
+    e->record_threads = config->record_threads;
+    if (e->record_threads < 1) {
+        e->record_threads = 1;
+    }
+    if (e->record_threads > ENGINE_MAX_RECORD_THREADS) {
+        e->record_threads = ENGINE_MAX_RECORD_THREADS;
+    }
+
+    // GPU driven culling records per frame push constants, secondaries are recorded every frame anyway
+    e->static_recording = config->static_recording;
+    if (e->static_recording && (e->record_threads > 1 || (config->mass_count > 0 && config->gpu_driven))) {
+        printf("Static recording needs inline recording and no GPU driven culling, recording every frame\n");
+        e->static_recording = 0;
+    }
+    e->static_generation = 1;
+
+    e->pool_started = e->record_threads > 1 || (config->mass_count == 0 && config->cpu_mass_count > 0);
+    if (e->pool_started) {
+        thread_pool_init(&e->pool, 0);
+        init_stage_end(e, "thread pool");
+    }
+
+    base_init(e, display, window);
+
+    gpu_queries_init(e);
+
+    alloc_init(&e->allocator, e->phys_device, e->device);
+
+    upload_scratch_init(e);
+
+    stream_init(e);
+
+    frame_descriptors_init(e);
+
+    init_stage_end(e, "memory, descriptors");
+
+    pipeline_cache_init(e);
+
+    init_stage_end(e, "pipeline cache");
+
+    // Shader modules and pipelines are the slowest part on cold cache, they go to worker meanwhile
+    // swapchain, geometry buffers and overlay are created here
+    pthread_t pipelines_thread;
+    int pipelines_threaded = 0;
+    if (e->config.parallel_init) {
+        pipelines_threaded = pthread_create(&pipelines_thread, NULL, pipelines_thread_main, e) == 0;
+        if (!pipelines_threaded) {
+            fprintf(stderr, "pthread_create failed for pipelines, creating them in order\n");
+        }
+    }
+    if (!pipelines_threaded) {
+        pipelines_thread_main(e);
+        init_stage_end(e, "pipelines");
+    }
+
+    if (e->headless) {
+        headless_targets_init(e);
+    } else {
+        swapchain_init(e, VK_NULL_HANDLE);
+    }
+
+    framebuffers_init(e);
+
+    init_stage_end(e, "swapchain");
+
+    e->gpu_driven = e->config.gpu_driven;
+    if (e->config.mass_count > 0) {
+        if (e->gpu_driven && !cull_supported(e)) {
+            printf("Graphics queue has no compute support, mass geometry is not GPU driven\n");
+            e->gpu_driven = 0;
+        }
+
+        if (e->gpu_driven) {
+            // Before cull_init, buffers are created for sharing and object state is handed to compute family
+            e->async_compute = e->compute.family != e->graphics_queue_family;
+            if (e->async_compute) {
+                async_compute_init(e);
+            }
+            cull_init(e);
+        } else {
+            mass_instances_init(e);
+        }
+    } else if (e->config.cpu_mass_count > 0) {
+        cpu_mass_init(e);
+    }
+
+    init_stage_end(e, "geometry");
+
+    e->draw_count = e->config.draw_count > 0 ? e->config.draw_count : 1;
+    if (e->draw_count > draw_list_items(e)) {
+        e->draw_count = draw_list_items(e);
+    }
+    memset(&e->record_stats, 0, sizeof(e->record_stats));
+    e->record_stats.record_threads = e->record_threads;
+    e->record_stats.draw_count = e->draw_count;
+    printf("Draw list: %u draws, recorded %s\n", e->draw_count,
+        e->static_recording ? "once per swapchain image" :
+        e->record_threads > 1 ? "into secondary command buffers on pool" : "inline");
+
+    overlay_init(&e->overlay);
+    if (e->config.overlay) {
+        overlay_gpu_init(e);
+    }
+
+    init_stage_end(e, "overlay");
+
+    if (pipelines_threaded) {
+        pthread_join(pipelines_thread, NULL);
+        init_stage_end(e, "pipelines wait");
+    }
+
+    e->init_stats.total_ms = (now_ns() - e->init_start_ns) / 1000000.0;
+
+    printf("Init: %.3f ms, pipelines %.3f ms %s\n", e->init_stats.total_ms, e->init_stats.pipelines_ms,
+        pipelines_threaded ? "on worker thread" : "in order");
+    for (uint32_t i = 0; i < e->init_stats.stage_count; i++) {
+        printf("  %-20s %9.3f ms\n", e->init_stats.stages[i].name, e->init_stats.stages[i].ms);
+    }
+
+    e->start_ns = now_ns();
+}
 
-void engine_init_xlib(Engine *e, int width, int height, Display *display, Window window) {
-    e->resize_pending = 0;
-    e->signaled_width = width;
-    e->signaled_height = height;
+void engine_init_xlib(Engine *e, const EngineConfig *config, int width, int height, Display *display, Window window) {
+    e->headless = 0;
 
-    base_init(e, display, window);
+    engine_init(e, config, width, height, display, window);
+}
 
-    vertex_memory_init(e);
+void engine_init_headless(Engine *e, const EngineConfig *config, int width, int height, uint32_t image_count) {
+    e->headless = 1;
+    e->headless_image_count = image_count > 0 ? image_count : 1;
 
-    swapchain_init(e);
+    engine_init(e, config, width, height, NULL, 0);
+}
 
-    framebuffers_init(e);
-    
-    triangle_pipeline_init(e);
+void engine_queue_stats(const Engine *e, EngineQueueStats *out_stats) {
+    out_stats->graphics_family = e->graphics_queue_family;
+    out_stats->compute_family = e->compute.family;
+    out_stats->transfer_family = e->transfer.family;
+    out_stats->async_compute = e->async_compute;
+    out_stats->graphics_busy_ms = e->gpu_time_total_ms;
+    out_stats->compute_busy_ms = e->compute_busy_ms;
+    out_stats->transfer_busy_ms = e->transfer_busy_ns / 1000000.0;
+    out_stats->transfer_timestamps = e->transfer_timestamp_pool != VK_NULL_HANDLE;
+    out_stats->transfer_submits = e->transfer_submits;
 }
 
 void engine_deinit(Engine *e) {
     // TODO: correct spot?
     vkDeviceWaitIdle(e->device);
 
+    uploads_collect(e, 1);
+
+    {
+        double wall_ms = (now_ns() - e->start_ns) / 1000000.0;
+        double wait_ms = e->fence_wait_ns / 1000000.0;
+        uint64_t frames = e->frame_number > 0 ? e->frame_number : 1;
+        printf("Frames in flight: %d, frames: %lu, CPU blocked on fences: %.2f ms, %.3f ms/frame, %.1f%% of wall time\n",
+            e->frames_in_flight, (unsigned long)e->frame_number, wait_ms, wait_ms / frames, 100.0 * wait_ms / wall_ms);
+        printf("Present mode: %s, swapchain images: %d, average frame: %.3f ms\n",
+            engine_present_mode_name(e->present_mode), e->swapchain_image_count, wall_ms / frames);
+        printf("GPU time: avg %.3f ms over %lu frames\n",
+            e->gpu_time_frames > 0 ? e->gpu_time_total_ms / e->gpu_time_frames : 0.0, (unsigned long)e->gpu_time_frames);
+        printf("Stream ring: peak %lu of %lu bytes per frame\n",
+            (unsigned long)e->stream_peak, (unsigned long)e->stream_frame_size);
+        printf("Input latch to submit: avg %.3f ms, max %.3f ms\n",
+            e->latch_to_submit_ns / 1000000.0 / frames, e->latch_to_submit_max_ns / 1000000.0);
+        printf("Command recording: %u threads, %u draws, avg %.3f ms\n", e->record_threads, e->draw_count,
+            e->record_stats.frames > 0 ? e->record_stats.total_ms / e->record_stats.frames : 0.0);
+        for (uint32_t v = 0; v < e->view_count; v++) {
+            printf("Window %u: presents: %lu, swapchain rebuilds: %lu, acquire skips: %lu\n", v + 1,
+                (unsigned long)e->views[v].presents, (unsigned long)e->views[v].rebuilds,
+                (unsigned long)e->views[v].acquire_skips);
+        }
+        printf("Queues: graphics %u busy %.2f ms, compute %u busy %.2f ms%s, transfer %u busy %.2f ms (%s) over %lu submits\n",
+            e->graphics_queue_family, e->gpu_time_total_ms, e->compute.family, e->compute_busy_ms,
+            e->async_compute ? " (async culling)" : "", e->transfer.family, e->transfer_busy_ns / 1000000.0,
+            e->transfer_timestamp_pool != VK_NULL_HANDLE ? "timestamps" : "CPU time until completion seen",
+            (unsigned long)e->transfer_submits);
+        if (e->static_recording) {
+            printf("Static recording: %lu frames recorded, %lu reused\n",
+                (unsigned long)e->record_stats.static_recorded, (unsigned long)e->record_stats.static_reused);
+        }
+        printf("Resize signals: %lu, swapchain rebuilds: %lu, rebuilds avoided: %lu\n",
+            (unsigned long)e->resize_stats.signals, (unsigned long)e->resize_stats.rebuilds,
+            (unsigned long)e->resize_stats.rebuilds_avoided);
+    }
+
+    if (e->config.overlay) {
+        overlay_gpu_deinit(e);
+    }
+
+    if (e->config.mass_count > 0) {
+        mass_pipeline_deinit(e);
+        if (e->gpu_driven) {
+            cull_deinit(e);
+            if (e->async_compute) {
+                async_compute_deinit(e);
+            }
+        } else {
+            mass_instances_deinit(e);
+        }
+    } else if (e->config.cpu_mass_count > 0) {
+        cpu_mass_deinit(e);
+    }
+
     triangle_pipeline_deinit(e);
 
+    pipeline_cache_deinit(e);
+
+    retired_collect(e, 1);
+
+    views_deinit(e);
+
     framebuffers_deinit(e);
 
-    swapchain_deinit(e);
+    readback_deinit(e);
+
+    if (e->headless) {
+        headless_targets_deinit(e);
+    } else {
+        swapchain_deinit(e);
+    }
+
+    frame_descriptors_deinit(e);
+
+    stream_deinit(e);
+
+    upload_scratch_deinit(e);
+
+    alloc_print_stats(&e->allocator);
+    alloc_deinit(&e->allocator);
 
-    vertex_memory_deinit(e);
+    gpu_queries_deinit(e);
+
+    if (e->pool_started) {
+        thread_pool_deinit(&e->pool);
+    }
 
     base_deinit(e);
 }
 
-void engine_signal_resize(Engine *e, int width, int height) {
+// RESIZE policy, bursts of signals are coalesced into one rebuild, old swapchain keeps presenting meanwhile
+
+static
+void resize_policy_signal(Engine *e, uint64_t now) {
+    if (!e->resize_pending) {
+        e->resize_first_ns = now;
+    }
+    e->resize_last_ns = now;
     e->resize_pending = 1;
+}
+
+// OUT_OF_DATE swapchain can not be presented at all, so it is rebuilt without waiting
+static
+void resize_policy_force(Engine *e) {
+    resize_policy_signal(e, now_ns());
+    e->resize_forced = 1;
+}
+
+static
+int resize_policy_should_rebuild(Engine *e, uint64_t now) {
+    if (e->resize_forced) {
+        return 1;
+    }
+
+    uint64_t settle_ns = (uint64_t)e->config.resize_settle_ms * 1000000;
+    uint64_t budget_ns = (uint64_t)e->config.resize_budget_ms * 1000000;
+
+    return now - e->resize_last_ns >= settle_ns || now - e->resize_first_ns >= budget_ns;
+}
+
+void engine_signal_resize(Engine *e, int width, int height) {
+    if (e->resize_pending) {
+        e->resize_stats.rebuilds_avoided++;
+    }
+    resize_policy_signal(e, now_ns());
+    e->resize_stats.signals++;
     e->signaled_width = width;
     e->signaled_height = height;
 }
 
 static
 void resize_reinit(Engine *e) {
-    vkDeviceWaitIdle(e->device);
+    // Framebuffers and window extent are baked into static recordings
+    e->static_generation++;
 
-    framebuffers_deinit(e);
-    swapchain_deinit(e);
+    if (e->headless) {
+        // Headless resize is explicit and rare, no reason to keep old targets around
+        vkDeviceWaitIdle(e->device);
+
+        framebuffers_deinit(e);
+        readback_deinit(e);
+        headless_targets_deinit(e);
+
+        headless_targets_init(e);
+        framebuffers_init(e);
+        return;
+    }
+
+    if (e->config.resize_wait_idle) {
+        vkDeviceWaitIdle(e->device);
+    }
+
+    // No vkDeviceWaitIdle by default, frames in flight keep using old swapchain until they retire
+    swapchain_retire(e);
 
-    swapchain_init(e);
+    swapchain_init(e, e->retired[e->retired_count - 1].swapchain);
     framebuffers_init(e);
+
+    if (e->config.resize_wait_idle) {
+        // Device is idle already, old swapchain goes right away
+        retired_collect(e, 1);
+    }
 }
 
-void engine_draw(Engine *e, float cycle) {
-    VK_CHECK(vkWaitForFences(e->device, 1, &e->render_fence, VK_TRUE, UINT64_MAX));
+int engine_readback(Engine *e, void *pixels) {
+    if (!e->headless || e->last_image_index == UINT32_MAX) {
+        return 0;
+    }
 
-    // TODO: before or after fence?
-    if (e->resize_pending) {
-        resize_reinit(e);
-        e->resize_pending = 0;
+    if (e->readback_buffer == VK_NULL_HANDLE) {
+        readback_init(e);
     }
 
-    uint32_t swapchain_image_index = -1;
-    {
-        VkResult result = vkAcquireNextImageKHR(e->device, e->swapchain, UINT64_MAX, e->present_sema, NULL, &swapchain_image_index);
-        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR) {
-            fprintf(stderr, "vkAcquireNextImageKHR (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR)\n");
-            exit(1);
-        }
-        if (result == VK_SUBOPTIMAL_KHR && !e->resize_pending) {
-            printf("vkAcquireNextImageKHR VK_SUBOPTIMAL_KHR\n");
-            e->resize_pending = 1;
-        }
-        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-            printf("vkAcquireNextImageKHR VK_ERROR_OUT_OF_DATE_KHR\n");
-            e->resize_pending = 1;
-            // TODO avoid recursion
-            engine_draw(e, cycle);
-            return;
+    VkImage image = e->headless_images[e->last_image_index];
+
+    EngineQueue graphics = queue_graphics(e);
+    int transfer_owned = e->transfer.family != graphics.family;
+
+    // Release goes on graphics queue, so it is also ordered after frame which rendered image
+    VkCommandBuffer release_cmd = VK_NULL_HANDLE;
+    if (transfer_owned) {
+        release_cmd = one_time_begin(e, &graphics);
+    }
+
+    VkCommandBuffer cmd = one_time_begin(e, &e->transfer);
+
+    // Layout is already TRANSFER_SRC_OPTIMAL after render pass, barrier only makes color writes visible
+    VkImageMemoryBarrier image_barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+
+    if (transfer_owned) {
+        // Image is never given back, render pass starts from UNDEFINED layout and discards old contents
+        image_barrier.dstAccessMask = 0;
+        image_barrier.srcQueueFamilyIndex = graphics.family;
+        image_barrier.dstQueueFamilyIndex = e->transfer.family;
+
+        vkCmdPipelineBarrier(release_cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &image_barrier);
+
+        image_barrier.srcAccessMask = 0;
+        image_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, NULL, 0, NULL, 1, &image_barrier);
+    } else {
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, NULL, 0, NULL, 1, &image_barrier);
+    }
+
+    VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {e->readback_extent.width, e->readback_extent.height, 1},
+    };
+
+    vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, e->readback_buffer, 1, &region);
+
+    VkBufferMemoryBarrier buffer_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = e->readback_buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE,
+    };
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+        0, NULL, 1, &buffer_barrier, 0, NULL);
+
+    if (transfer_owned) {
+        one_time_submit2(e, &graphics, release_cmd, &e->transfer, cmd);
+    } else {
+        one_time_submit(e, &e->transfer, cmd);
+    }
+
+    VkDeviceSize size = (VkDeviceSize)e->readback_extent.width * e->readback_extent.height * 4;
+    alloc_invalidate(&e->allocator, &e->readback_allocation, 0, size);
+    memcpy(pixels, e->readback_allocation.mapped, size);
+
+    return 1;
+}
+
+// Everything render pass content needs, written before recording starts, only read by recording threads
+typedef struct SceneDraw {
+    VkBuffer vertex_buffer;
+    VkDeviceSize vertex_offset;
+    uint32_t uniform_offset;
+    VkDeviceSize overlay_offset;
+    // UINT64_MAX unless vertex count is read from draw command in stream ring
+    VkDeviceSize overlay_indirect_offset;
+    uint32_t overlay_vertex_count;
+} SceneDraw;
+
+// Draws [first_draw, first_draw + draw_count) of draw list, dynamic state is not inherited by secondary
+// command buffers, so every one sets it again
+static
+void scene_record(Engine *e, VkCommandBuffer cmd, const SceneDraw *scene, VkExtent2D extent, uint32_t first_draw,
+                  uint32_t draw_count, int overlay) {
+    VkViewport viewport = {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = extent.width,
+        .height = extent.height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+
+    VkRect2D scissor_rect2d = {
+        .offset = {.x = 0, .y = 0},
+        .extent = extent,
+    };
+
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor_rect2d);
+
+    if (draw_count > 0 && e->config.mass_count > 0) {
+        mass_record(e, cmd, scene->uniform_offset, first_draw, draw_count);
+    } else if (draw_count > 0) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, e->triangle_pipeline);
+
+        VkDeviceSize offsets[] = {scene->vertex_offset};
+        vkCmdBindVertexBuffers(cmd, 0, 1, &scene->vertex_buffer, offsets);
+
+        // Three vertices per triangle, single triangle is draw list of one
+        for (uint32_t d = first_draw; d < first_draw + draw_count; d++) {
+            uint32_t first = draw_list_first(e, d);
+            vkCmdDraw(cmd, (draw_list_first(e, d + 1) - first) * 3, 1, first * 3, 0);
         }
     }
 
-    VK_CHECK(vkResetFences(e->device, 1, &e->render_fence));
-    vkResetCommandBuffer(e->command_buffer, 0);
+    // Last, so it stays on top
+    if (overlay) {
+        overlay_record(e, cmd, scene->overlay_vertex_count, scene->overlay_offset, scene->overlay_indirect_offset,
+            scene->uniform_offset);
+    }
+}
+
+typedef struct RecordJob {
+    Engine *e;
+    EngineFrame *frame;
+    const SceneDraw *scene;
+    VkFramebuffer framebuffer;
+} RecordJob;
+
+// Job index is slice of draw list, it owns pool and secondary buffer of same index for this frame
+static
+void record_job(void *user, uint32_t job, uint32_t thread) {
+    (void)thread;
+    RecordJob *r = user;
+    Engine *e = r->e;
+    EngineFrame *frame = r->frame;
+    VkCommandBuffer cmd = frame->record_buffers[job];
+
+    PROFILE_BEGIN("record slice");
+
+    VK_CHECK(vkResetCommandPool(e->device, frame->record_pools[job], 0));
+
+    VkCommandBufferInheritanceInfo inheritance_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .renderPass = e->render_pass,
+        .subpass = 0,
+        // Known framebuffer lets driver skip patching at execute time
+        .framebuffer = r->framebuffer,
+        .occlusionQueryEnable = VK_FALSE,
+        .pipelineStatistics = frame->stats_pool != VK_NULL_HANDLE ? PIPELINE_STATISTICS : 0,
+    };
 
     VkCommandBufferBeginInfo command_buf_begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance_info,
+    };
+
+    VK_CHECK(vkBeginCommandBuffer(cmd, &command_buf_begin_info));
+
+    uint32_t slices = e->record_threads;
+    uint32_t first_draw = (uint32_t)((uint64_t)e->draw_count * job / slices);
+    uint32_t next_draw = (uint32_t)((uint64_t)e->draw_count * (job + 1) / slices);
+    scene_record(e, cmd, r->scene, e->window, first_draw, next_draw - first_draw, e->config.overlay && job == slices - 1);
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    PROFILE_END();
+}
+
+void engine_record_stats(const Engine *e, EngineRecordStats *out_stats) {
+    *out_stats = e->record_stats;
+}
+
+// Whole frame command buffer, same sequence whether it is recorded every frame or once for static recording
+static
+void frame_record(Engine *e, EngineFrame *frame, VkCommandBuffer cmd, VkCommandBufferUsageFlags usage,
+                  uint32_t image_index, const SceneDraw *scene, float time) {
+    VkCommandBufferBeginInfo command_buf_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = usage,
         .pInheritanceInfo = NULL,
     };
 
-    VK_CHECK(vkBeginCommandBuffer(e->command_buffer, &command_buf_begin_info));
+    VK_CHECK(vkBeginCommandBuffer(cmd, &command_buf_begin_info));
+
+    stream_record_copy(e, cmd);
+
+    if (frame->timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(cmd, frame->timestamp_pool, 0, 2);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->timestamp_pool, 0);
+    }
+    if (frame->stats_pool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(cmd, frame->stats_pool, 0, 1);
+        vkCmdBeginQuery(cmd, frame->stats_pool, 0, 0);
+    }
+
+    if (e->config.mass_count > 0 && e->gpu_driven && !e->async_compute) {
+        cull_record(e, cmd, time);
+    }
 
     VkClearValue clear_value = {
         .color.float32 = { 0.2f, 0.2f, 0.2f, 1.0f },
@@ -872,7 +4617,7 @@ void engine_draw(Engine *e, float cycle) {
     VkRenderPassBeginInfo render_pass_begin_info = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
         .renderPass = e->render_pass,
-        .framebuffer = e->framebuffers[swapchain_image_index],
+        .framebuffer = e->framebuffers[image_index],
         .renderArea = {
             .offset = {
                 .x = 0,
@@ -884,95 +4629,371 @@ void engine_draw(Engine *e, float cycle) {
         .pClearValues = &clear_value,
     };
 
-    float mod_cycle = -cycle - 0.5f;
-    float alpha = (mod_cycle) * 2 * (float) M_PI;
-    float beta = (mod_cycle + 1.0f / 3.0f) * 2 * (float) M_PI;
-    float gamma = (mod_cycle + 2.0f / 3.0f) * 2 * (float) M_PI;
-    float vertices[] = {
-        sinf(alpha) / 2.0f, cosf(alpha) / 2.0f,
-        sinf(beta) / 2.0f, cosf(beta) / 2.0f,
-        sinf(gamma) / 2.0f, cosf(gamma) / 2.0f,
-    };
+    if (e->record_threads > 1) {
+        // Subpass content comes only from secondaries, every slice is recorded by one pool job
+        vkCmdBeginRenderPass(cmd, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-    memcpy(e->mapped_data, vertices, sizeof(vertices));
+        RecordJob job = {
+            .e = e,
+            .frame = frame,
+            .scene = scene,
+            .framebuffer = render_pass_begin_info.framebuffer,
+        };
 
-    VkViewport viewport = {
-        .x = 0.0f,
-        .y = 0.0f,
-        .width = e->window.width,
-        .height = e->window.height,
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f,
-    };
+        thread_pool_run(&e->pool, record_job, &job, e->record_threads);
 
-    VkRect2D scissor_rect2d = {
-        .offset = {.x = 0, .y = 0},
-        .extent = e->window,
-    };
+        vkCmdExecuteCommands(cmd, e->record_threads, frame->record_buffers);
+    } else {
+        vkCmdBeginRenderPass(cmd, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+
+        scene_record(e, cmd, scene, e->window, 0, e->draw_count, e->config.overlay);
+    }
+
+    vkCmdEndRenderPass(cmd);
+
+    // Extra windows get render pass each in same command buffer, always inline and without overlay
+    for (uint32_t v = 0; v < e->view_count; v++) {
+        EngineView *view = &e->views[v];
+        if (view->image_index == UINT32_MAX) {
+            continue;
+        }
+
+        render_pass_begin_info.framebuffer = view->framebuffers[view->image_index];
+        render_pass_begin_info.renderArea.extent = view->extent;
+
+        vkCmdBeginRenderPass(cmd, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+        scene_record(e, cmd, scene, view->extent, 0, e->draw_count, 0);
+        vkCmdEndRenderPass(cmd);
+    }
+
+    if (frame->stats_pool != VK_NULL_HANDLE) {
+        vkCmdEndQuery(cmd, frame->stats_pool, 0);
+    }
+    if (frame->timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->timestamp_pool, 1);
+    }
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+}
+
+void engine_draw(Engine *e, EngineLatchFn latch, void *user) {
+    EngineFrame *frame = &e->frames[e->frame_index];
+
+    {
+        PROFILE_BEGIN("fence wait");
+        uint64_t wait_start = now_ns();
+        VK_CHECK(vkWaitForFences(e->device, 1, &frame->render_fence, VK_TRUE, UINT64_MAX));
+        e->fence_wait_ns += now_ns() - wait_start;
+        PROFILE_END();
+    }
+
+    gpu_queries_collect(e, frame);
+
+    retired_collect(e, 0);
+
+    // Uploads made at init are normally complete by first frames
+    if (e->upload_count > 0) {
+        uploads_collect(e, 0);
+        if (e->upload_count == 0) {
+            alloc_linear_reset(&e->upload_scratch);
+        }
+    }
+
+    // TODO: before or after fence?
+    if (e->resize_pending) {
+        if (resize_policy_should_rebuild(e, now_ns())) {
+            PROFILE_BEGIN("swapchain rebuild");
+            resize_reinit(e);
+            PROFILE_END();
+            e->resize_pending = 0;
+            e->resize_forced = 0;
+            e->resize_stats.rebuilds++;
+        }
+        // Otherwise resize is in motion, present to existing swapchain, compositor scales or crops it
+    }
+
+    uint32_t swapchain_image_index = -1;
+    if (e->headless) {
+        // Nothing presents our images, so they are simply used round robin
+        swapchain_image_index = e->headless_next_image;
+        e->headless_next_image = (e->headless_next_image + 1) % e->swapchain_image_count;
+    } else {
+        PROFILE_BEGIN("acquire");
+        VkResult result = vkAcquireNextImageKHR(e->device, e->swapchain, UINT64_MAX, frame->acquire_sema, NULL, &swapchain_image_index);
+        PROFILE_END();
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR) {
+            fprintf(stderr, "vkAcquireNextImageKHR (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR)\n");
+            exit(1);
+        }
+        // SUBOPTIMAL is tolerated, image is still presentable, policy decides when to rebuild
+        if (result == VK_SUBOPTIMAL_KHR && !e->resize_pending) {
+            printf("vkAcquireNextImageKHR VK_SUBOPTIMAL_KHR\n");
+            resize_policy_signal(e, now_ns());
+        }
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            printf("vkAcquireNextImageKHR VK_ERROR_OUT_OF_DATE_KHR\n");
+            resize_policy_force(e);
+            // TODO avoid recursion
+            engine_draw(e, latch, user);
+            return;
+        }
+    }
 
-    vkCmdBeginRenderPass(e->command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    if (e->view_count > 0) {
+        PROFILE_BEGIN("acquire windows");
+        views_acquire(e);
+        PROFILE_END();
+    }
 
-    vkCmdBindPipeline(e->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, e->triangle_pipeline);
+    PROFILE_BEGIN("record");
+
+    VK_CHECK(vkResetFences(e->device, 1, &frame->render_fence));
+    VK_CHECK(vkResetCommandPool(e->device, frame->command_pool, 0));
+
+    // Everything above may block on GPU or presentation engine, so input is sampled only now
+    uint64_t latch_ns = now_ns();
+    float cycle = latch(user);
+
+    stream_begin_frame(e);
+
+    // Mass geometry animates on GPU from cycle in frame uniforms, everything else is written by vertex kernel
+    // straight into mapped memory, no stack copy
+    VkBuffer vertex_buffer = VK_NULL_HANDLE;
+    VkDeviceSize vertex_offset = 0;
+    if (e->config.mass_count == 0 && e->config.cpu_mass_count > 0) {
+        vertex_buffer = e->cpu_mass_buffer;
+        vertex_offset = cpu_mass_write(e, -cycle - 0.5f);
+    } else if (e->config.mass_count == 0) {
+        static const float center[3] = {0.0f, 0.0f, 0.0f};
+        static const float radius[3] = {0.5f, 0.5f, 0.5f};
+        static const float angle[3] = {0.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+        VertexKernelInput in = {
+            .center_x = center,
+            .center_y = center,
+            .radius = radius,
+            .angle = angle,
+            .count = 3,
+        };
 
-    vkCmdSetViewport(e->command_buffer, 0, 1, &viewport);
-    vkCmdSetScissor(e->command_buffer, 0, 1, &scissor_rect2d);
+        vertex_buffer = stream_gpu_buffer(e);
+        float *vertices = stream_alloc(e, 3 * 2 * sizeof(float), &vertex_offset);
+        vertex_kernel_run(e->vertex_isa, &in, 0, 3, -cycle - 0.5f, vertices);
+    }
 
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(e->command_buffer, 0, 1, &e->buffer, offsets);
+    float time = (float)((latch_ns - e->start_ns) / 1000000000.0);
 
-    vkCmdDraw(e->command_buffer, 3, 1, 0, 0);
+    VkDeviceSize uniform_offset;
+    {
+        FrameUniforms uniforms = {
+            .pixel_to_ndc = {2.0f / e->window.width, 2.0f / e->window.height},
+            .time = time,
+            .cycle = cycle,
+        };
+        memcpy(stream_alloc(e, sizeof(uniforms), &uniform_offset), &uniforms, sizeof(uniforms));
+    }
 
-    vkCmdEndRenderPass(e->command_buffer);
+    VkDeviceSize overlay_offset = 0;
+    VkDeviceSize overlay_indirect_offset = UINT64_MAX;
+    uint32_t overlay_vertex_count = 0;
+    if (e->config.overlay) {
+        overlay_vertex_count = overlay_prepare(e, &overlay_offset, &overlay_indirect_offset);
+    }
 
-    VK_CHECK(vkEndCommandBuffer(e->command_buffer));
+    stream_end_frame(e);
 
-    VkPipelineStageFlags wait_stage_flags[] = {
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+    SceneDraw scene = {
+        .vertex_buffer = vertex_buffer,
+        .vertex_offset = vertex_offset,
+        .uniform_offset = (uint32_t)uniform_offset,
+        .overlay_offset = overlay_offset,
+        .overlay_indirect_offset = overlay_indirect_offset,
+        .overlay_vertex_count = overlay_vertex_count,
     };
 
+    uint64_t record_start_ns = now_ns();
+
+    VkCommandBuffer cmd = frame->command_buffer;
+    // Images of extra windows are not part of key, so they always go dynamic path
+    if (e->static_recording && e->view_count == 0 && swapchain_image_index < ENGINE_MAX_STATIC_IMAGES) {
+        // Offsets in stream slice of this frame are same every frame, so recording of this frame and image
+        // only depends on things in key
+        EngineStaticKey key = {
+            .generation = e->static_generation,
+            .window = e->window,
+            .stream_head = e->stream_head,
+        };
+
+        EngineStaticKey *recorded = &frame->static_keys[swapchain_image_index];
+        cmd = frame->static_buffers[swapchain_image_index];
+        if (recorded->generation != key.generation || recorded->stream_head != key.stream_head ||
+            recorded->window.width != key.window.width || recorded->window.height != key.window.height) {
+            // Fence of this frame was waited, so buffer is not pending
+            frame_record(e, frame, cmd, 0, swapchain_image_index, &scene, time);
+            *recorded = key;
+            e->record_stats.static_recorded++;
+        } else {
+            e->record_stats.static_reused++;
+        }
+    } else {
+        frame_record(e, frame, cmd, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, swapchain_image_index, &scene, time);
+    }
+
+    {
+        uint64_t record_ns = now_ns() - record_start_ns;
+        e->record_stats.last_ms = record_ns / 1000000.0f;
+        e->record_stats.total_ms += record_ns / 1000000.0;
+        e->record_stats.frames++;
+    }
+
+    frame->queries_written = 1;
+    frame->queries_frame_number = e->frame_number;
+
+    PROFILE_END();
+
+    if (e->async_compute) {
+        PROFILE_BEGIN("compute submit");
+        async_compute_submit(e, frame, time);
+        PROFILE_END();
+    }
+
+    // All windows go in one submit and one present, main window first
+    VkSemaphore wait_semas[2 + ENGINE_MAX_VIEWS];
+    VkPipelineStageFlags wait_stage_flags[2 + ENGINE_MAX_VIEWS];
+    VkSemaphore signal_semas[1 + ENGINE_MAX_VIEWS];
+    VkSwapchainKHR present_swapchains[1 + ENGINE_MAX_VIEWS];
+    uint32_t present_indices[1 + ENGINE_MAX_VIEWS];
+    uint32_t present_count = 0;
+    if (!e->headless) {
+        wait_semas[0] = frame->acquire_sema;
+        signal_semas[0] = e->render_semas[swapchain_image_index];
+        present_swapchains[0] = e->swapchain;
+        present_indices[0] = swapchain_image_index;
+        present_count = 1;
+    }
+    for (uint32_t v = 0; v < e->view_count; v++) {
+        EngineView *view = &e->views[v];
+        if (view->image_index != UINT32_MAX) {
+            wait_semas[present_count] = view->acquire_semas[e->frame_index];
+            signal_semas[present_count] = view->render_semas[view->image_index];
+            present_swapchains[present_count] = view->swapchain;
+            present_indices[present_count] = view->image_index;
+            present_count++;
+        }
+    }
+    for (uint32_t i = 0; i < present_count; i++) {
+        wait_stage_flags[i] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    }
+    uint32_t wait_count = present_count;
+    if (e->async_compute) {
+        wait_semas[wait_count] = frame->compute_sema;
+        wait_stage_flags[wait_count] = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+        wait_count++;
+    }
+
     VkSubmitInfo submit_info = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
         
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &e->present_sema,
+        .waitSemaphoreCount = wait_count,
+        .pWaitSemaphores = wait_semas,
         .pWaitDstStageMask = wait_stage_flags,
 
         .commandBufferCount = 1,
-        .pCommandBuffers = &e->command_buffer,
+        .pCommandBuffers = &cmd,
 
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &e->render_sema,
+        .signalSemaphoreCount = present_count,
+        .pSignalSemaphores = present_count > 0 ? signal_semas : NULL,
     };
 
-    VK_CHECK(vkQueueSubmit(e->graphics_queue, 1, &submit_info, e->render_fence));
+    alloc_flush_commit(&e->allocator);
+
+    PROFILE_BEGIN("submit");
+    VK_CHECK(vkQueueSubmit(e->graphics_queue, 1, &submit_info, frame->render_fence));
+    PROFILE_END();
+
+    if (e->frame_number == 0) {
+        e->init_stats.first_frame_ms = (now_ns() - e->init_start_ns) / 1000000.0;
+        printf("Time to first frame: %.3f ms\n", e->init_stats.first_frame_ms);
+    }
+
+    {
+        uint64_t latency_ns = now_ns() - latch_ns;
+        e->latch_to_submit_ns += latency_ns;
+        if (latency_ns > e->latch_to_submit_max_ns) {
+            e->latch_to_submit_max_ns = latency_ns;
+        }
+    }
+
+    e->frame_index = (e->frame_index + 1) % e->frames_in_flight;
+    e->frame_number++;
+    e->last_image_index = swapchain_image_index;
+
+    if (e->headless) {
+        return;
+    }
+
+    VkResult present_results[1 + ENGINE_MAX_VIEWS];
 
     VkPresentInfoKHR present_info = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
 
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &e->render_sema,
+        .waitSemaphoreCount = present_count,
+        .pWaitSemaphores = signal_semas,
 
-        .swapchainCount = 1,
-        .pSwapchains = &e->swapchain,
+        .swapchainCount = present_count,
+        .pSwapchains = present_swapchains,
         
-        .pImageIndices = &swapchain_image_index,
+        .pImageIndices = present_indices,
+        .pResults = present_results,
     };
 
     {
-        VkResult result = vkQueuePresentKHR(e->graphics_queue, &present_info);
-        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR) {
-            fprintf(stderr, "vkQueuePresentKHR (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR)\n");
-            exit(1);
+        PROFILE_BEGIN("present");
+        VkResult batch_result = vkQueuePresentKHR(e->graphics_queue, &present_info);
+        PROFILE_END();
+        for (uint32_t i = 0; i < present_count; i++) {
+            VkResult r = batch_result;
+            if (r == VK_SUCCESS || r == VK_SUBOPTIMAL_KHR || r == VK_ERROR_OUT_OF_DATE_KHR) {
+                r = present_results[i];
+            }
+            if (r != VK_SUCCESS && r != VK_SUBOPTIMAL_KHR && r != VK_ERROR_OUT_OF_DATE_KHR) {
+                fprintf(stderr, "vkQueuePresentKHR (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR)\n");
+                exit(1);
+            }
+        }
+
+        // Extra windows in same order as they were added to present, skipped ones are not there
+        uint32_t next = 1;
+        for (uint32_t v = 0; v < e->view_count; v++) {
+            EngineView *view = &e->views[v];
+            if (view->image_index == UINT32_MAX) {
+                continue;
+            }
+
+            VkResult view_result = present_results[next++];
+            if (view_result != VK_ERROR_OUT_OF_DATE_KHR) {
+                view->presents++;
+                view->swapchain_presents++;
+            }
+            if (view_result != VK_SUCCESS) {
+                view->rebuild = 1;
+            }
+            view->image_index = UINT32_MAX;
+        }
+
+        VkResult result = present_results[0];
+        if (result != VK_ERROR_OUT_OF_DATE_KHR) {
+            e->presents++;
+            e->swapchain_presents++;
         }
         if (result == VK_SUBOPTIMAL_KHR && !e->resize_pending) {
             printf("vkQueuePresentKHR VK_SUBOPTIMAL_KHR \n");  
-            e->resize_pending = 1;
+            resize_policy_signal(e, now_ns());
         }
         if (result == VK_ERROR_OUT_OF_DATE_KHR) {
             printf("vkQueuePresentKHR VK_ERROR_OUT_OF_DATE_KHR\n");
-            e->resize_pending = 1;
+            resize_policy_force(e);
             // TODO avoid recursion
-            engine_draw(e, cycle);
+            engine_draw(e, latch, user);
             return;
         }
     }
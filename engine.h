@@ -1,6 +1,7 @@
 #ifndef ENGINE_H
 #define ENGINE_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #include <X11/Xlib.h>
@@ -9,7 +10,268 @@
 #define VK_USE_PLATFORM_XLIB_KHR
 #include <vulkan/vulkan.h>
 
+#include "overlay.h"
+#include "allocator.h"
+#include "thread_pool.h"
+#include "vertex_kernel.h"
+
+#define ENGINE_MAX_FRAMES_IN_FLIGHT 3
+// Secondary command buffers render pass content can be split into
+#define ENGINE_MAX_RECORD_THREADS 16
+// Swapchain images beyond this are recorded every frame even with static recording
+#define ENGINE_MAX_STATIC_IMAGES 8
+// Extra windows besides main one
+#define ENGINE_MAX_VIEWS 8
+// Timed steps of engine_init
+#define ENGINE_MAX_INIT_STAGES 24
+// Bytes of dynamic vertex and uniform data one frame may write
+#define ENGINE_STREAM_FRAME_SIZE (256 * 1024)
+
+typedef struct EngineConfig {
+    // How many frames CPU may record ahead of GPU, clamped to [1, ENGINE_MAX_FRAMES_IN_FLIGHT]
+    uint32_t frames_in_flight;
+
+    // Desired present mode, falls back to what surface supports, FIFO is always there
+    VkPresentModeKHR present_mode;
+    // Desired swapchain image count, clamped to surface limits
+    uint32_t image_count;
+
+    // Pipeline cache file loaded at init and written back at deinit, NULL disables it
+    const char *pipeline_cache_path;
+
+    // Directory with .spv files which override embedded shaders, NULL uses embedded ones
+    const char *shader_dir;
+
+    // Enable VK_LAYER_KHRONOS_validation when it is installed, costs startup time and CPU per call
+    int validation;
+    // Shader modules and graphics pipelines are created on worker thread while swapchain and buffers are
+    // created on caller one, off does everything in order on caller thread
+    int parallel_init;
+
+    // Physical device by index, UUID or part of name, all digits is index unless name: prefix says otherwise,
+    // NULL picks best scoring one
+    const char *device;
+    // File with UUID of device picked by scoring, next start takes it without scoring, NULL disables it
+    const char *device_cache_path;
+
+    // Swapchain is rebuilt once no resize was signaled for settle time, or budget elapsed since first one
+    // Zero settle time rebuilds on next frame after every signal
+    uint32_t resize_settle_ms;
+    uint32_t resize_budget_ms;
+    // Old rebuild path, waits for idle before recreate and destroys old swapchain at once, to compare against
+    int resize_wait_idle;
+
+    // Count vertex and fragment shader invocations, needs pipelineStatisticsQuery feature
+    int gpu_pipeline_stats;
+
+    // Stats text and frame time graph drawn on top of frame
+    int overlay;
+
+    // Copy per-frame data from host memory into device local buffer, 1 always, 0 never,
+    // -1 only if device has no host visible device local memory
+    int stream_staging;
+
+    // Instanced triangles drawn instead of single one, zero draws single triangle
+    uint32_t mass_count;
+    // Mass geometry moves and is culled by compute shader, drawn with indirect draw of visible instances
+    int gpu_driven;
+
+    // Triangles animated on CPU by vertex kernel every frame, used when mass_count is zero
+    uint32_t cpu_mass_count;
+
+    // Mass geometry is drawn with this many draw calls, each one covers equal part of instances or triangles
+    uint32_t draw_count;
+    // Render pass content is recorded into this many secondary command buffers on pool threads,
+    // 1 records it inline into primary, clamped to ENGINE_MAX_RECORD_THREADS
+    uint32_t record_threads;
+    // Command buffer per frame in flight and swapchain image is recorded once and resubmitted until
+    // resize or stream layout change, needs inline recording and no GPU driven culling
+    int static_recording;
+    // Use transfer-only and compute-only queue families when device has them, uploads and readbacks go
+    // to transfer queue, GPU driven culling to compute queue. Off puts everything on graphics queue
+    int dedicated_queues;
+} EngineConfig;
+
+// What static recording was made against, it is stale once any of it differs
+typedef struct EngineStaticKey {
+    // Zero never matches, engine generation starts at one
+    uint64_t generation;
+    VkExtent2D window;
+    VkDeviceSize stream_head;
+} EngineStaticKey;
+
+// Everything that must not be touched by CPU while GPU still executes the frame
+typedef struct EngineFrame {
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+
+    // Pool and secondary buffer per recording slice, pool is used only by job of that slice, so no locking
+    VkCommandPool record_pools[ENGINE_MAX_RECORD_THREADS];
+    VkCommandBuffer record_buffers[ENGINE_MAX_RECORD_THREADS];
+
+    // Static recording only, buffers are reset one by one, so pool is not transient
+    VkCommandPool static_pool;
+    VkCommandBuffer static_buffers[ENGINE_MAX_STATIC_IMAGES];
+    EngineStaticKey static_keys[ENGINE_MAX_STATIC_IMAGES];
+
+    // Async compute only, culling is submitted to compute queue, graphics submit waits for semaphore
+    VkCommandPool compute_pool;
+    VkCommandBuffer compute_buffer;
+    VkSemaphore compute_sema;
+    // VK_NULL_HANDLE if compute family has no timestamp support
+    VkQueryPool compute_timestamp_pool;
+
+    VkFence render_fence;
+    // Signaled by vkAcquireNextImageKHR, indexed per frame, because image index is unknown before acquire
+    VkSemaphore acquire_sema;
+
+    // Timestamps around render pass, VK_NULL_HANDLE if queue has no timestamp support
+    VkQueryPool timestamp_pool;
+    // VK_NULL_HANDLE unless pipeline statistics are enabled
+    VkQueryPool stats_pool;
+    int queries_written;
+    uint64_t queries_frame_number;
+} EngineFrame;
+
+typedef struct EngineGpuStats {
+    // GPU time of render pass of most recent completed frame, negative before first result
+    float gpu_time_ms;
+    // Zero unless pipeline statistics are enabled
+    uint64_t vertex_invocations;
+    uint64_t fragment_invocations;
+    // Frame the values belong to, it lags frames in flight behind current one
+    uint64_t frame_number;
+} EngineGpuStats;
+
+typedef struct EngineInitStage {
+    const char *name;
+    double ms;
+} EngineInitStage;
+
+typedef struct EngineInitStats {
+    // Caller thread, in order, stage starts where previous one ended
+    uint32_t stage_count;
+    EngineInitStage stages[ENGINE_MAX_INIT_STAGES];
+    double total_ms;
+    // Worker thread, overlaps stages after pipeline cache, waiting for it is stage of its own
+    double pipelines_ms;
+    // From engine_init start to first vkQueueSubmit return, negative before first frame
+    double first_frame_ms;
+} EngineInitStats;
+
+typedef struct EngineRecordStats {
+    // Secondary command buffers per frame, 1 means inline recording
+    uint32_t record_threads;
+    // Draw calls in render pass, overlay not included
+    uint32_t draw_count;
+    // CPU time of command buffer recording, including wait for recording threads, zero for reused
+    // static recording
+    float last_ms;
+    double total_ms;
+    uint64_t frames;
+    // Static recording only, frames recorded again because key was stale and frames submitted as is
+    uint64_t static_recorded;
+    uint64_t static_reused;
+} EngineRecordStats;
+
+#define ENGINE_MAX_RETIRED_SWAPCHAINS 8
+
+#define ENGINE_MAX_UPLOADS 8
+
+// Submitted one-time upload, its command buffers and staging buffer are freed once fence is signaled
+typedef struct EngineUpload {
+    VkFence fence;
+    // First is VK_NULL_HANDLE without ownership transfer, last one is VK_NULL_HANDLE when slot is free
+    VkCommandPool first_pool;
+    VkCommandBuffer first_cmd;
+    VkCommandPool last_pool;
+    VkCommandBuffer last_cmd;
+    // Query reset on graphics queue ahead of transfer submit, VK_NULL_HANDLE if none
+    VkCommandBuffer reset_cmd;
+    VkBuffer staging_buffer;
+    // Has transfer queue work, timed by query pair unless it is UINT32_MAX
+    int transfer;
+    uint32_t transfer_query;
+    uint64_t submit_ns;
+} EngineUpload;
+
+// Swapchain replaced by resize, destroyed once all frames which used it are complete
+typedef struct EngineRetiredSwapchain {
+    VkSwapchainKHR swapchain;
+    uint32_t image_count;
+    VkImageView *image_views;
+    VkFramebuffer *framebuffers;
+    VkSemaphore *render_semas;
+
+    // Safe to destroy when engine reaches this frame number and a later present to current swapchain completed,
+    // frame fence covers rendering but not wait of present on render semaphore
+    uint64_t retire_frame;
+} EngineRetiredSwapchain;
+
+// Extra window, everything tied to its surface, drawn and presented together with main window
+typedef struct EngineView {
+    VkSurfaceKHR surface;
+    VkPresentModeKHR present_mode;
+    VkSwapchainKHR swapchain;
+    uint32_t image_count;
+    VkImageView *image_views;
+    VkFramebuffer *framebuffers;
+    // Indexed per swapchain image, like main window ones
+    VkSemaphore *render_semas;
+    // Indexed per frame in flight
+    VkSemaphore acquire_semas[ENGINE_MAX_FRAMES_IN_FLIGHT];
+    VkExtent2D extent;
+
+    // Swapchain is rebuilt before next acquire
+    int rebuild;
+    // Acquired for current frame, UINT32_MAX if window is skipped
+    uint32_t image_index;
+    uint64_t presents;
+    uint64_t rebuilds;
+    // Frames with no image ready at acquire, window was not drawn then
+    uint64_t acquire_skips;
+
+    // Deferred destruction queue and presents to current swapchain, same as main window ones
+    uint32_t retired_count;
+    EngineRetiredSwapchain retired[ENGINE_MAX_RETIRED_SWAPCHAINS];
+    uint64_t swapchain_presents;
+} EngineView;
+
+// Queue and one-time command pool for uploads and readback on it, pool is shared when family is the same
+typedef struct EngineQueue {
+    uint32_t family;
+    VkQueue queue;
+    VkCommandPool one_time_pool;
+} EngineQueue;
+
+typedef struct EngineQueueStats {
+    // Same as graphics one when there is no dedicated family
+    uint32_t graphics_family;
+    uint32_t compute_family;
+    uint32_t transfer_family;
+    // Culling runs on compute queue
+    int async_compute;
+    // From timestamps around submitted work, transfer one only when transfer_timestamps is set, otherwise it is
+    // CPU time of uploads and readbacks from submit until their completion was seen, an upper bound
+    double graphics_busy_ms;
+    double compute_busy_ms;
+    double transfer_busy_ms;
+    int transfer_timestamps;
+    uint64_t transfer_submits;
+} EngineQueueStats;
+
+typedef struct EngineResizeStats {
+    // engine_signal_resize calls
+    uint64_t signals;
+    uint64_t rebuilds;
+    // Signals folded into rebuild which was already pending, each one used to be rebuild of its own
+    uint64_t rebuilds_avoided;
+} EngineResizeStats;
+
 typedef struct Engine {
+    EngineConfig config;
+
+
     // BASE
     VkInstance instance;
 
@@ -24,44 +286,266 @@ typedef struct Engine {
     VkDevice device;
     VkQueue graphics_queue;
 
-    VkCommandPool command_pool;
-    VkCommandBuffer command_buffer;
+    // Dedicated families if config and device allow, otherwise graphics queue and one_time_pool again
+    EngineQueue compute;
+    EngineQueue transfer;
+    // Orders two halves of ownership transfer between families
+    VkSemaphore handoff_sema;
+    uint32_t compute_timestamp_valid_bits;
+    int async_compute;
+    double compute_busy_ms;
+    uint64_t transfer_busy_ns;
+    uint64_t transfer_submits;
+    // Timestamp pair per transfer submit, VK_NULL_HANDLE when transfer family has no timestamps
+    uint32_t transfer_timestamp_valid_bits;
+    VkQueryPool transfer_timestamp_pool;
+    uint32_t transfer_query_next;
+    // Reset of next half on graphics queue for transfer-only family, goes with next upload
+    VkCommandBuffer transfer_reset_cmd;
+    VkSemaphore transfer_reset_sema;
+    // Pair of command buffer being recorded for transfer queue, UINT32_MAX if none
+    uint32_t transfer_query_active;
 
     VkRenderPass render_pass;
 
-    VkFence render_fence;
-    VkSemaphore present_sema, render_sema;
+    // FRAMES in flight
+    uint32_t frames_in_flight;
+    uint32_t frame_index;
+    uint64_t frame_number;
+    EngineFrame frames[ENGINE_MAX_FRAMES_IN_FLIGHT];
+
 
+    // GPU QUERIES
+    uint32_t timestamp_valid_bits;
+    uint64_t timestamp_mask;
+    // Nanoseconds per tick
+    float timestamp_period;
+    int pipeline_stats_supported;
+    EngineGpuStats gpu_stats;
+    double gpu_time_total_ms;
+    uint64_t gpu_time_frames;
+
+
+    // MEMORY, every resource is sub-allocated from few large blocks
+    Allocator allocator;
+    // Staging for one-time uploads, reset once none of them is pending
+    AllocLinear upload_scratch;
+    uint32_t upload_count;
+    EngineUpload uploads[ENGINE_MAX_UPLOADS];
+
+
+    // STREAM ring for per-frame vertices and uniforms, slice per frame in flight, bump allocated
+    VkBuffer stream_buffer;
+    Allocation stream_allocation;
+    char *stream_mapped;
+    // VK_NULL_HANDLE unless staged, then draws read this one
+    VkBuffer stream_device_buffer;
+    Allocation stream_device_allocation;
+    int stream_staged;
+    VkDeviceSize stream_frame_size;
+    VkDeviceSize stream_alignment;
+    // Offset in slice of current frame
+    VkDeviceSize stream_head;
+    VkDeviceSize stream_peak;
+
+    // Dynamic uniform buffer pointing at stream ring
+    VkDescriptorSetLayout frame_set_layout;
+    VkDescriptorPool frame_descriptor_pool;
+    VkDescriptorSet frame_set;
 
-    // MEMORY for vertices
-    VkBuffer buffer;
-    VkDeviceMemory memory;
-    void *mapped_data;
-    
 
     // SWAPCHAIN and friends
     VkSwapchainKHR swapchain;
     uint32_t swapchain_image_count;
     VkImageView *swapchain_image_views;
+    // Signaled by submit and waited by present, indexed per swapchain image
+    VkSemaphore *render_semas;
 
     VkFramebuffer *framebuffers;
 
+    // Deferred destruction queue, filled by resize
+    uint32_t retired_count;
+    EngineRetiredSwapchain retired[ENGINE_MAX_RETIRED_SWAPCHAINS];
+    // Presents to current swapchain, more than its image count means some image was acquired again,
+    // so a present to it completed, and with it presents queued earlier to retired swapchains
+    uint64_t swapchain_presents;
+
+    // Last image submitted for rendering, UINT32_MAX before first frame
+    uint32_t last_image_index;
+
     VkExtent2D window;
 
     int resize_pending;
+    // Swapchain is out of date, rebuild regardless of policy
+    int resize_forced;
+    uint64_t resize_first_ns, resize_last_ns;
+    EngineResizeStats resize_stats;
     // Set initially or signaled by resize, used to check Vulkan behaviour
     int signaled_width, signaled_height;
 
 
+    // VIEWS, extra windows sharing device, pipelines and stream ring, one submit and one present for all
+    uint32_t view_count;
+    EngineView views[ENGINE_MAX_VIEWS];
+    // Main window presents which were not out of date
+    uint64_t presents;
+
+
+    // HEADLESS, no surface and no swapchain, images above are engine owned
+    int headless;
+    uint32_t headless_image_count;
+    uint32_t headless_next_image;
+    VkImage *headless_images;
+    Allocation *headless_allocations;
+
+    // Used for rare blocking work such as readback
+    VkCommandPool one_time_pool;
+
+    // Created on first engine_readback call
+    VkBuffer readback_buffer;
+    Allocation readback_allocation;
+    VkExtent2D readback_extent;
+
+
+    // PIPELINE CACHE
+    VkPipelineCache pipeline_cache;
+    // Cache was seeded from file of previous run
+    int pipeline_cache_warm;
+
+
     // TRIANGLE pipeline
     VkPipeline triangle_pipeline;
+
+
+    // MASS geometry, config.mass_count instances of one triangle, per-instance data is static in device memory
+    VkBuffer mass_instance_buffer;
+    Allocation mass_instance_allocation;
+    VkPipelineLayout mass_pipeline_layout;
+    VkPipeline mass_pipeline;
+
+    // GPU DRIVEN mass geometry, object state lives only on GPU, visible instances and draw command are
+    // written by compute into slice per frame in flight, so CPU cost does not depend on object count
+    int gpu_driven;
+    VkBuffer mass_object_buffer;
+    Allocation mass_object_allocation;
+    VkBuffer mass_visible_buffer;
+    Allocation mass_visible_allocation;
+    VkDeviceSize mass_visible_slice;
+    VkBuffer mass_indirect_buffer;
+    Allocation mass_indirect_allocation;
+    VkDeviceSize mass_indirect_slice;
+    VkDescriptorSetLayout cull_set_layout;
+    VkDescriptorPool cull_descriptor_pool;
+    VkDescriptorSet cull_sets[ENGINE_MAX_FRAMES_IN_FLIGHT];
+    VkPipelineLayout cull_pipeline_layout;
+    VkPipeline cull_pipeline;
+    float cull_last_time;
+
+
+    // WORKERS for vertex kernel and parallel recording, started only if one of them is used
+    int pool_started;
+    ThreadPool pool;
+
+
+    // CPU MASS geometry, config.cpu_mass_count triangles, vertex kernel writes positions straight into
+    // host visible buffer, slice per frame in flight, large batches are split over pool
+    VertexKernelIsa vertex_isa;
+    // Structure of arrays for kernel, one allocation
+    float *cpu_mass_storage;
+    VertexKernelInput cpu_mass_input;
+    VkBuffer cpu_mass_buffer;
+    Allocation cpu_mass_allocation;
+    VkDeviceSize cpu_mass_slice;
+
+
+    // DRAW LIST, mass geometry split into draw_count draws, recorded in record_threads slices
+    uint32_t draw_count;
+    uint32_t record_threads;
+    EngineRecordStats record_stats;
+    int static_recording;
+    // Bumped by every resize, invalidates all static recordings
+    uint64_t static_generation;
+
+
+    // OVERLAY, batch is rebuilt every frame into stream ring, atlas is static
+    Overlay overlay;
+    VkImage overlay_atlas;
+    Allocation overlay_atlas_allocation;
+    VkImageView overlay_atlas_view;
+    VkSampler overlay_sampler;
+    VkDescriptorSetLayout overlay_set_layout;
+    VkDescriptorPool overlay_descriptor_pool;
+    VkDescriptorSet overlay_set;
+    VkPipelineLayout overlay_pipeline_layout;
+    VkPipeline overlay_pipeline;
+
+
+    // STATS
+    uint64_t start_ns;
+    uint64_t init_start_ns;
+    // End of last init stage
+    uint64_t init_stage_ns;
+    EngineInitStats init_stats;
+    // Time CPU spent blocked in vkWaitForFences, shows how much CPU and GPU work overlap
+    uint64_t fence_wait_ns;
+    // From latch callback to vkQueueSubmit return, that is how old sampled input is when GPU gets it
+    uint64_t latch_to_submit_ns, latch_to_submit_max_ns;
 } Engine;
 
-void engine_init_xlib(Engine *e, int width, int height, Display *display, Window window);
+// Called by engine_draw as late as possible, right before per-frame data is written
+// Samples input and animation state, returns animation cycle in [0, 1]
+typedef float (*EngineLatchFn)(void *user);
+
+void engine_config_default(EngineConfig *config);
+
+// Named presets picking present mode, image count and frames in flight together:
+// "low-latency", "max-throughput", "power-save". Returns 0 for unknown name
+int engine_config_apply_profile(EngineConfig *config, const char *name);
+
+// Names are "immediate", "mailbox", "fifo", "fifo-relaxed", returns 0 for unknown name
+int engine_present_mode_parse(const char *name, VkPresentModeKHR *out_mode);
+const char *engine_present_mode_name(VkPresentModeKHR mode);
+
+// Overrides config fields with ENGINE_* environment variables if they are set
+void engine_config_from_env(EngineConfig *config);
+
+void engine_init_xlib(Engine *e, const EngineConfig *config, int width, int height, Display *display, Window window);
+
+// Renders into engine owned ring of image_count color images, does not need X11 display or surface
+void engine_init_headless(Engine *e, const EngineConfig *config, int width, int height, uint32_t image_count);
+
+// Copies last rendered image as BGRA8 rows into pixels, which must hold width * height * 4 bytes
+// Blocks until GPU is idle, only works for headless engine, returns 0 if nothing was copied
+int engine_readback(Engine *e, void *pixels);
 
 void engine_signal_resize(Engine *e, int width, int height);
 
-void engine_draw(Engine *e, float cycle);
+// Adds window to render after init, main window is 0, returned index counts extra ones from 1
+// Exits if device can not present to it with format of main window
+uint32_t engine_add_window(Engine *e, Display *display, Window window);
+// Window 0 goes through resize policy, extra windows are rebuilt on next frame
+void engine_signal_window_resize(Engine *e, uint32_t window, int width, int height);
+uint64_t engine_window_presents(const Engine *e, uint32_t window);
+
+void engine_draw(Engine *e, EngineLatchFn latch, void *user);
+
+// Overlay content, cheap, nothing is uploaded until next engine_draw
+void engine_overlay_text(Engine *e, const char *text);
+void engine_overlay_frame_time(Engine *e, float frame_ms);
+
+// Device memory blocks, allocations and flushes so far
+void engine_memory_stats(const Engine *e, AllocStats *out_stats);
+
+// Latest GPU timings, cheap, results are collected inside engine_draw without blocking
+void engine_gpu_stats(const Engine *e, EngineGpuStats *out_stats);
+
+// CPU cost of recording render pass content, average covers whole run
+void engine_record_stats(const Engine *e, EngineRecordStats *out_stats);
+
+void engine_queue_stats(const Engine *e, EngineQueueStats *out_stats);
+
+// Time of every init stage and time to first frame
+void engine_init_stats(const Engine *e, EngineInitStats *out_stats);
 
 void engine_deinit(Engine *e);
 
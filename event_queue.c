@@ -0,0 +1,32 @@
+#include "event_queue.h"
+
+void event_queue_init(EventQueue *q) {
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+}
+
+int event_queue_push(EventQueue *q, const AppEvent *event) {
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - head == EVENT_QUEUE_SIZE) {
+        return 0;
+    }
+
+    q->events[tail & (EVENT_QUEUE_SIZE - 1)] = *event;
+    // Release, so consumer which sees new tail also sees event
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+int event_queue_pop(EventQueue *q, AppEvent *out_event) {
+    unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head == tail) {
+        return 0;
+    }
+
+    *out_event = q->events[head & (EVENT_QUEUE_SIZE - 1)];
+    // Release, so producer does not overwrite slot before it was copied out
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 1;
+}
@@ -0,0 +1,49 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Lock-free ring of window events, exactly one thread pushes and exactly one other thread pops.
+// Only discrete events go here, continuously changing state such as mouse position is published separately.
+
+// Power of two, so indices wrap by mask
+#define EVENT_QUEUE_SIZE 256
+
+typedef enum AppEventType {
+    APP_EVENT_RESIZE,
+    APP_EVENT_KEY,
+    APP_EVENT_QUIT,
+    // Window contents were lost and must be drawn again
+    APP_EVENT_EXPOSE,
+    APP_EVENT_VISIBILITY,
+    APP_EVENT_MAP,
+} AppEventType;
+
+typedef struct AppEvent {
+    AppEventType type;
+    // 0 is main window, extra windows count from 1
+    uint32_t window;
+    // APP_EVENT_RESIZE
+    int width;
+    int height;
+    // APP_EVENT_VISIBILITY and APP_EVENT_MAP, nonzero if some part of window is visible or window is mapped
+    int state;
+} AppEvent;
+
+typedef struct EventQueue {
+    AppEvent events[EVENT_QUEUE_SIZE];
+    // Free running counters, written by one side each, on own cache lines so sides do not fight over them
+    alignas(64) atomic_uint head;
+    alignas(64) atomic_uint tail;
+} EventQueue;
+
+void event_queue_init(EventQueue *q);
+
+// Producer side, returns 0 if queue is full
+int event_queue_push(EventQueue *q, const AppEvent *event);
+// Consumer side, returns 0 if queue is empty
+int event_queue_pop(EventQueue *q, AppEvent *out_event);
+
+#endif /* EVENT_QUEUE_H */
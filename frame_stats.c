@@ -0,0 +1,114 @@
+#include "frame_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static
+uint32_t frame_hist_bucket(uint64_t value_us) {
+    if (value_us > UINT32_MAX) {
+        value_us = UINT32_MAX;
+    }
+    if (value_us < FRAME_HIST_SUB_BUCKETS) {
+        return (uint32_t)value_us;
+    }
+
+    // Top FRAME_HIST_SUB_BITS + 1 bits select bucket, leading one selects power of two range
+    uint32_t msb = 63 - __builtin_clzll(value_us);
+    uint32_t shift = msb - FRAME_HIST_SUB_BITS;
+    return (shift + 1) * FRAME_HIST_SUB_BUCKETS + (uint32_t)(value_us >> shift) - FRAME_HIST_SUB_BUCKETS;
+}
+
+// Exclusive upper bound of bucket values
+static
+uint64_t frame_hist_bucket_limit(uint32_t bucket) {
+    if (bucket < FRAME_HIST_SUB_BUCKETS) {
+        return bucket + 1;
+    }
+
+    uint32_t shift = bucket / FRAME_HIST_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % FRAME_HIST_SUB_BUCKETS;
+    return (FRAME_HIST_SUB_BUCKETS + sub + 1) << shift;
+}
+
+void frame_hist_add(FrameHistogram *h, uint64_t value_us) {
+    h->counts[frame_hist_bucket(value_us)]++;
+    h->total++;
+    h->sum_us += value_us;
+    if (value_us > h->max_us) {
+        h->max_us = value_us;
+    }
+}
+
+float frame_hist_percentile_ms(const FrameHistogram *h, double p) {
+    if (h->total == 0) {
+        return 0;
+    }
+
+    // Nearest rank, at least one sample
+    uint64_t rank = (uint64_t)(p * (double)h->total + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < FRAME_HIST_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank) {
+            uint64_t limit_us = frame_hist_bucket_limit(b);
+            if (limit_us > h->max_us) {
+                limit_us = h->max_us;
+            }
+            return (float)limit_us / 1000.0f;
+        }
+    }
+
+    return (float)h->max_us / 1000.0f;
+}
+
+float frame_hist_mean_ms(const FrameHistogram *h) {
+    if (h->total == 0) {
+        return 0;
+    }
+    return (float)((double)h->sum_us / (double)h->total / 1000.0);
+}
+
+void frame_hist_print(const FrameHistogram *h, const char *label) {
+    printf("%s: %lu frames, mean %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms, hitches %lu\n",
+        label, (unsigned long)h->total, (double)frame_hist_mean_ms(h),
+        (double)frame_hist_percentile_ms(h, 0.5), (double)frame_hist_percentile_ms(h, 0.9),
+        (double)frame_hist_percentile_ms(h, 0.99), (double)frame_hist_percentile_ms(h, 0.999),
+        (double)h->max_us / 1000.0, (unsigned long)h->hitches);
+}
+
+void frame_stats_init(FrameStats *s, uint32_t window_ms, float hitch_ms) {
+    memset(s, 0, sizeof(*s));
+    s->window_ns = (uint64_t)window_ms * 1000000;
+    s->hitch_ms = hitch_ms;
+}
+
+int frame_stats_add(FrameStats *s, uint64_t frame_ns) {
+    uint64_t value_us = frame_ns / 1000;
+
+    // Before first window completes median is unknown, so only fixed threshold counts
+    float threshold_ms = s->hitch_ms;
+    if (threshold_ms <= 0) {
+        threshold_ms = 2.0f * s->last_window_median_ms;
+    }
+    int hitch = threshold_ms > 0 && (float)value_us / 1000.0f > threshold_ms;
+
+    frame_hist_add(&s->run, value_us);
+    frame_hist_add(&s->window, value_us);
+    s->run.hitches += hitch;
+    s->window.hitches += hitch;
+
+    s->window_elapsed_ns += frame_ns;
+    if (s->window_elapsed_ns < s->window_ns) {
+        return 0;
+    }
+
+    s->last_window = s->window;
+    s->last_window_median_ms = frame_hist_percentile_ms(&s->last_window, 0.5);
+    memset(&s->window, 0, sizeof(s->window));
+    s->window_elapsed_ns = 0;
+    return 1;
+}
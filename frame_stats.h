@@ -0,0 +1,50 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdint.h>
+
+// Log-bucketed frame time histogram, fixed memory, values in microseconds.
+// Every power of two range is split into FRAME_HIST_SUB_BUCKETS linear buckets, so error is below 1/32.
+
+#define FRAME_HIST_SUB_BITS 5
+#define FRAME_HIST_SUB_BUCKETS (1 << FRAME_HIST_SUB_BITS)
+// Values are clamped to 2^32 us, more than an hour
+#define FRAME_HIST_BUCKETS ((32 - FRAME_HIST_SUB_BITS + 1) * FRAME_HIST_SUB_BUCKETS)
+
+typedef struct FrameHistogram {
+    uint32_t counts[FRAME_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t hitches;
+} FrameHistogram;
+
+typedef struct FrameStats {
+    // Whole run
+    FrameHistogram run;
+    // Tumbling windows, not rolling: window being filled starts empty once it is complete and becomes
+    // last_window, so windowed values are read from last complete one and change once per window
+    FrameHistogram window;
+    FrameHistogram last_window;
+    uint64_t window_ns;
+    uint64_t window_elapsed_ns;
+    // Median of last_window, taken when it completes and not for every frame
+    float last_window_median_ms;
+
+    // Zero means twice median of last complete window
+    float hitch_ms;
+} FrameStats;
+
+void frame_stats_init(FrameStats *s, uint32_t window_ms, float hitch_ms);
+// Returns 1 when tumbling window was completed by this frame
+int frame_stats_add(FrameStats *s, uint64_t frame_ns);
+
+void frame_hist_add(FrameHistogram *h, uint64_t value_us);
+// p in [0, 1], returns upper bound of bucket, but never more than max
+float frame_hist_percentile_ms(const FrameHistogram *h, double p);
+float frame_hist_mean_ms(const FrameHistogram *h);
+
+// One line with p50/p90/p99/p99.9/max, mean and hitches
+void frame_hist_print(const FrameHistogram *h, const char *label);
+
+#endif /* FRAME_STATS_H */
@@ -1,9 +1,26 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
 
 #include "engine.h"
+#include "profiler.h"
+#include "frame_stats.h"
+#include "vertex_kernel.h"
+#include "event_queue.h"
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -11,24 +28,25 @@
 #define WIDTH 600
 #define HEIGHT 600
 
-#define FPS_MEASURE_LEN 120
+// Frame time percentiles cover tumbling window of this length, window title is updated when it completes
+#define STATS_WINDOW_MS 500
 
-typedef struct FPSCounter {
-    float data[FPS_MEASURE_LEN];
-    float prev;
-    int i;
-} FPSCounter;
+// Upper bound of input thread sleep, see input loop
+#define INPUT_POLL_TIMEOUT_MS 50
 
-float fps_append_and_measure(FPSCounter *f, float m) {
-    float sum_prev = f->prev - f->data[f->i];
-    f->data[f->i] = m;
-    f->i++;
-    if (f->i == FPS_MEASURE_LEN) {
-        f->i = 0;
-    }
-    float new_sum = sum_prev + m;
-    f->prev = new_sum;
-    return new_sum / FPS_MEASURE_LEN;
+// Animation rate of idle mode when --fps is not given
+#define IDLE_DEFAULT_FPS 30
+
+static
+uint64_t diff_time_ns(struct timespec *t1) {
+    struct timespec t2;
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    uint64_t time_spent = (uint64_t)((t2.tv_sec - t1->tv_sec) * 1000000000 + (t2.tv_nsec - t1->tv_nsec));
+
+    *t1 = t2;
+
+    return time_spent;
 }
 
 float diff_time_ms(struct timespec *t1) {
@@ -43,152 +61,1323 @@ float diff_time_ms(struct timespec *t1) {
     return time_spent;
 }
 
-int main() {
-    // I want to see output before segmentation fault
-    setbuf(stdout, NULL);
+// Sleeps until absolute deadlines, so time spent in frame does not shift the schedule
+typedef struct FramePacer {
+    struct timespec deadline;
+    // Zero means no pacing
+    long period_ns;
+} FramePacer;
 
-    Display *display = XOpenDisplay(NULL);
+static
+void pacer_init(FramePacer *p, float target_fps) {
+    p->period_ns = target_fps > 0 ? (long)(1000000000.0f / target_fps) : 0;
+    clock_gettime(CLOCK_MONOTONIC, &p->deadline);
+}
 
-    if (display == NULL) {
-        fprintf(stderr, "Cannot open display\n");
+static
+void pacer_wait(FramePacer *p) {
+    if (p->period_ns == 0) {
+        return;
+    }
+
+    p->deadline.tv_nsec += p->period_ns;
+    while (p->deadline.tv_nsec >= 1000000000) {
+        p->deadline.tv_nsec -= 1000000000;
+        p->deadline.tv_sec++;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // More than a period behind, e.g. after stall, start new schedule instead of burst of catch-up frames
+    long behind_ns = (now.tv_sec - p->deadline.tv_sec) * 1000000000 + (now.tv_nsec - p->deadline.tv_nsec);
+    if (behind_ns > p->period_ns) {
+        p->deadline = now;
+        return;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &p->deadline, NULL) == EINTR) {
+    }
+}
+
+// Input and animation state, engine samples it right before writing per-frame data
+typedef struct AppState {
+    int width;
+    int height;
+
+    // Latest mouse state published by input thread, see mouse_pack
+    const atomic_uint_least64_t *mouse;
+
+    float min_cycle_ms;
+    float max_cycle_ms;
+    float accum_cycle;
+
+    struct timespec latch_timer;
+} AppState;
+
+// Position and inside flag in one word, so render thread never sees half of an update
+static
+uint64_t mouse_pack(int inside, int x, int y) {
+    return (uint64_t)(uint16_t)x | (uint64_t)(uint16_t)y << 16 | (uint64_t)(inside != 0) << 32;
+}
+
+static
+float app_latch(void *user) {
+    AppState *app = user;
+
+    float delta_ms = diff_time_ms(&app->latch_timer);
+
+    uint64_t mouse = atomic_load_explicit(app->mouse, memory_order_relaxed);
+    int mouse_inside = (int)(mouse >> 32) & 1;
+    int mouse_x = (int16_t)(mouse & 0xffff);
+    int mouse_y = (int16_t)(mouse >> 16 & 0xffff);
+
+    // oval distance
+    float alpha;
+    if (mouse_inside) {
+        float dx = app->width / 2.0f - mouse_x;
+        float dy = app->height / 2.0f - mouse_y;
+        float maxdx = (app->width / 2.0f) * (app->width / 2.0f);
+        float maxdy = (app->height / 2.0f) * (app->width / 2.0f);
+        float diag = dx * dx / maxdx + dy * dy / maxdy;
+
+        alpha = fmin(1.0f, diag);
+    } else {
+        alpha = 1.0f;
+    }
+
+    float cur_cycle = app->min_cycle_ms + (app->max_cycle_ms - app->min_cycle_ms) * alpha;
+
+    app->accum_cycle += delta_ms / cur_cycle;
+    if (app->accum_cycle > 1.0f) {
+        app->accum_cycle -= 1.0f;
+    }
+
+    return app->accum_cycle;
+}
+
+// Same animation speed as window with mouse outside, assuming 60 Hz
+static
+float headless_latch(void *user) {
+    float *cycle = user;
+
+    *cycle += 1000.0f / 60.0f / 5000.0f;
+    if (*cycle > 1.0f) {
+        *cycle -= 1.0f;
+    }
+
+    return *cycle;
+}
+
+static
+void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [--profile low-latency|max-throughput|power-save] [--present-mode MODE] [--image-count N]\n"
+                    "    [--device [index:|uuid:|name:]SPEC] [--validation] [--serial-init] [--bench-startup RUNS]\n"
+                    "    [--frames-in-flight N] [--fps TARGET] [--headless FRAMES [--dump FILE.ppm]] [--resize-stress FRAMES]\n"
+                    "    [--trace FILE.json] [--hitch-ms MS] [--mass N [--gpu-driven]] [--bench-mass MAX_N] [--cpu-mass N]\n"
+                    "    [--bench-vertex N] [--draws N] [--record-threads N] [--bench-record MAX_THREADS]\n"
+                    "    [--static-record] [--bench-static FRAMES] [--windows N [--bench-windows FRAMES]]\n"
+                    "    [--shared-queue] [--render-cpu CPU] [--render-priority P] [--idle]\n", argv0);
+    exit(1);
+}
+
+// Renders without display, so it measures pure render cost without compositor or vsync
+static
+void run_headless(const EngineConfig *config, int frames, const char *dump_path, float hitch_ms) {
+    Engine engine;
+    engine_init_headless(&engine, config, WIDTH, HEIGHT, 3);
+
+    struct timespec timer, frame_timer;
+    clock_gettime(CLOCK_MONOTONIC, &timer);
+    frame_timer = timer;
+
+    FrameStats stats;
+    frame_stats_init(&stats, STATS_WINDOW_MS, hitch_ms);
+
+    float cycle = 0;
+    for (int i = 0; i < frames; i++) {
+        engine_draw(&engine, headless_latch, &cycle);
+        frame_stats_add(&stats, diff_time_ns(&frame_timer));
+    }
+
+    float total_ms = diff_time_ms(&timer);
+    printf("Headless: %d frames in %.2f ms, %.3f ms/frame, %.2f FPS\n",
+        frames, (double) total_ms, (double) (total_ms / frames), (double) (frames * 1000.0f / total_ms));
+    frame_hist_print(&stats.run, "Headless frame time");
+
+    if (dump_path != NULL) {
+        unsigned char *pixels = malloc(WIDTH * HEIGHT * 4);
+        if (engine_readback(&engine, pixels)) {
+            FILE *file = fopen(dump_path, "wb");
+            if (!file) {
+                fprintf(stderr, "Failed to open file: %s\n", dump_path);
+                exit(1);
+            }
+
+            // Binary PPM, pixels are BGRA
+            fprintf(file, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+            for (int i = 0; i < WIDTH * HEIGHT; i++) {
+                unsigned char rgb[3] = {pixels[i * 4 + 2], pixels[i * 4 + 1], pixels[i * 4 + 0]};
+                fwrite(rgb, 1, 3, file);
+            }
+
+            fclose(file);
+            printf("Last frame written to %s\n", dump_path);
+        }
+        free(pixels);
+    }
+
+    engine_deinit(&engine);
+}
+
+// Instance counts grow by this factor from BENCH_MASS_MIN up to given maximum
+#define BENCH_MASS_MIN 1000
+#define BENCH_MASS_STEP 4
+#define BENCH_MASS_WARMUP_FRAMES 30
+#define BENCH_MASS_FRAMES 300
+
+// Headless sweep over mass instance counts, engine is recreated for every count
+// Frames in flight keep GPU busy, so once GPU bound CPU frame time is GPU throughput
+static
+void run_bench_mass(const EngineConfig *base_config, uint32_t max_count) {
+    EngineConfig config = *base_config;
+    // Overlay would add its own constant cost to every row
+    config.overlay = 0;
+
+    // Culling decides on GPU how many are drawn, so GPU driven rows count objects submitted to culling and
+    // not triangles drawn
+    printf("Mass geometry sweep, %s\n", config.gpu_driven ? "GPU driven with culling" : "static instances");
+    printf("%12s %10s %10s %10s %16s\n", config.gpu_driven ? "objects" : "triangles", "p50 ms", "p99 ms", "GPU ms",
+        config.gpu_driven ? "objects/s" : "triangles/s");
+
+    uint32_t count = BENCH_MASS_MIN < max_count ? BENCH_MASS_MIN : max_count;
+    for (;;) {
+        config.mass_count = count;
+
+        Engine engine;
+        engine_init_headless(&engine, &config, WIDTH, HEIGHT, 3);
+
+        float cycle = 0;
+        for (int i = 0; i < BENCH_MASS_WARMUP_FRAMES; i++) {
+            engine_draw(&engine, headless_latch, &cycle);
+        }
+
+        FrameStats stats;
+        frame_stats_init(&stats, STATS_WINDOW_MS, 0);
+
+        // Every completed frame is counted once, results lag frames in flight behind
+        double gpu_total_ms = 0;
+        uint64_t gpu_frames = 0;
+        uint64_t gpu_last_frame = UINT64_MAX;
+
+        struct timespec timer, frame_timer;
+        clock_gettime(CLOCK_MONOTONIC, &timer);
+        frame_timer = timer;
+
+        for (int i = 0; i < BENCH_MASS_FRAMES; i++) {
+            engine_draw(&engine, headless_latch, &cycle);
+            frame_stats_add(&stats, diff_time_ns(&frame_timer));
+
+            EngineGpuStats gpu;
+            engine_gpu_stats(&engine, &gpu);
+            if (gpu.gpu_time_ms >= 0 && gpu.frame_number != gpu_last_frame) {
+                gpu_total_ms += (double) gpu.gpu_time_ms;
+                gpu_frames++;
+                gpu_last_frame = gpu.frame_number;
+            }
+        }
+
+        float total_ms = diff_time_ms(&timer);
+
+        engine_deinit(&engine);
+
+        printf("%12u %10.3f %10.3f %10.3f %16.0f\n", count,
+            (double) frame_hist_percentile_ms(&stats.run, 0.5),
+            (double) frame_hist_percentile_ms(&stats.run, 0.99),
+            gpu_frames > 0 ? gpu_total_ms / gpu_frames : 0.0,
+            (double) count * BENCH_MASS_FRAMES * 1000.0 / (double) total_ms);
+
+        if (count >= max_count) {
+            break;
+        }
+        count = (uint64_t) count * BENCH_MASS_STEP < max_count ? count * BENCH_MASS_STEP : max_count;
+    }
+}
+
+// Scene of recording sweep unless --mass, --cpu-mass or --draws say otherwise
+#define BENCH_RECORD_MASS 100000
+#define BENCH_RECORD_DRAWS 20000
+#define BENCH_RECORD_WARMUP_FRAMES 30
+#define BENCH_RECORD_FRAMES 300
+
+// Headless sweep over recording threads 1, 2, 4 up to given maximum, engine is recreated for every count
+static
+void run_bench_record(const EngineConfig *base_config, uint32_t max_threads) {
+    EngineConfig config = *base_config;
+    config.overlay = 0;
+    if (config.mass_count == 0 && config.cpu_mass_count == 0) {
+        config.mass_count = BENCH_RECORD_MASS;
+    }
+    if (config.draw_count <= 1) {
+        config.draw_count = BENCH_RECORD_DRAWS;
+    }
+
+    printf("Parallel recording sweep, %u draws\n", config.draw_count);
+    printf("%8s %14s %10s %10s\n", "threads", "record ms", "speedup", "p50 ms");
+
+    double single_ms = 0;
+    uint32_t threads = 1;
+    for (;;) {
+        config.record_threads = threads;
+
+        Engine engine;
+        engine_init_headless(&engine, &config, WIDTH, HEIGHT, 3);
+
+        float cycle = 0;
+        for (int i = 0; i < BENCH_RECORD_WARMUP_FRAMES; i++) {
+            engine_draw(&engine, headless_latch, &cycle);
+        }
+
+        EngineRecordStats before;
+        engine_record_stats(&engine, &before);
+
+        FrameStats stats;
+        frame_stats_init(&stats, STATS_WINDOW_MS, 0);
+
+        struct timespec frame_timer;
+        clock_gettime(CLOCK_MONOTONIC, &frame_timer);
+
+        for (int i = 0; i < BENCH_RECORD_FRAMES; i++) {
+            engine_draw(&engine, headless_latch, &cycle);
+            frame_stats_add(&stats, diff_time_ns(&frame_timer));
+        }
+
+        EngineRecordStats after;
+        engine_record_stats(&engine, &after);
+
+        engine_deinit(&engine);
+
+        double record_ms = (after.total_ms - before.total_ms) / (double) (after.frames - before.frames);
+        if (threads == 1) {
+            single_ms = record_ms;
+        }
+
+        printf("%8u %14.3f %10.2f %10.3f\n", after.record_threads, record_ms, single_ms / record_ms,
+            (double) frame_hist_percentile_ms(&stats.run, 0.5));
+
+        if (threads >= max_threads || threads >= ENGINE_MAX_RECORD_THREADS) {
+            break;
+        }
+        threads = threads * 2 < max_threads ? threads * 2 : max_threads;
+    }
+}
+
+// Scene of static recording comparison unless --mass, --cpu-mass or --draws say otherwise
+#define BENCH_STATIC_MASS 100000
+#define BENCH_STATIC_DRAWS 20000
+
+static
+uint64_t thread_cpu_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec;
+}
+
+// Headless per frame CPU cost of recording every frame against reusing static recordings, same scene,
+// resize halfway through checks that stale recordings are recorded again
+static
+void run_bench_static(const EngineConfig *base_config, int frames) {
+    EngineConfig config = *base_config;
+    config.gpu_driven = 0;
+    config.record_threads = 1;
+    if (config.mass_count == 0 && config.cpu_mass_count == 0) {
+        config.mass_count = BENCH_STATIC_MASS;
+    }
+    if (config.draw_count <= 1) {
+        config.draw_count = BENCH_STATIC_DRAWS;
+    }
+
+    printf("Static recording comparison, %u draws, %d frames\n", config.draw_count, frames);
+    printf("%8s %12s %14s %10s %10s %10s\n", "mode", "record ms", "frame CPU ms", "p50 ms", "recorded", "reused");
+
+    for (int mode = 0; mode < 2; mode++) {
+        config.static_recording = mode;
+
+        Engine engine;
+        engine_init_headless(&engine, &config, WIDTH, HEIGHT, 3);
+
+        float cycle = 0;
+        for (int i = 0; i < BENCH_RECORD_WARMUP_FRAMES; i++) {
+            engine_draw(&engine, headless_latch, &cycle);
+        }
+
+        EngineRecordStats before;
+        engine_record_stats(&engine, &before);
+
+        FrameStats stats;
+        frame_stats_init(&stats, STATS_WINDOW_MS, 0);
+
+        uint64_t cpu_total_ns = 0;
+        for (int i = 0; i < frames; i++) {
+            if (i == frames / 2) {
+                engine_signal_resize(&engine, WIDTH / 2, HEIGHT / 2);
+            }
+
+            uint64_t cpu_start_ns = thread_cpu_ns();
+            engine_draw(&engine, headless_latch, &cycle);
+            uint64_t cpu_ns = thread_cpu_ns() - cpu_start_ns;
+
+            cpu_total_ns += cpu_ns;
+            frame_stats_add(&stats, cpu_ns);
+        }
+
+        EngineRecordStats after;
+        engine_record_stats(&engine, &after);
+
+        int enabled = engine.static_recording;
+        engine_deinit(&engine);
+
+        double record_ms = (after.total_ms - before.total_ms) / (double) (after.frames - before.frames);
+        printf("%8s %12.3f %14.3f %10.3f %10lu %10lu\n", enabled ? "static" : "dynamic", record_ms,
+            cpu_total_ns / 1000000.0 / frames, (double) frame_hist_percentile_ms(&stats.run, 0.5),
+            (unsigned long)(after.static_recorded - before.static_recorded),
+            (unsigned long)(after.static_reused - before.static_reused));
+    }
+}
+
+#define BENCH_STARTUP_MASS 1000000
+
+// Headless engine_init and first frame with pipelines created in order and on worker thread, first run of
+// each mode is not counted, it warms driver, pipeline cache file and device cache file
+static
+void run_bench_startup(const EngineConfig *base_config, int runs) {
+    EngineConfig config = *base_config;
+    if (config.mass_count == 0 && config.cpu_mass_count == 0) {
+        config.mass_count = BENCH_STARTUP_MASS;
+    }
+
+    double init_ms[2] = {0, 0};
+    double first_frame_ms[2] = {0, 0};
+    double min_first_frame_ms[2] = {0, 0};
+    double pipelines_ms[2] = {0, 0};
+
+    for (int mode = 0; mode < 2; mode++) {
+        config.parallel_init = mode;
+
+        for (int run = 0; run <= runs; run++) {
+            Engine engine;
+            engine_init_headless(&engine, &config, WIDTH, HEIGHT, 3);
+
+            float cycle = 0;
+            engine_draw(&engine, headless_latch, &cycle);
+
+            EngineInitStats stats;
+            engine_init_stats(&engine, &stats);
+            engine_deinit(&engine);
+
+            if (run == 0) {
+                continue;
+            }
+
+            init_ms[mode] += stats.total_ms;
+            first_frame_ms[mode] += stats.first_frame_ms;
+            pipelines_ms[mode] += stats.pipelines_ms;
+            if (run == 1 || stats.first_frame_ms < min_first_frame_ms[mode]) {
+                min_first_frame_ms[mode] = stats.first_frame_ms;
+            }
+        }
+    }
+
+    printf("Startup comparison, %u mass instances, %d runs\n", config.mass_count, runs);
+    printf("%10s %10s %12s %16s %16s\n", "mode", "init ms", "pipelines ms", "first frame ms", "min first ms");
+    for (int mode = 0; mode < 2; mode++) {
+        printf("%10s %10.3f %12.3f %16.3f %16.3f\n", mode ? "parallel" : "serial", init_ms[mode] / runs,
+            pipelines_ms[mode] / runs, first_frame_ms[mode] / runs, min_first_frame_ms[mode]);
+    }
+    printf("Time to first frame cut: %.1f%%\n",
+        100.0 * (1.0 - first_frame_ms[1] / first_frame_ms[0]));
+}
+
+// Accuracy check against libm first, timing of broken kernel is meaningless
+static
+int run_bench_vertex(uint32_t count) {
+    ThreadPool pool;
+    thread_pool_init(&pool, 0);
+
+    int ok = vertex_kernel_check(&pool);
+    if (ok) {
+        vertex_kernel_bench(&pool, count);
+    }
+
+    thread_pool_deinit(&pool);
+    return ok;
+}
+
+// Set from SIGUSR1, trace is written from render loop, not from handler
+static volatile sig_atomic_t trace_requested = 0;
+// Render wake eventfd, so suspended idle render thread serves request too, -1 until it exists
+static volatile sig_atomic_t trace_wake_fd = -1;
+
+static
+void trace_signal_handler(int sig) {
+    (void)sig;
+    trace_requested = 1;
+
+    // write is async signal safe, errno is kept for code interrupted by signal
+    if (trace_wake_fd >= 0) {
+        int saved_errno = errno;
+        uint64_t one = 1;
+        if (write(trace_wake_fd, &one, sizeof(one)) < 0) {
+            // Counter overflow only, render thread is awake then anyway
+        }
+        errno = saved_errno;
+    }
+}
+
+// Window is owned by input thread, engine by render thread, this is everything between them
+typedef struct RenderShared {
+    Display *display;
+    Window window;
+    // Rendered by same engine as main window, see engine_add_window
+    Window extra_windows[ENGINE_MAX_VIEWS];
+    uint32_t extra_window_count;
+    // Measure per-window frame rate over this many frames and exit
+    int bench_windows_frames;
+    EngineConfig config;
+    float target_fps;
+    float hitch_ms;
+    int resize_stress_frames;
+    const char *trace_path;
+    // Negative leaves render thread wherever scheduler puts it
+    int render_cpu;
+    // Positive is SCHED_FIFO priority, negative is nice value, zero keeps default
+    int render_priority;
+    // Render thread sleeps until animation timer or window event, draws nothing while window is hidden
+    int idle;
+
+    // Input to render, discrete events in order, mouse as latest snapshot, see mouse_pack
+    EventQueue events;
+    atomic_uint_least64_t mouse;
+    // Written after every queued event, idle render thread sleeps on it
+    int render_wake_fd;
+
+    // Render to input, X requests are made by input thread, eventfd wakes it from poll
+    pthread_mutex_t mutex;
+    int wake_fd;
+    char title[96];
+    int title_pending;
+    int resize_width;
+    int resize_height;
+    int resize_pending;
+    int render_done;
+} RenderShared;
+
+static
+void render_wake_input(RenderShared *shared) {
+    uint64_t one = 1;
+    // EAGAIN means counter is full, input thread is woken anyway
+    if (write(shared->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "eventfd write failed: %s\n", strerror(errno));
+    }
+}
+
+// Render thread drains queue every frame, so full queue waits at most for a frame, unless render thread is gone
+static
+void input_push(RenderShared *shared, const AppEvent *event) {
+    while (!event_queue_push(&shared->events, event)) {
+        pthread_mutex_lock(&shared->mutex);
+        int render_done = shared->render_done;
+        pthread_mutex_unlock(&shared->mutex);
+        if (render_done) {
+            return;
+        }
+
+        struct timespec delay = {.tv_sec = 0, .tv_nsec = 1000000};
+        nanosleep(&delay, NULL);
+    }
+
+    uint64_t one = 1;
+    if (write(shared->render_wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "eventfd write failed: %s\n", strerror(errno));
+    }
+}
+
+// Counter of eventfd or timerfd, zero if it was not signaled, fd must be non-blocking
+static
+uint64_t fd_drain(int fd) {
+    uint64_t count = 0;
+    if (read(fd, &count, sizeof(count)) < 0) {
+        return 0;
+    }
+    return count;
+}
+
+// Periodic from one period after now, zero period disarms
+static
+void idle_timer_set(int timer_fd, long period_ns) {
+    struct itimerspec spec = {0};
+    if (period_ns > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &spec.it_value);
+        spec.it_value.tv_nsec += period_ns;
+        while (spec.it_value.tv_nsec >= 1000000000) {
+            spec.it_value.tv_nsec -= 1000000000;
+            spec.it_value.tv_sec++;
+        }
+        spec.it_interval.tv_sec = period_ns / 1000000000;
+        spec.it_interval.tv_nsec = period_ns % 1000000000;
+    }
+
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+        fprintf(stderr, "timerfd_settime failed: %s\n", strerror(errno));
         exit(1);
     }
+}
 
-    Window root = DefaultRootWindow(display);
+typedef struct IdleStats {
+    uint64_t timer_frames;
+    uint64_t event_frames;
+    uint64_t wakeups;
+    uint64_t suspended_ns;
+} IdleStats;
 
-    // Create an X11 window
-    XSetWindowAttributes attributes;
-    attributes.event_mask = ExposureMask | KeyPressMask | StructureNotifyMask
-                            | PointerMotionMask | EnterWindowMask | LeaveWindowMask;
+static
+uint64_t monotonic_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+}
 
-    Window window = XCreateWindow(display, root, 0, 0, WIDTH, HEIGHT, 1, CopyFromParent,
-                                  InputOutput, CopyFromParent, CWEventMask, &attributes);
+static
+double timespec_diff_s(const struct timespec *t0, const struct timespec *t1) {
+    return (double) (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
 
-    XMapWindow(display, window);
-    XStoreName(display, window, "Vulkan Window");
+static
+double rusage_cpu_s(const struct rusage *usage) {
+    return (double) (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec)
+        + (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1e6;
+}
 
-    Atom WM_PROTOCOLS = XInternAtom(display, "WM_PROTOCOLS", False);
-    Atom WM_DELETE_WINDOW = XInternAtom(display, "WM_DELETE_WINDOW", False);
-    XSetWMProtocols(display, window, &WM_DELETE_WINDOW, 1);
+// Failures are reported and ignored, realtime priority usually needs CAP_SYS_NICE or RLIMIT_RTPRIO
+static
+void render_thread_setup(const RenderShared *shared) {
+    if (shared->render_cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(shared->render_cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            fprintf(stderr, "Render thread affinity to CPU %d failed: %s\n", shared->render_cpu, strerror(err));
+        } else {
+            printf("Render thread pinned to CPU %d\n", shared->render_cpu);
+        }
+    }
+
+    if (shared->render_priority > 0) {
+        struct sched_param param = {.sched_priority = shared->render_priority};
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            fprintf(stderr, "Render thread SCHED_FIFO priority %d failed: %s\n", shared->render_priority, strerror(err));
+        } else {
+            printf("Render thread SCHED_FIFO priority %d\n", shared->render_priority);
+        }
+    } else if (shared->render_priority < 0) {
+        // Nice value is per thread on Linux
+        if (setpriority(PRIO_PROCESS, (id_t)gettid(), shared->render_priority) != 0) {
+            fprintf(stderr, "Render thread nice %d failed: %s\n", shared->render_priority, strerror(errno));
+        } else {
+            printf("Render thread nice %d\n", shared->render_priority);
+        }
+    }
+}
+
+// RENDER thread, pacing, frame stats and engine_draw, window requests go back to input thread
+static
+void *render_thread_main(void *arg) {
+    RenderShared *shared = arg;
+
+    profiler_thread_name("render");
 
     Engine engine;
-    engine_init_xlib(&engine, WIDTH, HEIGHT, display, window);    
+    engine_init_xlib(&engine, &shared->config, WIDTH, HEIGHT, shared->display, shared->window);
+    for (uint32_t i = 0; i < shared->extra_window_count; i++) {
+        engine_add_window(&engine, shared->display, shared->extra_windows[i]);
+    }
 
-    struct timespec delta_timer, debug_timer;
+    // After engine init, so engine pool workers do not inherit pinning and priority
+    render_thread_setup(shared);
+
+    struct timespec delta_timer;
     clock_gettime(CLOCK_MONOTONIC, &delta_timer);
-    clock_gettime(CLOCK_MONOTONIC, &debug_timer); 
 
-    // struct timespec sleep_t = {
-    //     .tv_nsec = 1 * 1000000,
-    // };
+    FramePacer pacer;
+    pacer_init(&pacer, shared->target_fps);
 
-    FPSCounter counter = {0};
+    FrameStats stats;
+    frame_stats_init(&stats, STATS_WINDOW_MS, shared->hitch_ms);
 
     int running = 1;
 
-    int width = WIDTH;
-    int height = HEIGHT;
+    AppState app = {
+        .width = WIDTH,
+        .height = HEIGHT,
+        .mouse = &shared->mouse,
+        .min_cycle_ms = 500,
+        .max_cycle_ms = 5000,
+        .accum_cycle = 0,
+    };
+    clock_gettime(CLOCK_MONOTONIC, &app.latch_timer);
 
-    float min_cycle_ms = 500;
-    float max_cycle_ms = 5000;
+    int frame_stats_started = 0;
 
-    float accum_cycle = 0;
-    float cur_cycle = max_cycle_ms;
+    int resize_stress_frames = shared->resize_stress_frames;
+    int frame = 0;
+    // Index 0 is old rebuild path which waits for idle, 1 is retiring one
+    float worst_frame_ms[2] = {0};
+    float total_frame_ms[2] = {0};
+    int path_frames[2] = {0};
 
-    int mouse_inside = 0;
-    int mouse_x = 0;
-    int mouse_y = 0;
+    // Presents are counted by engine per window, first frame includes startup and is left out
+    int bench_windows_frames = shared->bench_windows_frames;
+    int bench_frame = 0;
+    uint64_t bench_start_ns = 0;
+    uint64_t bench_start_presents[1 + ENGINE_MAX_VIEWS];
+
+    // IDLE mode, frame is drawn for animation timer tick or for event which changed window, timer is disarmed
+    // while window is unmapped or fully obscured, so then only window events wake thread
+    long idle_period_ns = (long) (1000000000.0f / (shared->target_fps > 0 ? shared->target_fps : IDLE_DEFAULT_FPS));
+    int timer_fd = -1;
+    int mapped = 1;
+    int visible = 1;
+    int shown = 1;
+    uint64_t suspend_start_ns = 0;
+    IdleStats idle_stats = {0};
+    if (shared->idle) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd < 0) {
+            fprintf(stderr, "timerfd_create failed: %s\n", strerror(errno));
+            exit(1);
+        }
+        idle_timer_set(timer_fd, idle_period_ns);
+        printf("Idle rendering, animation at %.1f FPS\n", 1e9 / (double) idle_period_ns);
+    }
 
-    char window_title[32];
+    // CPU time is reported for loop only, init costs the same in every mode
+    struct timespec loop_wall_start, loop_cpu_start;
+    clock_gettime(CLOCK_MONOTONIC, &loop_wall_start);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &loop_cpu_start);
+    struct rusage loop_usage_start;
+    getrusage(RUSAGE_SELF, &loop_usage_start);
 
     while (running) {
-        float delta_ms = diff_time_ms(&delta_timer);
-        // float render_ms = diff_time_ms(&debug_timer);
-        // printf("render_ms %.2f ms\n", render_ms);
-        // printf("Time elapsed: %.2f ms\n", delta_ms);
+        // Sleep first, so events drained below and state latched in engine_draw are as fresh as possible
+        int timer_tick = 0;
+        if (shared->idle) {
+            PROFILE_BEGIN("idle wait");
+            struct pollfd fds[2] = {
+                {.fd = shared->render_wake_fd, .events = POLLIN},
+                {.fd = timer_fd, .events = POLLIN},
+            };
+            poll(fds, 2, -1);
+            PROFILE_END();
 
-        {
-            XTextProperty title;
-            float val = fps_append_and_measure(&counter, 1000.0f / delta_ms);
-            snprintf(window_title, sizeof(window_title), "FPS: %.2f", (double) val);
-            char *list[] = {window_title};
-            XStringListToTextProperty(list, 1, &title);
-            XSetWMName(display, window, &title);
-            XFree(title.value);
+            idle_stats.wakeups++;
+            fd_drain(shared->render_wake_fd);
+            timer_tick = fd_drain(timer_fd) > 0;
+        } else {
+            pacer_wait(&pacer);
         }
 
-        // oval distance
-        {
-            float alpha;
+        PROFILE_BEGIN("event drain");
+        int window_changed = 0;
+        AppEvent event;
+        while (event_queue_pop(&shared->events, &event)) {
+            if (event.type == APP_EVENT_KEY || event.type == APP_EVENT_QUIT) {
+                running = 0;
+                break;
+            } else if (event.type == APP_EVENT_RESIZE && event.window > 0) {
+                engine_signal_window_resize(&engine, event.window, event.width, event.height);
+            } else if (event.type == APP_EVENT_RESIZE) {
+                app.width = event.width;
+                app.height = event.height;
+                engine_signal_resize(&engine, app.width, app.height);
+                window_changed = 1;
+            } else if (event.type == APP_EVENT_EXPOSE) {
+                window_changed = 1;
+            } else if (event.type == APP_EVENT_VISIBILITY) {
+                visible = event.state;
+            } else if (event.type == APP_EVENT_MAP) {
+                mapped = event.state;
+            }
+        }
+        PROFILE_END();
 
-            if (mouse_inside) {
-                float dx = width / 2.0f - mouse_x;
-                float dy = height / 2.0f - mouse_y;
-                float maxdx = (width / 2.0f) * (width / 2.0f);
-                float maxdy = (height / 2.0f) * (width / 2.0f);
-                float diag = dx * dx / maxdx + dy * dy / maxdy;
+        if (!running) {
+            break;
+        }
+
+        // Before idle skip, so trace is written while rendering is suspended as well
+        if (trace_requested) {
+            trace_requested = 0;
+            if (shared->trace_path != NULL) {
+                profiler_dump(shared->trace_path);
+            }
+        }
+
+        if (shared->idle) {
+            if (shown != (mapped && visible)) {
+                shown = mapped && visible;
+                idle_timer_set(timer_fd, shown ? idle_period_ns : 0);
+                if (shown) {
+                    idle_stats.suspended_ns += monotonic_ns() - suspend_start_ns;
+                    window_changed = 1;
+                } else {
+                    suspend_start_ns = monotonic_ns();
+                }
+            }
 
-                alpha = fmin(1.0f, diag);
+            if (!shown || !(timer_tick || window_changed)) {
+                continue;
+            }
+            if (timer_tick) {
+                idle_stats.timer_frames++;
             } else {
-                alpha = 1.0f;
+                idle_stats.event_frames++;
+            }
+        }
+
+        uint64_t delta_ns = diff_time_ns(&delta_timer);
+        float delta_ms = delta_ns / 1000000.0f;
+
+        if (resize_stress_frames > 0) {
+            // First half rebuilds the old way, second half retires old swapchain, with same resize sequence
+            int path = frame > resize_stress_frames / 2;
+            engine.config.resize_wait_idle = !path;
+
+            // First frame includes startup, not interesting
+            if (frame > 0) {
+                worst_frame_ms[path] = fmaxf(worst_frame_ms[path], delta_ms);
+                total_frame_ms[path] += delta_ms;
+                path_frames[path]++;
+            }
+
+            if (frame == resize_stress_frames) {
+                static const char *path_names[2] = {"wait idle", "retire"};
+                for (int p = 0; p < 2; p++) {
+                    printf("Resize stress %s: %d frames, avg %.3f ms, worst %.3f ms\n", path_names[p], path_frames[p],
+                        (double) (total_frame_ms[p] / (path_frames[p] > 0 ? path_frames[p] : 1)),
+                        (double) worst_frame_ms[p]);
+                }
+                break;
             }
 
-            cur_cycle = min_cycle_ms + (max_cycle_ms - min_cycle_ms) * alpha;
+            // Resize every few frames, so both resize and steady frames are measured
+            if (frame % 4 == 0) {
+                int step = frame / 4;
+                pthread_mutex_lock(&shared->mutex);
+                shared->resize_width = WIDTH - 200 + (step * 37) % 400;
+                shared->resize_height = HEIGHT - 200 + (step * 53) % 400;
+                shared->resize_pending = 1;
+                pthread_mutex_unlock(&shared->mutex);
+                render_wake_input(shared);
+            }
+
+            frame++;
+        }
+
+        if (bench_windows_frames > 0) {
+            if (bench_frame == 1) {
+                bench_start_ns = monotonic_ns();
+                for (uint32_t w = 0; w <= shared->extra_window_count; w++) {
+                    bench_start_presents[w] = engine_window_presents(&engine, w);
+                }
+            }
+
+            if (bench_frame == bench_windows_frames + 1) {
+                double wall_s = (monotonic_ns() - bench_start_ns) / 1e9;
+                double total_fps = 0;
+                printf("Windows: %u, %d frames over %.3f s\n", shared->extra_window_count + 1, bench_windows_frames, wall_s);
+                for (uint32_t w = 0; w <= shared->extra_window_count; w++) {
+                    double fps = (engine_window_presents(&engine, w) - bench_start_presents[w]) / wall_s;
+                    total_fps += fps;
+                    printf("Window %u: %.1f FPS\n", w, fps);
+                }
+                printf("Aggregate: %.1f FPS\n", total_fps);
+                break;
+            }
+
+            bench_frame++;
+        }
+
+        if (frame_stats_started) {
+            engine_overlay_frame_time(&engine, delta_ms);
+        }
+
+        // First delta is startup, not a frame. Text is formatted only when window completes,
+        // title is an X request and property change for window manager, so it must not happen per frame
+        if (frame_stats_started && frame_stats_add(&stats, delta_ns)) {
+            EngineGpuStats gpu_stats;
+            engine_gpu_stats(&engine, &gpu_stats);
+
+            char overlay_text[OVERLAY_TEXT_SIZE];
+            snprintf(overlay_text, sizeof(overlay_text), "FPS %.1f\nP50 %.2f MS\nP99 %.2f MS\nMAX %.2f MS\nGPU %.3f MS\nHITCHES %lu",
+                (double) (1000.0f / frame_hist_mean_ms(&stats.last_window)),
+                (double) frame_hist_percentile_ms(&stats.last_window, 0.5),
+                (double) frame_hist_percentile_ms(&stats.last_window, 0.99),
+                (double) stats.last_window.max_us / 1000.0, (double) gpu_stats.gpu_time_ms,
+                (unsigned long) stats.run.hitches);
+            engine_overlay_text(&engine, overlay_text);
+
+            pthread_mutex_lock(&shared->mutex);
+            snprintf(shared->title, sizeof(shared->title), "FPS: %.1f p50: %.2f p99: %.2f ms GPU: %.3f ms",
+                (double) (1000.0f / frame_hist_mean_ms(&stats.last_window)),
+                (double) frame_hist_percentile_ms(&stats.last_window, 0.5),
+                (double) frame_hist_percentile_ms(&stats.last_window, 0.99), (double) gpu_stats.gpu_time_ms);
+            shared->title_pending = 1;
+            pthread_mutex_unlock(&shared->mutex);
+            render_wake_input(shared);
+        }
+
+        // Mouse and animation cycle are latched inside, after fence wait and image acquire
+        PROFILE_BEGIN("frame");
+        engine_draw(&engine, app_latch, &app);
+        PROFILE_END();
+
+        frame_stats_started = 1;
+    }
+
+    frame_hist_print(&stats.run, "Frame time");
+
+    struct timespec wall_end, cpu_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    struct rusage usage_end;
+    getrusage(RUSAGE_SELF, &usage_end);
+
+    // Process time includes input thread and driver threads
+    double wall_s = timespec_diff_s(&loop_wall_start, &wall_end);
+    double process_s = rusage_cpu_s(&usage_end) - rusage_cpu_s(&loop_usage_start);
+    printf("CPU time: render thread %.3f s, process %.3f s over %.3f s wall, %.1f%% of one core\n",
+        timespec_diff_s(&loop_cpu_start, &cpu_end), process_s, wall_s, 100.0 * process_s / wall_s);
+
+    if (shared->idle) {
+        if (!shown) {
+            idle_stats.suspended_ns += monotonic_ns() - suspend_start_ns;
+        }
+        printf("Idle: %lu wakeups, %lu frames for animation, %lu for window events, %.3f s suspended\n",
+            (unsigned long) idle_stats.wakeups, (unsigned long) idle_stats.timer_frames,
+            (unsigned long) idle_stats.event_frames, idle_stats.suspended_ns / 1e9);
+
+        // Baseline is estimate, not second run: continuous loop at animation rate draws every period, also
+        // while suspended, at process CPU cost per frame measured here. Uncapped run without --idle draws
+        // more frames than that, so real saving against it is larger
+        uint64_t drawn = idle_stats.timer_frames + idle_stats.event_frames;
+        if (drawn > 0) {
+            double continuous_frames = wall_s * 1e9 / (double) idle_period_ns;
+            double baseline_s = process_s / (double) drawn * continuous_frames;
+            printf("Idle CPU time saved: %.3f s of estimated %.3f s for %.0f continuous frames at animation rate, %.1f%%\n",
+                baseline_s - process_s, baseline_s, continuous_frames,
+                baseline_s > 0 ? 100.0 * (baseline_s - process_s) / baseline_s : 0.0);
+        }
+        close(timer_fd);
+    }
+
+    engine_deinit(&engine);
+
+    pthread_mutex_lock(&shared->mutex);
+    shared->render_done = 1;
+    pthread_mutex_unlock(&shared->mutex);
+    render_wake_input(shared);
+
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    // I want to see output before segmentation fault
+    setbuf(stdout, NULL);
+
+    // Defaults, then environment, then command line, so the last one wins
+    EngineConfig config;
+    engine_config_default(&config);
+    engine_config_from_env(&config);
+
+    int headless_frames = 0;
+    const char *dump_path = NULL;
+    // Scripted window resizes for given number of frames, e.g. under Xvfb, reports worst frame time
+    int resize_stress_frames = 0;
+    // Zero renders as fast as engine_draw returns
+    float target_fps = 0;
+    // Zero counts frames longer than twice median of last complete stats window as hitches
+    float hitch_ms = 0;
+    // Sweep instance counts up to this one and exit
+    uint32_t bench_mass_max = 0;
+    // Check and time vertex kernel on this many vertices and exit
+    uint32_t bench_vertex_count = 0;
+    // Sweep recording threads up to this count and exit
+    uint32_t bench_record_max = 0;
+    int bench_static_frames = 0;
+    // Headless engine startups per mode, serial against parallel init
+    int bench_startup_runs = 0;
+    // Main window and extra ones, all drawn by one engine
+    int window_count = 1;
+    int bench_windows_frames = 0;
+    // Render thread pinning, -1 is none, and priority, see RenderShared
+    int render_cpu = -1;
+    int render_priority = 0;
+    // Draw only for animation timer and window events, see RenderShared
+    int idle = 0;
+    // Profiler is enabled when trace path is given
+    const char *trace_path = getenv("ENGINE_TRACE");
+
+    // Profile first, so separate options can adjust it regardless of order
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--profile") == 0 && !engine_config_apply_profile(&config, argv[i + 1])) {
+            fprintf(stderr, "Unknown profile: %s\n", argv[i + 1]);
+            usage(argv[0]);
         }
+    }
 
-        accum_cycle += delta_ms / cur_cycle;
-        if (accum_cycle > 1.0f) {
-            accum_cycle -= 1.0f;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            i++;
+        } else if (strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc) {
+            if (!engine_present_mode_parse(argv[++i], &config.present_mode)) {
+                fprintf(stderr, "Unknown present mode: %s\n", argv[i]);
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--image-count") == 0 && i + 1 < argc) {
+            config.image_count = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+            config.frames_in_flight = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--validation") == 0) {
+            config.validation = 1;
+        } else if (strcmp(argv[i], "--serial-init") == 0) {
+            config.parallel_init = 0;
+        } else if (strcmp(argv[i], "--bench-startup") == 0 && i + 1 < argc) {
+            bench_startup_runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+            config.device = argv[++i];
+        } else if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+            headless_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_path = argv[++i];
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            target_fps = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--resize-stress") == 0 && i + 1 < argc) {
+            resize_stress_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hitch-ms") == 0 && i + 1 < argc) {
+            hitch_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--mass") == 0 && i + 1 < argc) {
+            config.mass_count = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--gpu-driven") == 0) {
+            config.gpu_driven = 1;
+        } else if (strcmp(argv[i], "--bench-mass") == 0 && i + 1 < argc) {
+            bench_mass_max = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cpu-mass") == 0 && i + 1 < argc) {
+            config.cpu_mass_count = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-vertex") == 0 && i + 1 < argc) {
+            bench_vertex_count = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--draws") == 0 && i + 1 < argc) {
+            config.draw_count = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--record-threads") == 0 && i + 1 < argc) {
+            config.record_threads = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-record") == 0 && i + 1 < argc) {
+            bench_record_max = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--shared-queue") == 0) {
+            config.dedicated_queues = 0;
+        } else if (strcmp(argv[i], "--static-record") == 0) {
+            config.static_recording = 1;
+        } else if (strcmp(argv[i], "--bench-static") == 0 && i + 1 < argc) {
+            bench_static_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--windows") == 0 && i + 1 < argc) {
+            window_count = atoi(argv[++i]);
+            if (window_count < 1 || window_count > 1 + ENGINE_MAX_VIEWS) {
+                fprintf(stderr, "Window count must be in [1, %d]\n", 1 + ENGINE_MAX_VIEWS);
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--bench-windows") == 0 && i + 1 < argc) {
+            bench_windows_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--render-cpu") == 0 && i + 1 < argc) {
+            render_cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--render-priority") == 0 && i + 1 < argc) {
+            render_priority = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--idle") == 0) {
+            idle = 1;
+        } else {
+            usage(argv[0]);
         }
+    }
+
+    if (trace_path != NULL && trace_path[0] == '\0') {
+        trace_path = NULL;
+    }
+    profiler_init(trace_path != NULL, trace_path);
+    profiler_thread_name("main");
+    signal(SIGUSR1, trace_signal_handler);
+
+    if (bench_vertex_count > 0) {
+        int ok = run_bench_vertex(bench_vertex_count);
+        profiler_deinit();
+        return ok ? 0 : 1;
+    }
+
+    if (bench_record_max > 0) {
+        run_bench_record(&config, bench_record_max);
+        profiler_deinit();
+        return 0;
+    }
+
+    if (bench_static_frames > 0) {
+        run_bench_static(&config, bench_static_frames);
+        profiler_deinit();
+        return 0;
+    }
+
+    if (bench_startup_runs > 0) {
+        run_bench_startup(&config, bench_startup_runs);
+        profiler_deinit();
+        return 0;
+    }
+
+    if (bench_mass_max > 0) {
+        run_bench_mass(&config, bench_mass_max);
+        profiler_deinit();
+        return 0;
+    }
+
+    if (headless_frames > 0) {
+        run_headless(&config, headless_frames, dump_path, hitch_ms);
+        profiler_deinit();
+        return 0;
+    }
+
+    // Render thread presents through Vulkan WSI on same Display, Xlib must lock it
+    if (!XInitThreads()) {
+        fprintf(stderr, "XInitThreads failed\n");
+        exit(1);
+    }
+
+    Display *display = XOpenDisplay(NULL);
+
+    if (display == NULL) {
+        fprintf(stderr, "Cannot open display\n");
+        exit(1);
+    }
+
+    Window root = DefaultRootWindow(display);
+
+    // Create an X11 window
+    XSetWindowAttributes attributes;
+    attributes.event_mask = ExposureMask | KeyPressMask | StructureNotifyMask | VisibilityChangeMask
+                            | PointerMotionMask | EnterWindowMask | LeaveWindowMask;
+
+    Window window = XCreateWindow(display, root, 0, 0, WIDTH, HEIGHT, 1, CopyFromParent,
+                                  InputOutput, CopyFromParent, CWEventMask, &attributes);
+
+    XMapWindow(display, window);
+    XStoreName(display, window, "Vulkan Window");
+
+    Atom WM_PROTOCOLS = XInternAtom(display, "WM_PROTOCOLS", False);
+    Atom WM_DELETE_WINDOW = XInternAtom(display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(display, window, &WM_DELETE_WINDOW, 1);
+
+    // Cascaded, so all of them are visible and none is fully obscured
+    Window extra_windows[ENGINE_MAX_VIEWS];
+    uint32_t extra_window_count = (uint32_t)window_count - 1;
+    for (uint32_t i = 0; i < extra_window_count; i++) {
+        int offset = (int)(i + 1) * 40;
+        extra_windows[i] = XCreateWindow(display, root, offset, offset, WIDTH, HEIGHT, 1, CopyFromParent,
+                                         InputOutput, CopyFromParent, CWEventMask, &attributes);
+
+        char name[32];
+        snprintf(name, sizeof(name), "Vulkan Window %u", i + 1);
+        XMapWindow(display, extra_windows[i]);
+        XStoreName(display, extra_windows[i], name);
+        XSetWMProtocols(display, extra_windows[i], &WM_DELETE_WINDOW, 1);
+    }
+
+    RenderShared shared = {
+        .display = display,
+        .window = window,
+        .extra_window_count = extra_window_count,
+        .bench_windows_frames = bench_windows_frames,
+        .config = config,
+        .target_fps = target_fps,
+        .hitch_ms = hitch_ms,
+        .resize_stress_frames = resize_stress_frames,
+        .trace_path = trace_path,
+        .render_cpu = render_cpu,
+        .render_priority = render_priority,
+        .idle = idle,
+    };
+    memcpy(shared.extra_windows, extra_windows, extra_window_count * sizeof(Window));
+    event_queue_init(&shared.events);
+    atomic_init(&shared.mouse, mouse_pack(0, 0, 0));
+    pthread_mutex_init(&shared.mutex, NULL);
+    shared.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shared.render_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shared.wake_fd < 0 || shared.render_wake_fd < 0) {
+        fprintf(stderr, "eventfd failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    trace_wake_fd = shared.render_wake_fd;
+
+    pthread_t render_thread;
+    if (pthread_create(&render_thread, NULL, render_thread_main, &shared) != 0) {
+        fprintf(stderr, "pthread_create failed for render thread\n");
+        exit(1);
+    }
 
+    // INPUT thread, owns display, only X calls outside of it are those Vulkan makes for presentation
+    // Indexed like AppEvent.window
+    int widths[1 + ENGINE_MAX_VIEWS];
+    int heights[1 + ENGINE_MAX_VIEWS];
+    for (uint32_t i = 0; i <= extra_window_count; i++) {
+        widths[i] = WIDTH;
+        heights[i] = HEIGHT;
+    }
+    int mouse_inside = 0;
+    int mouse_x = 0;
+    int mouse_y = 0;
+
+    for (;;) {
+        PROFILE_BEGIN("event pump");
         while (XPending(display) > 0) {
             XEvent event;
             XNextEvent(display, &event);
 
+            AppEvent app_event;
+            int mouse_changed = 0;
+
+            uint32_t window_id = 0;
+            for (uint32_t i = 0; i < extra_window_count; i++) {
+                if (event.xany.window == extra_windows[i]) {
+                    window_id = i + 1;
+                }
+            }
+            app_event.window = window_id;
+
+            // Idle mode and mouse follow main window only, extra windows just mirror it
+            if (window_id > 0 && event.type != KeyPress && event.type != ConfigureNotify && event.type != ClientMessage) {
+                continue;
+            }
+
             if (event.type == Expose) {
-                // TODO
+                // Last of series, one redraw covers all rectangles
+                if (event.xexpose.count == 0) {
+                    app_event.type = APP_EVENT_EXPOSE;
+                    input_push(&shared, &app_event);
+                }
+            } else if (event.type == VisibilityNotify) {
+                app_event.type = APP_EVENT_VISIBILITY;
+                app_event.state = event.xvisibility.state != VisibilityFullyObscured;
+                input_push(&shared, &app_event);
+            } else if (event.type == MapNotify || event.type == UnmapNotify) {
+                app_event.type = APP_EVENT_MAP;
+                app_event.state = event.type == MapNotify;
+                input_push(&shared, &app_event);
             } else if (event.type == KeyPress) {
-                running = 0;
-                break;
+                app_event.type = APP_EVENT_KEY;
+                input_push(&shared, &app_event);
             } else if (event.type == ConfigureNotify) {
-                if (!(width == event.xconfigure.width &&
-                     height == event.xconfigure.height)) {
-                    width = event.xconfigure.width;
-                    height = event.xconfigure.height;
-                    engine_signal_resize(&engine, width, height);
+                if (!(widths[window_id] == event.xconfigure.width &&
+                     heights[window_id] == event.xconfigure.height)) {
+                    widths[window_id] = event.xconfigure.width;
+                    heights[window_id] = event.xconfigure.height;
+                    app_event.type = APP_EVENT_RESIZE;
+                    app_event.width = widths[window_id];
+                    app_event.height = heights[window_id];
+                    input_push(&shared, &app_event);
                 }
             } else if (event.type == ClientMessage) {
                 if (event.xclient.message_type == WM_PROTOCOLS && (Atom)event.xclient.data.l[0] == WM_DELETE_WINDOW) {
-                    running = 0;
-                    break;
+                    app_event.type = APP_EVENT_QUIT;
+                    input_push(&shared, &app_event);
                 }
             } else if (event.type == MotionNotify) {
                 mouse_x = event.xmotion.x;
                 mouse_y = event.xmotion.y;
+                mouse_changed = 1;
             } else if (event.type == EnterNotify && event.xcrossing.mode == NotifyNormal) {
                 mouse_inside = 1;
+                mouse_changed = 1;
             } else if (event.type == LeaveNotify && event.xcrossing.mode == NotifyNormal) {
                 mouse_inside = 0;
+                mouse_changed = 1;
+            }
+
+            // Not queued, render thread only wants latest position when it latches
+            if (mouse_changed) {
+                atomic_store_explicit(&shared.mouse, mouse_pack(mouse_inside, mouse_x, mouse_y), memory_order_relaxed);
             }
         }
+        PROFILE_END();
 
-        if (!running) {
+        char title_text[sizeof(shared.title)];
+        pthread_mutex_lock(&shared.mutex);
+        int title_pending = shared.title_pending;
+        if (title_pending) {
+            memcpy(title_text, shared.title, sizeof(title_text));
+            shared.title_pending = 0;
+        }
+        int resize_pending = shared.resize_pending;
+        int resize_width = shared.resize_width;
+        int resize_height = shared.resize_height;
+        shared.resize_pending = 0;
+        int render_done = shared.render_done;
+        pthread_mutex_unlock(&shared.mutex);
+
+        if (render_done) {
             break;
         }
-        
-        // float x_ms = diff_time_ms(&debug_timer);
-        // printf("x_ms %.2f ms\n", x_ms);
 
-        engine_draw(&engine, accum_cycle);
+        if (title_pending) {
+            XTextProperty title;
+            char *list[] = {title_text};
+            XStringListToTextProperty(list, 1, &title);
+            XSetWMName(display, window, &title);
+            XFree(title.value);
+        }
+        if (resize_pending) {
+            XResizeWindow(display, window, resize_width, resize_height);
+        }
+        XFlush(display);
+
+        // Vulkan presentation on render thread can read X socket too and queue our events without poll
+        // seeing them, so sleep is bounded and queue is checked again
+        if (XPending(display) == 0) {
+            struct pollfd fds[2] = {
+                {.fd = ConnectionNumber(display), .events = POLLIN},
+                {.fd = shared.wake_fd, .events = POLLIN},
+            };
+            poll(fds, 2, INPUT_POLL_TIMEOUT_MS);
 
-        // nanosleep(&sleep_t, NULL);
+            if (fds[1].revents & POLLIN) {
+                uint64_t wakes;
+                if (read(shared.wake_fd, &wakes, sizeof(wakes)) < 0 && errno != EAGAIN) {
+                    fprintf(stderr, "eventfd read failed: %s\n", strerror(errno));
+                }
+            }
+        }
     }
 
-    engine_deinit(&engine);
+    pthread_join(render_thread, NULL);
+
+    trace_wake_fd = -1;
+    close(shared.render_wake_fd);
+    close(shared.wake_fd);
+    pthread_mutex_destroy(&shared.mutex);
+
+    profiler_deinit();
 
     // Clean up
+    for (uint32_t i = 0; i < extra_window_count; i++) {
+        XDestroyWindow(display, extra_windows[i]);
+    }
     XDestroyWindow(display, window);
     XCloseDisplay(display);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,31 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform Frame {
+    vec2 pixel_to_ndc;
+    float time;
+    float cycle;
+} frame;
+
+// Per instance, packed 12 bytes, see MassInstance
+// Offset in [-1, 1] of OFFSET_RANGE, so objects partially outside of screen are still placed exactly
+layout(location = 0) in vec2 inOffset;
+// Scale in [0, 1] of MAX_SCALE, phase in [0, 1] of cycle
+layout(location = 1) in vec2 inScalePhase;
+layout(location = 2) in vec4 inColor;
+
+layout(location = 0) out vec3 vertexColor;
+
+const float OFFSET_RANGE = 2.0;
+const float MAX_SCALE = 0.5;
+const float TAU = 6.28318531;
+
+void main() {
+    // Same shape and spin as single triangle, every instance is shifted in its cycle
+    float angle = (-frame.cycle - inScalePhase.y - 0.5 + float(gl_VertexIndex) / 3.0) * TAU;
+    vec2 corner = vec2(sin(angle), cos(angle)) * (inScalePhase.x * MAX_SCALE);
+
+    gl_Position = vec4(inOffset * OFFSET_RANGE + corner, 0.0, 1.0);
+
+    // Instance color, darker towards second and third vertex, so spin is visible
+    vertexColor = inColor.rgb * (1.0 - 0.3 * float(gl_VertexIndex));
+}
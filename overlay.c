@@ -0,0 +1,213 @@
+#include "overlay.h"
+
+#include <string.h>
+
+// Rows top to bottom, bit 4 is leftmost pixel. Characters without glyph are drawn empty.
+static const uint8_t overlay_font[OVERLAY_CHAR_COUNT][OVERLAY_GLYPH_HEIGHT] = {
+    [' ' - OVERLAY_FIRST_CHAR] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+    ['!' - OVERLAY_FIRST_CHAR] = {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04},
+    ['%' - OVERLAY_FIRST_CHAR] = {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03},
+    ['(' - OVERLAY_FIRST_CHAR] = {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02},
+    [')' - OVERLAY_FIRST_CHAR] = {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08},
+    ['+' - OVERLAY_FIRST_CHAR] = {0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00},
+    [',' - OVERLAY_FIRST_CHAR] = {0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08},
+    ['-' - OVERLAY_FIRST_CHAR] = {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00},
+    ['.' - OVERLAY_FIRST_CHAR] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c},
+    ['/' - OVERLAY_FIRST_CHAR] = {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},
+    ['0' - OVERLAY_FIRST_CHAR] = {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e},
+    ['1' - OVERLAY_FIRST_CHAR] = {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e},
+    ['2' - OVERLAY_FIRST_CHAR] = {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f},
+    ['3' - OVERLAY_FIRST_CHAR] = {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e},
+    ['4' - OVERLAY_FIRST_CHAR] = {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02},
+    ['5' - OVERLAY_FIRST_CHAR] = {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e},
+    ['6' - OVERLAY_FIRST_CHAR] = {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e},
+    ['7' - OVERLAY_FIRST_CHAR] = {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+    ['8' - OVERLAY_FIRST_CHAR] = {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e},
+    ['9' - OVERLAY_FIRST_CHAR] = {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c},
+    [':' - OVERLAY_FIRST_CHAR] = {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00},
+    ['<' - OVERLAY_FIRST_CHAR] = {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02},
+    ['=' - OVERLAY_FIRST_CHAR] = {0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00},
+    ['>' - OVERLAY_FIRST_CHAR] = {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08},
+    ['?' - OVERLAY_FIRST_CHAR] = {0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04},
+    ['A' - OVERLAY_FIRST_CHAR] = {0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11},
+    ['B' - OVERLAY_FIRST_CHAR] = {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e},
+    ['C' - OVERLAY_FIRST_CHAR] = {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e},
+    ['D' - OVERLAY_FIRST_CHAR] = {0x1e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1e},
+    ['E' - OVERLAY_FIRST_CHAR] = {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f},
+    ['F' - OVERLAY_FIRST_CHAR] = {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10},
+    ['G' - OVERLAY_FIRST_CHAR] = {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f},
+    ['H' - OVERLAY_FIRST_CHAR] = {0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11},
+    ['I' - OVERLAY_FIRST_CHAR] = {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e},
+    ['J' - OVERLAY_FIRST_CHAR] = {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c},
+    ['K' - OVERLAY_FIRST_CHAR] = {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},
+    ['L' - OVERLAY_FIRST_CHAR] = {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f},
+    ['M' - OVERLAY_FIRST_CHAR] = {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11},
+    ['N' - OVERLAY_FIRST_CHAR] = {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},
+    ['O' - OVERLAY_FIRST_CHAR] = {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e},
+    ['P' - OVERLAY_FIRST_CHAR] = {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10},
+    ['Q' - OVERLAY_FIRST_CHAR] = {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d},
+    ['R' - OVERLAY_FIRST_CHAR] = {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11},
+    ['S' - OVERLAY_FIRST_CHAR] = {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e},
+    ['T' - OVERLAY_FIRST_CHAR] = {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+    ['U' - OVERLAY_FIRST_CHAR] = {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e},
+    ['V' - OVERLAY_FIRST_CHAR] = {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04},
+    ['W' - OVERLAY_FIRST_CHAR] = {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a},
+    ['X' - OVERLAY_FIRST_CHAR] = {0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11},
+    ['Y' - OVERLAY_FIRST_CHAR] = {0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04},
+    ['Z' - OVERLAY_FIRST_CHAR] = {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f},
+    ['_' - OVERLAY_FIRST_CHAR] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f},
+
+};
+
+#define OVERLAY_RGBA(r, g, b, a) ((uint32_t)(r) | ((uint32_t)(g) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(a) << 24))
+
+#define OVERLAY_TEXT_COLOR OVERLAY_RGBA(255, 255, 255, 255)
+#define OVERLAY_PANEL_COLOR OVERLAY_RGBA(0, 0, 0, 160)
+#define OVERLAY_LINE_COLOR OVERLAY_RGBA(255, 255, 255, 96)
+
+void overlay_atlas_pixels(uint8_t *pixels) {
+    memset(pixels, 0, OVERLAY_ATLAS_WIDTH * OVERLAY_ATLAS_HEIGHT);
+
+    for (int c = 0; c < OVERLAY_CHAR_COUNT; c++) {
+        int cell_x = (c % OVERLAY_ATLAS_COLUMNS) * OVERLAY_CELL_WIDTH;
+        int cell_y = (c / OVERLAY_ATLAS_COLUMNS) * OVERLAY_CELL_HEIGHT;
+
+        for (int y = 0; y < OVERLAY_GLYPH_HEIGHT; y++) {
+            for (int x = 0; x < OVERLAY_GLYPH_WIDTH; x++) {
+                int on = c + OVERLAY_FIRST_CHAR == OVERLAY_SOLID_CHAR ||
+                         (overlay_font[c][y] >> (OVERLAY_GLYPH_WIDTH - 1 - x)) & 1;
+                pixels[(cell_y + y) * OVERLAY_ATLAS_WIDTH + cell_x + x] = on ? 255 : 0;
+            }
+        }
+    }
+}
+
+void overlay_init(Overlay *o) {
+    memset(o, 0, sizeof(*o));
+    o->graph_ms = 33.3f;
+    o->scale = 2;
+}
+
+void overlay_set_text(Overlay *o, const char *text) {
+    strncpy(o->text, text, OVERLAY_TEXT_SIZE - 1);
+    o->text[OVERLAY_TEXT_SIZE - 1] = '\0';
+}
+
+void overlay_push_frame_time(Overlay *o, float frame_ms) {
+    o->history_ms[o->history_next] = frame_ms;
+    o->history_next = (o->history_next + 1) % OVERLAY_HISTORY;
+}
+
+typedef struct OverlayBatch {
+    OverlayVertex *vertices;
+    uint32_t count;
+    uint32_t max;
+} OverlayBatch;
+
+// Glyph part of cell, whole solid cell is used for rectangles, sampled in its middle
+static
+void overlay_quad(OverlayBatch *b, float x0, float y0, float x1, float y1, int c, uint32_t color) {
+    if (b->count + 6 > b->max) {
+        return;
+    }
+
+    int index = c - OVERLAY_FIRST_CHAR;
+    float u0 = (float)((index % OVERLAY_ATLAS_COLUMNS) * OVERLAY_CELL_WIDTH) / OVERLAY_ATLAS_WIDTH;
+    float v0 = (float)((index / OVERLAY_ATLAS_COLUMNS) * OVERLAY_CELL_HEIGHT) / OVERLAY_ATLAS_HEIGHT;
+    float u1 = u0 + (float)OVERLAY_GLYPH_WIDTH / OVERLAY_ATLAS_WIDTH;
+    float v1 = v0 + (float)OVERLAY_GLYPH_HEIGHT / OVERLAY_ATLAS_HEIGHT;
+
+    OverlayVertex *v = &b->vertices[b->count];
+    v[0] = (OverlayVertex){x0, y0, u0, v0, color};
+    v[1] = (OverlayVertex){x1, y0, u1, v0, color};
+    v[2] = (OverlayVertex){x1, y1, u1, v1, color};
+    v[3] = (OverlayVertex){x0, y0, u0, v0, color};
+    v[4] = (OverlayVertex){x1, y1, u1, v1, color};
+    v[5] = (OverlayVertex){x0, y1, u0, v1, color};
+    b->count += 6;
+}
+
+static
+void overlay_rect(OverlayBatch *b, float x0, float y0, float x1, float y1, uint32_t color) {
+    overlay_quad(b, x0, y0, x1, y1, OVERLAY_SOLID_CHAR, color);
+}
+
+uint32_t overlay_build(const Overlay *o, OverlayVertex *vertices, uint32_t max_vertices) {
+    OverlayBatch b = {
+        .vertices = vertices,
+        .count = 0,
+        .max = max_vertices,
+    };
+
+    float scale = (float)o->scale;
+    float margin = 4 * scale;
+    float advance = OVERLAY_CELL_WIDTH * scale;
+    float line_height = (OVERLAY_CELL_HEIGHT + 2) * scale;
+
+    // Text block size decides panel size
+    int lines = 1;
+    int columns = 0;
+    for (int i = 0, column = 0; o->text[i] != '\0'; i++) {
+        if (o->text[i] == '\n') {
+            lines++;
+            column = 0;
+        } else if (++column > columns) {
+            columns = column;
+        }
+    }
+
+    float bar_width = scale;
+    float graph_width = OVERLAY_HISTORY * bar_width;
+    float graph_height = 24 * scale;
+    float text_width = columns * advance;
+
+    float panel_width = (text_width > graph_width ? text_width : graph_width) + 2 * margin;
+    float panel_height = lines * line_height + graph_height + 3 * margin;
+    overlay_rect(&b, 0, 0, panel_width, panel_height, OVERLAY_PANEL_COLOR);
+
+    {
+        float x = margin;
+        float y = margin;
+        for (int i = 0; o->text[i] != '\0'; i++) {
+            int c = (unsigned char)o->text[i];
+            if (c == '\n') {
+                x = margin;
+                y += line_height;
+                continue;
+            }
+            if (c >= 'a' && c <= 'z') {
+                c -= 'a' - 'A';
+            }
+            if (c > OVERLAY_FIRST_CHAR && c < OVERLAY_SOLID_CHAR) {
+                overlay_quad(&b, x, y, x + OVERLAY_GLYPH_WIDTH * scale, y + OVERLAY_GLYPH_HEIGHT * scale, c, OVERLAY_TEXT_COLOR);
+            }
+            x += advance;
+        }
+    }
+
+    // Sparkline, oldest frame on the left, bar color tells which refresh budget frame missed
+    float graph_x = margin;
+    float graph_bottom = panel_height - margin;
+    for (uint32_t i = 0; i < OVERLAY_HISTORY; i++) {
+        float ms = o->history_ms[(o->history_next + i) % OVERLAY_HISTORY];
+        if (ms <= 0) {
+            continue;
+        }
+
+        float h = ms < o->graph_ms ? ms / o->graph_ms * graph_height : graph_height;
+        uint32_t color = ms <= 16.7f ? OVERLAY_RGBA(64, 224, 64, 255)
+                       : ms <= 33.4f ? OVERLAY_RGBA(240, 200, 32, 255)
+                       : OVERLAY_RGBA(240, 48, 48, 255);
+
+        float x = graph_x + i * bar_width;
+        overlay_rect(&b, x, graph_bottom - h, x + bar_width, graph_bottom, color);
+    }
+
+    // 60 Hz budget line
+    {
+        float y = graph_bottom - 16.7f / o->graph_ms * graph_height;
+        overlay_rect(&b, graph_x, y, graph_x + graph_width, y + 1, OVERLAY_LINE_COLOR);
+    }
+
+    return b.count;
+}
@@ -0,0 +1,59 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stdint.h>
+
+// Stats overlay, CPU side only: bitmap font atlas and quad batch in pixel coordinates.
+// Engine uploads atlas once and draws the batch in its render pass.
+
+#define OVERLAY_FIRST_CHAR 32
+// Printable ASCII and one solid cell at 127, used for rectangles
+#define OVERLAY_CHAR_COUNT 96
+#define OVERLAY_SOLID_CHAR 127
+
+// 5x7 glyphs with one pixel of padding, so nearest sampling never bleeds into neighbour
+#define OVERLAY_GLYPH_WIDTH 5
+#define OVERLAY_GLYPH_HEIGHT 7
+#define OVERLAY_CELL_WIDTH 6
+#define OVERLAY_CELL_HEIGHT 8
+#define OVERLAY_ATLAS_COLUMNS 16
+#define OVERLAY_ATLAS_WIDTH (OVERLAY_ATLAS_COLUMNS * OVERLAY_CELL_WIDTH)
+#define OVERLAY_ATLAS_HEIGHT (OVERLAY_CHAR_COUNT / OVERLAY_ATLAS_COLUMNS * OVERLAY_CELL_HEIGHT)
+
+#define OVERLAY_MAX_QUADS 1024
+#define OVERLAY_MAX_VERTICES (OVERLAY_MAX_QUADS * 6)
+#define OVERLAY_HISTORY 128
+#define OVERLAY_TEXT_SIZE 256
+
+typedef struct OverlayVertex {
+    float x, y;
+    float u, v;
+    // RGBA8, alpha multiplies atlas coverage
+    uint32_t color;
+} OverlayVertex;
+
+typedef struct Overlay {
+    char text[OVERLAY_TEXT_SIZE];
+
+    // Ring of frame times for sparkline
+    float history_ms[OVERLAY_HISTORY];
+    uint32_t history_next;
+    // Frame time of full graph height, longer frames are clamped
+    float graph_ms;
+
+    // Integer scale of glyphs and bars
+    int scale;
+} Overlay;
+
+// OVERLAY_ATLAS_WIDTH * OVERLAY_ATLAS_HEIGHT bytes, one coverage byte per texel
+void overlay_atlas_pixels(uint8_t *pixels);
+
+void overlay_init(Overlay *o);
+// Copied, '\n' starts new line, lowercase is drawn as uppercase
+void overlay_set_text(Overlay *o, const char *text);
+void overlay_push_frame_time(Overlay *o, float frame_ms);
+
+// Returns number of vertices written, triangle list, never more than max_vertices
+uint32_t overlay_build(const Overlay *o, OverlayVertex *vertices, uint32_t max_vertices);
+
+#endif /* OVERLAY_H */
@@ -0,0 +1,22 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform Frame {
+    // 2 / framebuffer size, positions are in pixels from top left
+    vec2 pixel_to_ndc;
+    float time;
+    float cycle;
+} frame;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inUV;
+layout(location = 2) in vec4 inColor;
+
+layout(location = 0) out vec2 fragUV;
+layout(location = 1) out vec4 fragColor;
+
+void main() {
+    gl_Position = vec4(inPosition * frame.pixel_to_ndc - 1.0, 0.0, 1.0);
+
+    fragUV = inUV;
+    fragColor = inColor;
+}
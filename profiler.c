@@ -0,0 +1,187 @@
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef struct ProfilerZone {
+    const char *name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+} ProfilerZone;
+
+typedef struct ProfilerThread {
+    char name[32];
+    int tid;
+    // Only incremented by owner thread, zone index is written & (PROFILER_RING_ZONES - 1)
+    uint64_t written;
+    ProfilerZone *zones;
+
+    // Open zones, closed zone becomes complete event, so ring wrap never leaves unmatched begin/end
+    int depth;
+    const char *open_names[PROFILER_MAX_DEPTH];
+    uint64_t open_start_ns[PROFILER_MAX_DEPTH];
+} ProfilerThread;
+
+int profiler_enabled = 0;
+
+static const char *profiler_trace_path;
+static uint64_t profiler_start_ns;
+static ProfilerThread profiler_threads[PROFILER_MAX_THREADS];
+static int profiler_thread_count;
+static pthread_mutex_t profiler_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local ProfilerThread *profiler_self;
+// Thread which got no slot does not retry, so its markers do not take mutex every time
+static _Thread_local int profiler_self_failed;
+static int profiler_full_warned;
+
+static
+uint64_t profiler_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Allocation happens once per thread on first marker, never after
+static
+ProfilerThread *profiler_thread_get(void) {
+    if (profiler_self != NULL || profiler_self_failed) {
+        return profiler_self;
+    }
+
+    pthread_mutex_lock(&profiler_mutex);
+    if (profiler_thread_count == PROFILER_MAX_THREADS && !profiler_full_warned) {
+        fprintf(stderr, "Profiler: more than %d threads, zones of the rest are dropped\n", PROFILER_MAX_THREADS);
+        profiler_full_warned = 1;
+    }
+    if (profiler_thread_count < PROFILER_MAX_THREADS) {
+        ProfilerThread *t = &profiler_threads[profiler_thread_count];
+        t->zones = calloc(PROFILER_RING_ZONES, sizeof(ProfilerZone));
+        if (t->zones != NULL) {
+            t->tid = profiler_thread_count + 1;
+            snprintf(t->name, sizeof(t->name), "thread %d", t->tid);
+            profiler_thread_count++;
+            profiler_self = t;
+        }
+    }
+    profiler_self_failed = profiler_self == NULL;
+    pthread_mutex_unlock(&profiler_mutex);
+
+    return profiler_self;
+}
+
+void profiler_init(int enabled, const char *trace_path) {
+    profiler_trace_path = trace_path;
+    profiler_start_ns = profiler_now_ns();
+    profiler_enabled = enabled;
+
+    if (enabled) {
+        printf("Profiler: on, %d zones per thread, trace %s\n", PROFILER_RING_ZONES,
+            trace_path != NULL ? trace_path : "on demand");
+    }
+}
+
+void profiler_thread_name(const char *name) {
+    if (!profiler_enabled) {
+        return;
+    }
+
+    ProfilerThread *t = profiler_thread_get();
+    if (t != NULL) {
+        snprintf(t->name, sizeof(t->name), "%s", name);
+    }
+}
+
+void profiler_begin_impl(const char *name) {
+    ProfilerThread *t = profiler_thread_get();
+    if (t == NULL) {
+        return;
+    }
+
+    // Too deep zones are counted but not recorded, so end still matches
+    if (t->depth < PROFILER_MAX_DEPTH) {
+        t->open_names[t->depth] = name;
+        t->open_start_ns[t->depth] = profiler_now_ns();
+    }
+    t->depth++;
+}
+
+void profiler_end_impl(void) {
+    ProfilerThread *t = profiler_self;
+    // Profiler can be enabled between begin and end
+    if (t == NULL || t->depth == 0) {
+        return;
+    }
+
+    t->depth--;
+    if (t->depth >= PROFILER_MAX_DEPTH) {
+        return;
+    }
+
+    ProfilerZone *zone = &t->zones[t->written & (PROFILER_RING_ZONES - 1)];
+    zone->name = t->open_names[t->depth];
+    zone->start_ns = t->open_start_ns[t->depth];
+    zone->duration_ns = profiler_now_ns() - zone->start_ns;
+    __atomic_store_n(&t->written, t->written + 1, __ATOMIC_RELEASE);
+}
+
+int profiler_dump(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror("Cannot write trace");
+        return 0;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"triangle\"}}");
+
+    pthread_mutex_lock(&profiler_mutex);
+    int thread_count = profiler_thread_count;
+    pthread_mutex_unlock(&profiler_mutex);
+
+    uint64_t zone_count = 0;
+    for (int i = 0; i < thread_count; i++) {
+        ProfilerThread *t = &profiler_threads[i];
+
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            t->tid, t->name);
+
+        uint64_t written = __atomic_load_n(&t->written, __ATOMIC_ACQUIRE);
+        uint64_t first = written > PROFILER_RING_ZONES ? written - PROFILER_RING_ZONES : 0;
+        for (uint64_t z = first; z < written; z++) {
+            ProfilerZone *zone = &t->zones[z & (PROFILER_RING_ZONES - 1)];
+            // Trace timestamps are microseconds
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                zone->name, t->tid,
+                (double)(int64_t)(zone->start_ns - profiler_start_ns) / 1000.0, (double)zone->duration_ns / 1000.0);
+        }
+        zone_count += written - first;
+    }
+
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    printf("Profiler: %lu zones written to %s\n", (unsigned long)zone_count, path);
+    return 1;
+}
+
+void profiler_deinit(void) {
+    if (!profiler_enabled) {
+        return;
+    }
+
+    if (profiler_trace_path != NULL) {
+        profiler_dump(profiler_trace_path);
+    }
+
+    profiler_enabled = 0;
+
+    // All threads that recorded must be finished here
+    for (int i = 0; i < profiler_thread_count; i++) {
+        free(profiler_threads[i].zones);
+    }
+    memset(profiler_threads, 0, sizeof(profiler_threads));
+    profiler_thread_count = 0;
+}
@@ -0,0 +1,36 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+#include "thread_pool.h"
+
+// Zone profiler, every thread writes complete zones into own preallocated ring, oldest are overwritten.
+// When disabled each marker is one load and branch.
+
+// Every pool worker plus main, render, input and pipelines threads
+#define PROFILER_MAX_THREADS (THREAD_POOL_MAX_WORKERS + 4)
+#define PROFILER_RING_ZONES 16384
+#define PROFILER_MAX_DEPTH 16
+
+extern int profiler_enabled;
+
+// Path can be NULL, then trace is written only by profiler_dump with explicit path
+void profiler_init(int enabled, const char *trace_path);
+// Optional, names calling thread in trace
+void profiler_thread_name(const char *name);
+
+// Name must be string literal or otherwise outlive profiler
+void profiler_begin_impl(const char *name);
+void profiler_end_impl(void);
+
+// Chrome/Perfetto trace JSON, open in chrome://tracing or ui.perfetto.dev.
+// Other threads keep writing while dump is made, zones being overwritten at that moment can be torn.
+int profiler_dump(const char *path);
+// Dumps to path from profiler_init, if any
+void profiler_deinit(void);
+
+#define PROFILE_BEGIN(name) do { if (profiler_enabled) profiler_begin_impl(name); } while (0)
+#define PROFILE_END() do { if (profiler_enabled) profiler_end_impl(); } while (0)
+
+#endif /* PROFILER_H */
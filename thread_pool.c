@@ -0,0 +1,137 @@
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "profiler.h"
+
+// Takes jobs until batch is drained, returns with mutex held
+static
+void thread_pool_drain(ThreadPool *pool, uint32_t thread) {
+    while (pool->next_job < pool->job_count) {
+        uint32_t job = pool->next_job++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        pool->fn(pool->user, job, thread);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->jobs_left--;
+        if (pool->jobs_left == 0) {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+}
+
+static
+void *thread_pool_worker(void *arg) {
+    ThreadPool *pool = arg;
+
+    pthread_mutex_lock(&pool->mutex);
+    uint32_t thread = ++pool->started;
+    pthread_mutex_unlock(&pool->mutex);
+
+    // Worker which starts late joins batch in progress, drained batch just has nothing left
+    uint64_t seen_generation = 0;
+
+    char name[32];
+    snprintf(name, sizeof(name), "worker %u", thread);
+    profiler_thread_name(name);
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->quit && pool->generation == seen_generation) {
+            pthread_cond_wait(&pool->work_cond, &pool->mutex);
+        }
+        if (pool->quit) {
+            break;
+        }
+        seen_generation = pool->generation;
+
+        thread_pool_drain(pool, thread);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+void thread_pool_init(ThreadPool *pool, uint32_t threads) {
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (uint32_t)online : 1;
+    }
+    if (threads > THREAD_POOL_MAX_WORKERS + 1) {
+        threads = THREAD_POOL_MAX_WORKERS + 1;
+    }
+
+    pool->worker_count = threads - 1;
+    pool->fn = NULL;
+    pool->user = NULL;
+    pool->job_count = 0;
+    pool->generation = 0;
+    pool->quit = 0;
+    pool->next_job = 0;
+    pool->jobs_left = 0;
+    pool->started = 0;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    // Caller is thread 0
+    for (uint32_t i = 0; i < pool->worker_count; i++) {
+        if (pthread_create(&pool->workers[i], NULL, thread_pool_worker, pool) != 0) {
+            fprintf(stderr, "pthread_create failed for pool worker %u\n", i);
+            exit(1);
+        }
+    }
+}
+
+void thread_pool_deinit(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (uint32_t i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+uint32_t thread_pool_threads(const ThreadPool *pool) {
+    return pool->worker_count + 1;
+}
+
+void thread_pool_run(ThreadPool *pool, ThreadPoolFn fn, void *user, uint32_t job_count) {
+    if (job_count == 0) {
+        return;
+    }
+
+    // Nothing to share, skip locking
+    if (pool->worker_count == 0 || job_count == 1) {
+        for (uint32_t job = 0; job < job_count; job++) {
+            fn(user, job, 0);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->fn = fn;
+    pool->user = user;
+    pool->job_count = job_count;
+    pool->next_job = 0;
+    pool->jobs_left = job_count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cond);
+
+    thread_pool_drain(pool, 0);
+
+    while (pool->jobs_left > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,48 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// Fixed set of worker threads running one parallel-for at a time.
+// Caller thread takes jobs too, so pool with zero workers simply runs everything inline.
+
+#define THREAD_POOL_MAX_WORKERS 31
+
+// Called once per job index, from any thread of pool, in any order
+typedef void (*ThreadPoolFn)(void *user, uint32_t job, uint32_t thread);
+
+typedef struct ThreadPool {
+    pthread_t workers[THREAD_POOL_MAX_WORKERS];
+    uint32_t worker_count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+
+    // Current batch, generation tells workers a new one was published
+    ThreadPoolFn fn;
+    void *user;
+    uint32_t job_count;
+    uint64_t generation;
+    int quit;
+
+    // Next job to take and jobs not finished yet, taking a job locks mutex, so jobs should not be tiny
+    uint32_t next_job;
+    uint32_t jobs_left;
+
+    // Workers number themselves from 1 on startup
+    uint32_t started;
+} ThreadPool;
+
+// Zero threads means number of online CPUs, pool uses threads - 1 workers, caller is the last one
+void thread_pool_init(ThreadPool *pool, uint32_t threads);
+void thread_pool_deinit(ThreadPool *pool);
+
+// Threads including caller, thread argument of ThreadPoolFn is below this
+uint32_t thread_pool_threads(const ThreadPool *pool);
+
+// Blocks until all jobs are done, not reentrant, call only from thread which owns pool
+void thread_pool_run(ThreadPool *pool, ThreadPoolFn fn, void *user, uint32_t job_count);
+
+#endif /* THREAD_POOL_H */
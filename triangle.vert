@@ -13,5 +13,6 @@ layout(location = 0) out vec3 vertexColor;
 void main() {
     gl_Position = vec4(inPosition, 0.0, 1.0);
 
-    vertexColor = colors[gl_VertexIndex];
+    // CPU mass geometry draws many triangles from one buffer
+    vertexColor = colors[gl_VertexIndex % 3];
 }
@@ -0,0 +1,455 @@
+#include "vertex_kernel.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VERTEX_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+// Minimax polynomials on [-pi/4, pi/4], same as cephes sinf and cosf
+#define SIN_P0 -1.9515295891e-4f
+#define SIN_P1 8.3321608736e-3f
+#define SIN_P2 -1.6666654611e-1f
+#define COS_P0 2.443315711809948e-5f
+#define COS_P1 -1.388731625493765e-3f
+#define COS_P2 4.166664568298827e-2f
+
+#define TWO_PI 6.28318530717958647692f
+
+// Turns are reduced to nearest quarter q, rest x is in [-pi/4, pi/4]:
+// sin(x + q pi/2) is sin x, cos x, -sin x, -cos x for q mod 4 equal 0, 1, 2, 3, cos is sin one quarter later
+void vertex_kernel_sincos(float turns, float *out_sin, float *out_cos) {
+    float q = nearbyintf(turns * 4.0f);
+    int32_t qi = (int32_t)q;
+    float x = (turns - q * 0.25f) * TWO_PI;
+    float x2 = x * x;
+
+    float s = x + x * x2 * ((SIN_P0 * x2 + SIN_P1) * x2 + SIN_P2);
+    float c = 1.0f - 0.5f * x2 + x2 * x2 * ((COS_P0 * x2 + COS_P1) * x2 + COS_P2);
+
+    float sin_value = (qi & 1) ? c : s;
+    float cos_value = (qi & 1) ? s : c;
+    *out_sin = (qi & 2) ? -sin_value : sin_value;
+    *out_cos = ((qi + 1) & 2) ? -cos_value : cos_value;
+}
+
+static
+void vertex_scalar(const VertexKernelInput *in, uint32_t i, float cycle, float *out_xy) {
+    float s, c;
+    vertex_kernel_sincos(in->angle[i] + cycle, &s, &c);
+    out_xy[i * 2 + 0] = in->center_x[i] + in->radius[i] * s;
+    out_xy[i * 2 + 1] = in->center_y[i] + in->radius[i] * c;
+}
+
+static
+void run_scalar(const VertexKernelInput *in, uint32_t first, uint32_t count, float cycle, float *out_xy) {
+    for (uint32_t i = first; i < first + count; i++) {
+        vertex_scalar(in, i, cycle, out_xy);
+    }
+}
+
+#ifdef VERTEX_KERNEL_X86
+
+// Scalar head until destination is aligned for streaming stores, unless it can never be
+static
+uint32_t head_to_alignment(const VertexKernelInput *in, uint32_t first, uint32_t end, float cycle, float *out_xy,
+                           uintptr_t alignment) {
+    uint32_t i = first;
+    if (((uintptr_t)out_xy & 7) == 0) {
+        while (i < end && ((uintptr_t)(out_xy + i * 2) & (alignment - 1)) != 0) {
+            vertex_scalar(in, i, cycle, out_xy);
+            i++;
+        }
+    }
+    return i;
+}
+
+static
+void sincos_sse2(__m128 turns, __m128 *out_sin, __m128 *out_cos) {
+    // Conversion rounds to nearest with default MXCSR, SSE2 has no round instruction
+    __m128i qi = _mm_cvtps_epi32(_mm_mul_ps(turns, _mm_set1_ps(4.0f)));
+    __m128 q = _mm_cvtepi32_ps(qi);
+    __m128 x = _mm_mul_ps(_mm_sub_ps(turns, _mm_mul_ps(q, _mm_set1_ps(0.25f))), _mm_set1_ps(TWO_PI));
+    __m128 x2 = _mm_mul_ps(x, x);
+
+    __m128 sp = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(SIN_P0), x2), _mm_set1_ps(SIN_P1)), x2), _mm_set1_ps(SIN_P2));
+    __m128 s = _mm_add_ps(x, _mm_mul_ps(_mm_mul_ps(x, x2), sp));
+    __m128 cp = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(COS_P0), x2), _mm_set1_ps(COS_P1)), x2), _mm_set1_ps(COS_P2));
+    __m128 c = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), x2)), _mm_mul_ps(_mm_mul_ps(x2, x2), cp));
+
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(qi, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 sin_value = _mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s));
+    __m128 cos_value = _mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c));
+
+    // Bit 1 of quarter moved to sign bit
+    __m128 sin_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(qi, _mm_set1_epi32(2)), 30));
+    __m128 cos_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(qi, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+    *out_sin = _mm_xor_ps(sin_value, sin_sign);
+    *out_cos = _mm_xor_ps(cos_value, cos_sign);
+}
+
+static
+void run_sse2(const VertexKernelInput *in, uint32_t first, uint32_t count, float cycle, float *out_xy) {
+    uint32_t end = first + count;
+    uint32_t i = head_to_alignment(in, first, end, cycle, out_xy, 16);
+    int stream = ((uintptr_t)(out_xy + i * 2) & 15) == 0;
+
+    __m128 cycle4 = _mm_set1_ps(cycle);
+    for (; i + 4 <= end; i += 4) {
+        __m128 s, c;
+        sincos_sse2(_mm_add_ps(_mm_loadu_ps(in->angle + i), cycle4), &s, &c);
+
+        __m128 r = _mm_loadu_ps(in->radius + i);
+        __m128 x = _mm_add_ps(_mm_loadu_ps(in->center_x + i), _mm_mul_ps(r, s));
+        __m128 y = _mm_add_ps(_mm_loadu_ps(in->center_y + i), _mm_mul_ps(r, c));
+
+        // x0 y0 x1 y1 and x2 y2 x3 y3
+        __m128 v0 = _mm_unpacklo_ps(x, y);
+        __m128 v1 = _mm_unpackhi_ps(x, y);
+        if (stream) {
+            _mm_stream_ps(out_xy + i * 2, v0);
+            _mm_stream_ps(out_xy + i * 2 + 4, v1);
+        } else {
+            _mm_storeu_ps(out_xy + i * 2, v0);
+            _mm_storeu_ps(out_xy + i * 2 + 4, v1);
+        }
+    }
+
+    for (; i < end; i++) {
+        vertex_scalar(in, i, cycle, out_xy);
+    }
+
+    // Streaming stores are weakly ordered, they must land before buffer is flushed and submitted
+    _mm_sfence();
+}
+
+__attribute__((target("avx2,fma")))
+static
+void sincos_avx2(__m256 turns, __m256 *out_sin, __m256 *out_cos) {
+    __m256 q = _mm256_round_ps(_mm256_mul_ps(turns, _mm256_set1_ps(4.0f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256i qi = _mm256_cvtps_epi32(q);
+    __m256 x = _mm256_mul_ps(_mm256_fnmadd_ps(q, _mm256_set1_ps(0.25f), turns), _mm256_set1_ps(TWO_PI));
+    __m256 x2 = _mm256_mul_ps(x, x);
+
+    __m256 sp = _mm256_fmadd_ps(_mm256_fmadd_ps(_mm256_set1_ps(SIN_P0), x2, _mm256_set1_ps(SIN_P1)), x2, _mm256_set1_ps(SIN_P2));
+    __m256 s = _mm256_fmadd_ps(_mm256_mul_ps(x, x2), sp, x);
+    __m256 cp = _mm256_fmadd_ps(_mm256_fmadd_ps(_mm256_set1_ps(COS_P0), x2, _mm256_set1_ps(COS_P1)), x2, _mm256_set1_ps(COS_P2));
+    __m256 c = _mm256_fmadd_ps(_mm256_mul_ps(x2, x2), cp, _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), x2, _mm256_set1_ps(1.0f)));
+
+    __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(qi, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+    __m256 sin_value = _mm256_blendv_ps(s, c, swap);
+    __m256 cos_value = _mm256_blendv_ps(c, s, swap);
+
+    __m256 sin_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(qi, _mm256_set1_epi32(2)), 30));
+    __m256 cos_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(qi, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+    *out_sin = _mm256_xor_ps(sin_value, sin_sign);
+    *out_cos = _mm256_xor_ps(cos_value, cos_sign);
+}
+
+__attribute__((target("avx2,fma")))
+static
+void run_avx2(const VertexKernelInput *in, uint32_t first, uint32_t count, float cycle, float *out_xy) {
+    uint32_t end = first + count;
+    uint32_t i = head_to_alignment(in, first, end, cycle, out_xy, 32);
+    int stream = ((uintptr_t)(out_xy + i * 2) & 31) == 0;
+
+    __m256 cycle8 = _mm256_set1_ps(cycle);
+    for (; i + 8 <= end; i += 8) {
+        __m256 s, c;
+        sincos_avx2(_mm256_add_ps(_mm256_loadu_ps(in->angle + i), cycle8), &s, &c);
+
+        __m256 r = _mm256_loadu_ps(in->radius + i);
+        __m256 x = _mm256_fmadd_ps(r, s, _mm256_loadu_ps(in->center_x + i));
+        __m256 y = _mm256_fmadd_ps(r, c, _mm256_loadu_ps(in->center_y + i));
+
+        // Unpack works within 128 bit lanes: x0 y0 x1 y1 | x4 y4 x5 y5 and x2 y2 x3 y3 | x6 y6 x7 y7
+        __m256 lo = _mm256_unpacklo_ps(x, y);
+        __m256 hi = _mm256_unpackhi_ps(x, y);
+        __m256 v0 = _mm256_permute2f128_ps(lo, hi, 0x20);
+        __m256 v1 = _mm256_permute2f128_ps(lo, hi, 0x31);
+        if (stream) {
+            _mm256_stream_ps(out_xy + i * 2, v0);
+            _mm256_stream_ps(out_xy + i * 2 + 8, v1);
+        } else {
+            _mm256_storeu_ps(out_xy + i * 2, v0);
+            _mm256_storeu_ps(out_xy + i * 2 + 8, v1);
+        }
+    }
+
+    for (; i < end; i++) {
+        vertex_scalar(in, i, cycle, out_xy);
+    }
+
+    _mm_sfence();
+}
+
+#endif
+
+int vertex_kernel_isa_supported(VertexKernelIsa isa) {
+    switch (isa) {
+    case VERTEX_KERNEL_SCALAR:
+        return 1;
+#ifdef VERTEX_KERNEL_X86
+    case VERTEX_KERNEL_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case VERTEX_KERNEL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    default:
+        return 0;
+    }
+}
+
+VertexKernelIsa vertex_kernel_best_isa(void) {
+    static int best = -1;
+    if (best < 0) {
+        best = VERTEX_KERNEL_SCALAR;
+        for (int isa = VERTEX_KERNEL_SCALAR; isa < VERTEX_KERNEL_ISA_COUNT; isa++) {
+            if (vertex_kernel_isa_supported((VertexKernelIsa)isa)) {
+                best = isa;
+            }
+        }
+    }
+    return (VertexKernelIsa)best;
+}
+
+const char *vertex_kernel_isa_name(VertexKernelIsa isa) {
+    switch (isa) {
+    case VERTEX_KERNEL_SCALAR: return "scalar";
+    case VERTEX_KERNEL_SSE2: return "sse2";
+    case VERTEX_KERNEL_AVX2: return "avx2";
+    default: return "unknown";
+    }
+}
+
+void vertex_kernel_run(VertexKernelIsa isa, const VertexKernelInput *in, uint32_t first, uint32_t count,
+                       float cycle, float *out_xy) {
+    switch (isa) {
+#ifdef VERTEX_KERNEL_X86
+    case VERTEX_KERNEL_SSE2:
+        run_sse2(in, first, count, cycle, out_xy);
+        break;
+    case VERTEX_KERNEL_AVX2:
+        run_avx2(in, first, count, cycle, out_xy);
+        break;
+#endif
+    default:
+        run_scalar(in, first, count, cycle, out_xy);
+        break;
+    }
+}
+
+typedef struct VertexKernelJob {
+    VertexKernelIsa isa;
+    const VertexKernelInput *in;
+    float cycle;
+    float *out_xy;
+} VertexKernelJob;
+
+static
+void vertex_kernel_job(void *user, uint32_t job, uint32_t thread) {
+    (void)thread;
+    VertexKernelJob *j = user;
+
+    uint32_t first = job * VERTEX_KERNEL_CHUNK;
+    uint32_t count = j->in->count - first < VERTEX_KERNEL_CHUNK ? j->in->count - first : VERTEX_KERNEL_CHUNK;
+    vertex_kernel_run(j->isa, j->in, first, count, j->cycle, j->out_xy);
+}
+
+void vertex_kernel_run_parallel(ThreadPool *pool, VertexKernelIsa isa, const VertexKernelInput *in,
+                                float cycle, float *out_xy) {
+    if (pool == NULL || in->count <= VERTEX_KERNEL_CHUNK) {
+        vertex_kernel_run(isa, in, 0, in->count, cycle, out_xy);
+        return;
+    }
+
+    VertexKernelJob job = {
+        .isa = isa,
+        .in = in,
+        .cycle = cycle,
+        .out_xy = out_xy,
+    };
+
+    thread_pool_run(pool, vertex_kernel_job, &job, (in->count + VERTEX_KERNEL_CHUNK - 1) / VERTEX_KERNEL_CHUNK);
+}
+
+// CHECK and BENCH, run by --bench-vertex, need no Vulkan
+
+#define CHECK_SINCOS_SAMPLES 1000000
+// Absolute error against libm double, radius is at most 1 in NDC, so this is below pixel size of any window
+#define CHECK_SINCOS_MAX_ERROR 5e-7
+#define CHECK_VERTEX_MAX_ERROR 4e-6
+
+static
+double elapsed_ns(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1e9 + (t1.tv_nsec - t0->tv_nsec);
+}
+
+// Deterministic inputs, centers and radii in NDC range, angles cover several turns both ways
+static
+float *check_input_init(VertexKernelInput *in, uint32_t count) {
+    float *storage = malloc((size_t)count * 4 * sizeof(float));
+    if (storage == NULL) {
+        fprintf(stderr, "Unable to allocate vertex kernel input for %u vertices\n", count);
+        exit(1);
+    }
+
+    float *center_x = storage;
+    float *center_y = storage + count;
+    float *radius = storage + (size_t)count * 2;
+    float *angle = storage + (size_t)count * 3;
+
+    uint32_t state = 12345;
+    for (uint32_t i = 0; i < count; i++) {
+        state = state * 1664525u + 1013904223u;
+        center_x[i] = (int32_t)state / 2147483648.0f;
+        state = state * 1664525u + 1013904223u;
+        center_y[i] = (int32_t)state / 2147483648.0f;
+        state = state * 1664525u + 1013904223u;
+        radius[i] = (state >> 8) / 16777216.0f;
+        state = state * 1664525u + 1013904223u;
+        angle[i] = (int32_t)state / 2147483648.0f * 4.0f;
+    }
+
+    in->center_x = center_x;
+    in->center_y = center_y;
+    in->radius = radius;
+    in->angle = angle;
+    in->count = count;
+    return storage;
+}
+
+// Largest difference from libm evaluated in double, output is offset by one float, so streaming path has scalar head
+static
+double check_vertices(ThreadPool *pool, VertexKernelIsa isa, const VertexKernelInput *in, float cycle, int misalign) {
+    float *storage = malloc(((size_t)in->count * 2 + 32) * sizeof(float));
+    if (storage == NULL) {
+        fprintf(stderr, "Unable to allocate vertex kernel output for %u vertices\n", in->count);
+        exit(1);
+    }
+    // 64 byte aligned start, then shifted by whole vertex, which SIMD levels must handle with scalar head
+    float *out_xy = (float *)(((uintptr_t)storage + 63) & ~(uintptr_t)63) + (misalign ? 2 : 0);
+
+    vertex_kernel_run_parallel(pool, isa, in, cycle, out_xy);
+
+    double max_error = 0;
+    for (uint32_t i = 0; i < in->count; i++) {
+        double a = 2.0 * M_PI * ((double)in->angle[i] + (double)cycle);
+        double x = (double)in->center_x[i] + (double)in->radius[i] * sin(a);
+        double y = (double)in->center_y[i] + (double)in->radius[i] * cos(a);
+        max_error = fmax(max_error, fabs((double)out_xy[i * 2 + 0] - x));
+        max_error = fmax(max_error, fabs((double)out_xy[i * 2 + 1] - y));
+    }
+
+    free(storage);
+    return max_error;
+}
+
+int vertex_kernel_check(ThreadPool *pool) {
+    int ok = 1;
+
+    // Argument is sum of angle and cycle, so few turns either way is what kernel sees
+    double max_sin = 0, max_cos = 0;
+    for (uint32_t i = 0; i <= CHECK_SINCOS_SAMPLES; i++) {
+        float turns = -4.0f + 8.0f * i / CHECK_SINCOS_SAMPLES;
+        float s, c;
+        vertex_kernel_sincos(turns, &s, &c);
+        double a = 2.0 * M_PI * (double)turns;
+        max_sin = fmax(max_sin, fabs((double)s - sin(a)));
+        max_cos = fmax(max_cos, fabs((double)c - cos(a)));
+    }
+    int sincos_ok = max_sin <= CHECK_SINCOS_MAX_ERROR && max_cos <= CHECK_SINCOS_MAX_ERROR;
+    printf("sincos: max error sin %.3g, cos %.3g, %s\n", max_sin, max_cos, sincos_ok ? "ok" : "FAILED");
+    ok = ok && sincos_ok;
+
+    // Odd count leaves tail after last full vector, two chunks and a bit go through pool
+    static const uint32_t counts[] = {1, 3, 7, 1001, VERTEX_KERNEL_CHUNK * 2 + 5};
+    for (int isa = VERTEX_KERNEL_SCALAR; isa < VERTEX_KERNEL_ISA_COUNT; isa++) {
+        if (!vertex_kernel_isa_supported((VertexKernelIsa)isa)) {
+            printf("%-8s not supported\n", vertex_kernel_isa_name((VertexKernelIsa)isa));
+            continue;
+        }
+
+        double max_error = 0;
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+            VertexKernelInput in;
+            float *storage = check_input_init(&in, counts[c]);
+            for (int misalign = 0; misalign < 2; misalign++) {
+                max_error = fmax(max_error, check_vertices(pool, (VertexKernelIsa)isa, &in, 0.37f, misalign));
+            }
+            free(storage);
+        }
+
+        int isa_ok = max_error <= CHECK_VERTEX_MAX_ERROR;
+        printf("%-8s vertices: max error %.3g, %s\n", vertex_kernel_isa_name((VertexKernelIsa)isa), max_error,
+            isa_ok ? "ok" : "FAILED");
+        ok = ok && isa_ok;
+    }
+
+    return ok;
+}
+
+#define BENCH_VERTEX_REPEATS 20
+
+void vertex_kernel_bench(ThreadPool *pool, uint32_t count) {
+    VertexKernelInput in;
+    float *storage = check_input_init(&in, count);
+
+    float *out_xy = aligned_alloc(64, ((size_t)count * 2 * sizeof(float) + 63) & ~(size_t)63);
+    if (out_xy == NULL) {
+        fprintf(stderr, "Unable to allocate vertex kernel output for %u vertices\n", count);
+        exit(1);
+    }
+
+    // libm loop is what engine used to do per vertex, kept as baseline
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int r = 0; r < BENCH_VERTEX_REPEATS; r++) {
+        float cycle = r / (float)BENCH_VERTEX_REPEATS;
+        for (uint32_t i = 0; i < count; i++) {
+            float a = (in.angle[i] + cycle) * 2.0f * (float)M_PI;
+            out_xy[i * 2 + 0] = in.center_x[i] + in.radius[i] * sinf(a);
+            out_xy[i * 2 + 1] = in.center_y[i] + in.radius[i] * cosf(a);
+        }
+    }
+    double libm_ns = elapsed_ns(&t0) / BENCH_VERTEX_REPEATS;
+
+    printf("Vertex kernel, %u vertices, %u threads\n", count, pool != NULL ? thread_pool_threads(pool) : 1);
+    printf("%-8s %14s %14s\n", "isa", "1 thread v/ns", "pool v/ns");
+    printf("%-8s %14.3f %14s\n", "libm", count / libm_ns, "-");
+
+    for (int isa = VERTEX_KERNEL_SCALAR; isa < VERTEX_KERNEL_ISA_COUNT; isa++) {
+        if (!vertex_kernel_isa_supported((VertexKernelIsa)isa)) {
+            continue;
+        }
+
+        // Warm up, so first touch of output pages is not measured
+        vertex_kernel_run((VertexKernelIsa)isa, &in, 0, count, 0.0f, out_xy);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int r = 0; r < BENCH_VERTEX_REPEATS; r++) {
+            vertex_kernel_run((VertexKernelIsa)isa, &in, 0, count, r / (float)BENCH_VERTEX_REPEATS, out_xy);
+        }
+        double single_ns = elapsed_ns(&t0) / BENCH_VERTEX_REPEATS;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int r = 0; r < BENCH_VERTEX_REPEATS; r++) {
+            vertex_kernel_run_parallel(pool, (VertexKernelIsa)isa, &in, r / (float)BENCH_VERTEX_REPEATS, out_xy);
+        }
+        double pool_ns = elapsed_ns(&t0) / BENCH_VERTEX_REPEATS;
+
+        printf("%-8s %14.3f %14.3f\n", vertex_kernel_isa_name((VertexKernelIsa)isa), count / single_ns, count / pool_ns);
+    }
+
+    free(out_xy);
+    free(storage);
+}
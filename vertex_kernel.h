@@ -0,0 +1,56 @@
+#ifndef VERTEX_KERNEL_H
+#define VERTEX_KERNEL_H
+
+#include <stdint.h>
+
+#include "thread_pool.h"
+
+// CPU vertex animation, every vertex turns around its own center:
+//   x = center_x + radius * sin(2 pi (angle + cycle))
+//   y = center_y + radius * cos(2 pi (angle + cycle))
+// Inputs are structure of arrays, output is interleaved x, y pairs, written straight into vertex buffer.
+// SIMD levels use polynomial sincos and streaming stores, so output is not pulled into cache.
+
+// Vertices per parallel job, multiple of 8, so every job starts at same alignment
+#define VERTEX_KERNEL_CHUNK 16384
+
+typedef enum VertexKernelIsa {
+    VERTEX_KERNEL_SCALAR,
+    VERTEX_KERNEL_SSE2,
+    VERTEX_KERNEL_AVX2,
+    VERTEX_KERNEL_ISA_COUNT,
+} VertexKernelIsa;
+
+typedef struct VertexKernelInput {
+    const float *center_x;
+    const float *center_y;
+    const float *radius;
+    // In turns
+    const float *angle;
+    uint32_t count;
+} VertexKernelInput;
+
+int vertex_kernel_isa_supported(VertexKernelIsa isa);
+// Highest level CPU and OS support, detected on first call
+VertexKernelIsa vertex_kernel_best_isa(void);
+const char *vertex_kernel_isa_name(VertexKernelIsa isa);
+
+// Scalar version of polynomial every level uses, abs error is within few float ulp of 1
+void vertex_kernel_sincos(float turns, float *out_sin, float *out_cos);
+
+// Vertices [first, first + count), out_xy is whole output, vertex i goes to out_xy[2 * i] and out_xy[2 * i + 1]
+void vertex_kernel_run(VertexKernelIsa isa, const VertexKernelInput *in, uint32_t first, uint32_t count,
+                       float cycle, float *out_xy);
+
+// All vertices, batches above one chunk are split over pool, NULL pool runs on caller
+void vertex_kernel_run_parallel(ThreadPool *pool, VertexKernelIsa isa, const VertexKernelInput *in,
+                                float cycle, float *out_xy);
+
+// Compares every supported level against libm, also with unaligned output and tails, prints results,
+// returns 0 if any error is above limit
+int vertex_kernel_check(ThreadPool *pool);
+
+// Prints vertices per nanosecond of libm loop and of every supported level, on caller and on pool
+void vertex_kernel_bench(ThreadPool *pool, uint32_t count);
+
+#endif /* VERTEX_KERNEL_H */